@@ -1 +1 @@
-rm -rf lang lang.js lang.wasm lang.data
+rm -rf lang lang.js lang.wasm lang.data lang_bootstrap prelude.h runtime.h
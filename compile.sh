@@ -1,9 +1,24 @@
 TARGET=$1
+PRELUDE="stl.lang"
+
+build_prelude() {
+    # Parse the prelude with a host build of the interpreter, and embed it as prelude.h,
+    # along with the runtime of compiled programs (runtime.h, for --emit-c):
+    gcc lang.c -Wall -Wshadow -O1 -pthread -DNO_PRELUDE -o lang_bootstrap &&
+        ./lang_bootstrap --build-prelude prelude.h $PRELUDE &&
+        ./lang_bootstrap --build-runtime runtime.h runtime.c &&
+        rm -f lang_bootstrap
+}
+
 if [ "$TARGET" = "gcc" ]; then
-    gcc lang.c -Wall -Wshadow -Ofast -o lang
+    build_prelude &&
+        gcc lang.c -Wall -Wshadow -Ofast -pthread -o lang
 elif [ "$TARGET" = "emcc" ]; then
-    emcc lang.c -s WASM=1 -s FORCE_FILESYSTEM=1 -s EXIT_RUNTIME=1 -s INVOKE_RUN=0 -s MODULARIZE=1 -s 'EXPORT_NAME="MyCode"' -s 'EXTRA_EXPORTED_RUNTIME_METHODS=["FS", "callMain"]' -s ALLOW_MEMORY_GROWTH=1 -o lang.js
+    build_prelude &&
+        # (the page passes sources to run_code() in memory, so there is no main() or file system)
+        emcc lang.c -O3 -DLANG_NO_MAIN -s WASM=1 -s FILESYSTEM=0 -s ENVIRONMENT=worker -s EXIT_RUNTIME=0 -s INVOKE_RUN=0 -s MODULARIZE=1 -s 'EXPORT_NAME="MyCode"' -s 'EXPORTED_FUNCTIONS=["_run_code"]' -s 'EXPORTED_RUNTIME_METHODS=["ccall"]' -s ALLOW_MEMORY_GROWTH=1 -o lang.js &&
+        # (the worker asks for lang.wasm, and caches it, by this hash; see worker.js)
+        echo "var LANG_BUILD = '$(sha256sum lang.wasm | cut -c1-16)';" >> lang.js
 else
     echo "Usage: ./compile.sh (gcc|emcc)"
 fi
-
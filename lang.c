@@ -12,13 +12,39 @@
 #include <ctype.h>
 #include <stdarg.h>
 #include <limits.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <time.h>
+#include <errno.h>
+
+#include "lang.h"
+
+#ifdef __EMSCRIPTEN__
+#include <emscripten.h>
+// Lets the page show the output of a long run as it goes (see worker.js):
+EM_JS(void, flush_output, (void), {
+    if (Module['onFlush']) Module['onFlush']();
+});
+#else
+#include <pthread.h>
+#define EMSCRIPTEN_KEEPALIVE
+#endif
 
 #define DEBUG
 
+#define LANG_VERSION "0.2"
+
 #define MAX_INPUT_LEN 100000
+#define STREAM_CHUNK_SIZE 65536  // read at once by lang_run_stream()
 #define SINGLE_CHAR_TOKENS "()[],+-*/=?:"
-#define SYSTEM_FUNCTION_TOKENS "+-*/=?%:"
+#define SYSTEM_FUNCTION_TOKENS "+-*/=?%:@"
 #define DEFAULT_HASHTABLE_SIZE 100
+#define DEFAULT_INLINE_SIZE 12  // expressions in a function body
 #define HASH_TYPE long long
 #define streq(a, b) (strcmp((a), (b)) == 0)
 
@@ -40,6 +66,8 @@
 #define HASH_OF_READ_CHAR 375212875132050
 #define HASH_OF_PRINT     356168244
 #define HASH_OF_GET       338196
+#define HASH_OF_LEN       343310
+#define HASH_OF_AT        288
 #define HASH_OF_NULL      9985484
 #define HASH_OF_ANY       298521
 #define HASH_OF_TRUE      10179301
@@ -58,18 +86,288 @@ bool member_of(char c, char * set)
     return false;
 }
 
+// Reports an error to the interpreter running on this thread (see INTERPRETER):
+void fail(const char * fmt, ...);
+void fail_with(int status, const char * fmt, ...);
+
 #define expect(condition, ...)             \
     do {                                   \
         if (!(condition)) {                \
-            fprintf(stderr, __VA_ARGS__);  \
-            exit(EXIT_FAILURE);            \
+            fail(__VA_ARGS__);             \
         }                                  \
     } while (0);
 
+/*
+ * The runtime objects (expressions, queues, thunks, results, strings and lists)
+ * are allocated with heap_alloc(), from the active Heap of the interpreter
+ * running on this thread (it has one for each lifetime, see Interp). A heap
+ * counts the bytes in use, so that an interpreter can limit it, and owns all
+ * of its memory, which is released at once by release_heap(). Outside of an
+ * interpreter (e.g. in the compiler), objects come from a heap of the thread's
+ * own.
+ */
+#define SLAB_GRANULE 16
+#define SLAB_CLASSES 8  // objects up to 128 bytes
+#define SLAB_MAX     (SLAB_CLASSES * SLAB_GRANULE)
+#define SLAB_SIZE    (64 * 1024)
+
+struct Heap;
+
+struct FreeObject {
+    struct FreeObject * next;
+} typedef FreeObject;
+
+/*
+ * Small objects come from slabs, in size classes of SLAB_GRANULE bytes. A slab
+ * is aligned to its size, so an object finds its slab (and so its heap) from
+ * its address. Freed objects go on the heap's free list for their class, and
+ * are reused by the next allocation of that class. Larger objects are
+ * malloc()ed with a header of their own.
+ */
+struct Slab {
+    struct Heap * heap;
+    struct Slab * next;
+} typedef Slab;
+
+struct Block {
+    struct Heap * heap;
+    struct Block * prev;
+    struct Block * next;
+} typedef Block;
+
+// (rounded up, so that the memory after a header stays 16-byte aligned)
+#define SLAB_HEADER_SIZE  ((sizeof(Slab) + 15) & ~(size_t)15)
+#define BLOCK_HEADER_SIZE ((sizeof(Block) + 15) & ~(size_t)15)
+
+struct Heap {
+    size_t bytes;
+    size_t peak;
+    size_t limit;  // 0 if unlimited
+    FreeObject * free_lists[SLAB_CLASSES];
+    char * slab_next;  // the unused part of the newest slab
+    size_t slab_left;
+    Slab * slabs;
+    Block * blocks;
+} typedef Heap;
+
+_Thread_local Heap * active_heap = NULL;
+_Thread_local Heap thread_heap;
+
+void init_heap(Heap * h, size_t limit)
+{
+    memset(h, 0, sizeof(Heap));
+    h->limit = limit;
+}
+
+size_t slab_class(size_t size)
+{
+    return size == 0 ? 0 : (size - 1) / SLAB_GRANULE;
+}
+
+void * slab_alloc(Heap * h, size_t size)
+{
+    size_t c = slab_class(size);
+    FreeObject * obj = h->free_lists[c];
+    if (obj != NULL) {
+        h->free_lists[c] = obj->next;
+        return obj;
+    }
+    size_t csize = (c + 1) * SLAB_GRANULE;
+    if (h->slab_left < csize) {
+        Slab * slab = aligned_alloc(SLAB_SIZE, SLAB_SIZE);
+        expect(slab != NULL, "Error: Out of memory.\n");
+        slab->heap = h;
+        slab->next = h->slabs;
+        h->slabs = slab;
+        h->slab_next = (char *)slab + SLAB_HEADER_SIZE;
+        h->slab_left = SLAB_SIZE - SLAB_HEADER_SIZE;
+    }
+    void * p = h->slab_next;
+    h->slab_next += csize;
+    h->slab_left -= csize;
+    return p;
+}
+
+void * block_alloc(Heap * h, size_t size)
+{
+    Block * b = malloc(BLOCK_HEADER_SIZE + size);
+    expect(b != NULL, "Error: Out of memory.\n");
+    b->heap = h;
+    b->prev = NULL;
+    b->next = h->blocks;
+    if (h->blocks != NULL) h->blocks->prev = b;
+    h->blocks = b;
+    return (char *)b + BLOCK_HEADER_SIZE;
+}
+
+void block_free(void * p)
+{
+    Block * b = (Block *)((char *)p - BLOCK_HEADER_SIZE);
+    Heap * h = b->heap;
+    if (b->prev != NULL) b->prev->next = b->next;
+    else h->blocks = b->next;
+    if (b->next != NULL) b->next->prev = b->prev;
+    free(b);
+}
+
+void * heap_alloc_in(Heap * h, size_t size)
+{
+    if (h->limit != 0 && h->bytes + size > h->limit) {
+        fail_with(LANG_OUT_OF_MEMORY, "Error: Heap limit of %zu bytes exceeded.\n", h->limit);
+    }
+    h->bytes += size;
+    if (h->bytes > h->peak) h->peak = h->bytes;
+    if (size <= SLAB_MAX) return slab_alloc(h, size);
+    return block_alloc(h, size);
+}
+
+void * heap_alloc(size_t size)
+{
+    return heap_alloc_in(active_heap != NULL ? active_heap : &thread_heap, size);
+}
+
+void heap_free(void * p, size_t size)
+{
+    // (to the heap the object came from, which need not be the active one)
+    Heap * h;
+    if (size <= SLAB_MAX) {
+        h = ((Slab *)((uintptr_t)p & ~(uintptr_t)(SLAB_SIZE - 1)))->heap;
+        FreeObject * obj = p;
+        size_t c = slab_class(size);
+        obj->next = h->free_lists[c];
+        h->free_lists[c] = obj;
+    } else {
+        h = ((Block *)((char *)p - BLOCK_HEADER_SIZE))->heap;
+        block_free(p);
+    }
+    h->bytes = size > h->bytes ? 0 : h->bytes - size;
+}
+
+void release_heap(Heap * h)
+{
+    // Frees all of the memory of a heap at once, whatever is still allocated
+    // (but keeps its limit, and its peak for the statistics).
+    for (Slab * slab = h->slabs, * next; slab != NULL; slab = next) {
+        next = slab->next;
+        free(slab);
+    }
+    for (Block * b = h->blocks, * next; b != NULL; b = next) {
+        next = b->next;
+        free(b);
+    }
+    size_t peak = h->peak;
+    init_heap(h, h->limit);
+    h->peak = peak;
+}
+
+void heap_adopt(Heap * h, Heap * other)
+{
+    // Moves the memory of other into h, leaving other empty.
+    while (other->slabs != NULL) {
+        Slab * slab = other->slabs;
+        other->slabs = slab->next;
+        slab->heap = h;
+        slab->next = h->slabs;
+        h->slabs = slab;
+    }
+    while (other->blocks != NULL) {
+        Block * b = other->blocks;
+        other->blocks = b->next;
+        b->heap = h;
+        b->prev = NULL;
+        b->next = h->blocks;
+        if (h->blocks != NULL) h->blocks->prev = b;
+        h->blocks = b;
+    }
+    for (size_t c = 0; c < SLAB_CLASSES; c++) {
+        while (other->free_lists[c] != NULL) {
+            FreeObject * obj = other->free_lists[c];
+            other->free_lists[c] = obj->next;
+            obj->next = h->free_lists[c];
+            h->free_lists[c] = obj;
+        }
+    }
+    // (h keeps allocating from its own newest slab)
+    h->bytes += other->bytes;
+    if (h->bytes > h->peak) h->peak = h->bytes;
+    init_heap(other, other->limit);
+}
+
+/*
+ * An arena hands out memory which is only released all at once, by
+ * destroy_arena(). It holds the syntax tree of a program (see parse_program()).
+ */
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+struct ArenaChunk {
+    struct ArenaChunk * next;
+    size_t size;
+    size_t used;
+} typedef ArenaChunk;
+
+// (rounded up, so that the memory after the header stays 16-byte aligned)
+#define ARENA_HEADER_SIZE ((sizeof(ArenaChunk) + 15) & ~(size_t)15)
+
+struct Arena {
+    ArenaChunk * chunks;  // the newest first
+    Heap * heap;          // where the chunks come from (the active one when it was made)
+} typedef Arena;
+
+Arena * new_arena()
+{
+    Arena * a = heap_alloc(sizeof(Arena));
+    a->chunks = NULL;
+    a->heap = active_heap != NULL ? active_heap : &thread_heap;
+    return a;
+}
+
+void * arena_alloc(Arena * a, size_t size)
+{
+    size = (size + 15) & ~(size_t)15;
+    ArenaChunk * c = a->chunks;
+    if (c == NULL || c->size - c->used < size) {
+        size_t csize = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+        c = heap_alloc_in(a->heap, ARENA_HEADER_SIZE + csize);
+        c->next = a->chunks;
+        c->size = csize;
+        c->used = 0;
+        a->chunks = c;
+    }
+    void * p = (char *)c + ARENA_HEADER_SIZE + c->used;
+    c->used += size;
+    return p;
+}
+
+void arena_adopt(Arena * a, Arena * other)
+{
+    // Moves the memory of other into a, and destroys other.
+    ArenaChunk * last = other->chunks;
+    if (last != NULL) {
+        while (last->next != NULL) last = last->next;
+        if (a->chunks == NULL) {
+            a->chunks = other->chunks;
+        } else {
+            // (a's newest chunk stays first, to be allocated from)
+            last->next = a->chunks->next;
+            a->chunks->next = other->chunks;
+        }
+    }
+    heap_free(other, sizeof(Arena));
+}
+
+void destroy_arena(Arena * a)
+{
+    for (ArenaChunk * c = a->chunks, * next; c != NULL; c = next) {
+        next = c->next;
+        heap_free(c, ARENA_HEADER_SIZE + c->size);
+    }
+    heap_free(a, sizeof(Arena));
+}
+
 void substring(char * dst, char * src, int l, int r)
 {
-    int n = strlen(src) + 1, j = 0;
-    for (int i = l; i < r && i < n && src[i] != '\0'; i++) {
+    int j = 0;
+    for (int i = l; i < r && src[i] != '\0'; i++) {
         dst[j++] = src[i];
     }
     dst[j] = '\0';
@@ -101,20 +399,44 @@ HASH_TYPE hash_string(char * s)
     return h;
 }
 
-char * read_file(char * fname)
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+
+unsigned long long fnv1a(unsigned long long h, const void * data, size_t len)
 {
-    char * line;
-    FILE * fp;
-    size_t len = 0;
-    char * input = new_string(MAX_INPUT_LEN);
+    // 64-bit FNV-1a, for hashing files (start with h = FNV_OFFSET_BASIS)
+    const unsigned char * bytes = data;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ bytes[i]) * 1099511628211ULL;
+    }
+    return h;
+}
 
-    fp = fopen(fname, "r");
-    expect(fp != NULL, "Error: Failed to open file %s.", fname);
-    while (getline(&line, &len, fp) != -1) {
-        strcat(input, line);
+char * try_read_file(char * fname)
+{
+    // Reads a whole file ("-" for stdin), or returns NULL if it can't be opened.
+    FILE * fp;
+    size_t len = 0, cap = MAX_INPUT_LEN, n;
+
+    fp = streq(fname, "-") ? stdin : fopen(fname, "r");
+    if (fp == NULL) return NULL;
+    char * input = new_string(cap);
+    // large (e.g. generated) programs may not fit, so grow as needed:
+    while ((n = fread(input + len, 1, cap - len, fp)) > 0) {
+        len += n;
+        if (len == cap) {
+            cap *= 2;
+            input = realloc(input, cap + 1);
+        }
     }
-    fclose(fp);
-    if (line) free(line);
+    input[len] = '\0';
+    if (fp != stdin) fclose(fp);
+    return input;
+}
+
+char * read_file(char * fname)
+{
+    char * input = try_read_file(fname);
+    expect(input != NULL, "Error: Failed to open file %s.\n", fname);
     return input;
 }
 
@@ -135,6 +457,8 @@ struct Queue {
     Node * head;
     Node * tail;
     size_t size;
+    Arena * arena;  // where the nodes live, or NULL for the heap
+    int refs;       // for contexts (see new_context())
 } typedef Queue;
 
 /* function headers */
@@ -145,12 +469,12 @@ size_t queue_size(Queue * q);
 
 Node * new_node()
 {
-    return malloc(sizeof(Node));
+    return heap_alloc(sizeof(Node));
 }
 
 void destroy_node(Node * node)
 {
-    free(node);
+    heap_free(node, sizeof(Node));
 }
 
 Node * queue_begin(Queue * q) { return q->head->next; }
@@ -160,18 +484,36 @@ Node * queue_end(Queue * q) { return q->tail; }
 #define queue_foreach_reverse(e, q) \
     for (Node * e = q->tail->prev, * end = q->head; e != end; e = e->prev)
 
-Queue * new_queue(Queue * q_old)
+Node * queue_new_node(Queue * q)
+{
+    return q->arena == NULL ? new_node() : arena_alloc(q->arena, sizeof(Node));
+}
+
+Queue * init_queue(Queue * q, Arena * arena)
 {
-    Queue * q = malloc(sizeof(Queue));
     q->size = 0;
-    q->head = malloc(sizeof(Node));
-    q->tail = malloc(sizeof(Node));
+    q->arena = arena;
+    q->refs = 1;
+    q->head = queue_new_node(q);
+    q->tail = queue_new_node(q);
     q->head->data = NULL;
     q->tail->data = NULL;
     q->head->next = q->tail;
     q->tail->prev = q->head;
     q->head->prev = NULL;
     q->tail->next = NULL;
+    return q;
+}
+
+Queue * new_arena_queue(Arena * arena)
+{
+    // The queue is released with its arena, and must not be destroyed.
+    return init_queue(arena_alloc(arena, sizeof(Queue)), arena);
+}
+
+Queue * new_queue(Queue * q_old)
+{
+    Queue * q = init_queue(heap_alloc(sizeof(Queue)), NULL);
     if (q_old != NULL) {  // clone q_old
         queue_foreach(node, q_old) {
             queue_push(q, node->data);
@@ -182,19 +524,20 @@ Queue * new_queue(Queue * q_old)
 
 void destroy_queue(Queue * q)
 {
+    if (q->arena != NULL) return;
     Node * cur, * next;
     for (cur = q->head; cur != q->tail; ) {
         next = cur->next;
         destroy_node(cur);
         cur = next;
     }
-    free(q->tail);
-    free(q);
+    destroy_node(q->tail);
+    heap_free(q, sizeof(Queue));
 }
 
 void queue_push(Queue * q, void * data)
 {
-    Node * n = new_node();
+    Node * n = queue_new_node(q);
     n->data = data;
     q->tail->prev->next = n;
     n->prev = q->tail->prev;
@@ -203,6 +546,17 @@ void queue_push(Queue * q, void * data)
     q->size++;
 }
 
+void queue_insert_after(Queue * q, Node * node, void * data)
+{
+    Node * n = queue_new_node(q);
+    n->data = data;
+    n->prev = node;
+    n->next = node->next;
+    node->next->prev = n;
+    node->next = n;
+    q->size++;
+}
+
 void queue_remove(Queue * q, Node * node)
 {
     expect(node->prev != NULL, "Error (internal): queue_remove.\n");
@@ -211,7 +565,7 @@ void queue_remove(Queue * q, Node * node)
     Node * p = node->prev;
     p->next = n;
     n->prev = p;
-    destroy_node(node);
+    if (q->arena == NULL) destroy_node(node);
     q->size--;
 }
 
@@ -260,23 +614,36 @@ void destroy_hashtable(HashTable * ht)
          node != (ht)->table + (ht)->capacity;          \
          node++) if (node->set)
 
+int hashtable_slot(HASH_TYPE key, int capacity)
+{
+    // Hashes may be negative (they are allowed to overflow), and the low bits of
+    // a string hash only depend on the end of the string, so mix all the bits first:
+    unsigned long long k = (unsigned long long)key * 0x9E3779B97F4A7C15ULL;
+    return (k >> 32) % capacity;
+}
+
 void hashtable_insert(HashTable * ht, HASH_TYPE key, void * value)
 {
-    // grow the hash table if needed:
-    if (ht->size == ht->capacity) {
+    // grow the hash table if needed (keep it at most half full, so probes stay short):
+    if (2 * ht->size >= ht->capacity) {
         HashTableItem * old_table = ht->table;
         int old_capacity = ht->capacity;
         ht->capacity *= 2;
         ht->size = 0;
         ht->table = malloc(ht->capacity * sizeof(HashTableItem));
+        for (int i = 0; i < ht->capacity; i++) {
+            ht->table[i].set = false;
+        }
         for (int i = 0; i < old_capacity; i++) {
-            hashtable_insert(ht, old_table[i].key, old_table[i].value);
+            if (old_table[i].set) {
+                hashtable_insert(ht, old_table[i].key, old_table[i].value);
+            }
         }
         free(old_table);
     }
 
     int cap = ht->capacity;
-    for (int i = key % cap, j = 0; j < cap; i = (i + 1) % cap, j++) {
+    for (int i = hashtable_slot(key, cap), j = 0; j < cap; i = (i + 1) % cap, j++) {
         if (!ht->table[i].set) {
             ht->table[i].set = true;
             ht->table[i].key = key;
@@ -292,23 +659,30 @@ void hashtable_remove(HashTable * ht, HASH_TYPE key)
     expect(ht->size != 0, "Error: Removing item from empty HashTable.\n");
     int cap = ht->capacity;
     int found = false;
-    for (int i = key % cap, j = 0; j < cap; i = (i + 1) % cap, j++) {
+    for (int i = hashtable_slot(key, cap), j = 0; j < cap; i = (i + 1) % cap, j++) {
         if (ht->table[i].set && ht->table[i].key == key) {
             ht->table[i].set = false;
             found = true;
+            ht->size--;
+            // re-insert the rest of the cluster, so that lookups can stop at empty slots:
+            for (i = (i + 1) % cap; ht->table[i].set; i = (i + 1) % cap) {
+                ht->table[i].set = false;
+                ht->size--;
+                hashtable_insert(ht, ht->table[i].key, ht->table[i].value);
+            }
             break;
         }
     }
 
     expect(found, "Error: Couldn't find element in HashTable with key %lld.\n", key);
-    ht->size--;
 }
 
 HashTableItem * hashtable_find(HashTable * ht, HASH_TYPE key)
 {
     int cap = ht->capacity;
-    for (int i = key % cap, j = 0; j < cap; i = (i + 1) % cap, j++) {
-        if (ht->table[i].set && ht->table[i].key == key) {
+    for (int i = hashtable_slot(key, cap), j = 0; j < cap; i = (i + 1) % cap, j++) {
+        if (!ht->table[i].set) break;
+        if (ht->table[i].key == key) {
             return ht->table + i;
         }
     }
@@ -322,554 +696,2386 @@ size_t hashtable_size(HashTable * ht)
 
 
 /*******************
- *   EXPRESSIONS   *
+ *     BUFFER      *
  *******************/
 
-enum ExpressionType;
-struct Expression;
-
-enum PrimitiveType {
-    PrimitiveANY = 0,
-    PrimitiveTRUE = 1,
-    PrimitiveFALSE = 2,
-    PrimitiveNULL = 3,
-    PrimitiveNumber = 4,
-    PrimitiveString = 5,
-    PrimitiveChar = 6,
-} typedef PrimitiveType;
-char * PrimitiveTypeString[7] = {
-    "PrimitiveANY",
-    "PrimitiveTRUE",
-    "PrimitiveFALSE",
-    "PrimitiveNULL",
-    "PrimitiveNumber",
-    "PrimitiveString",
-    "PrimitiveChar",
-};
-
-enum ExpressionType {
-    Program = 0,
-    Statement = 1,
-    List = 2,
-    Id = 3,
-    Primitive = 4,
-} typedef ExpressionType;
-char * ExpressionTypeString[5] = {
-    "Program",
-    "Statement",
-    "List",
-    "Id",
-    "Primitive",
-};
-
-struct Expression {
-    HASH_TYPE value;
-    Queue/*<Expression>*/ * children;
-    ExpressionType type;
-    PrimitiveType ptype;
-    char * str;
-} typedef Expression;
+struct Buffer {
+    char * data;
+    size_t len;
+    size_t cap;
+} typedef Buffer;
 
-Expression * new_expression(HASH_TYPE value, ExpressionType type, PrimitiveType ptype, char * str);
-void destroy_expression(Expression * e);
-void print_expression(Expression * e, HashTable * symbols, int d);
+Buffer * new_buffer()
+{
+    Buffer * buf = malloc(sizeof(Buffer));
+    buf->len = 0;
+    buf->cap = 64;
+    buf->data = malloc(buf->cap);
+    return buf;
+}
 
-Expression * new_expression(HASH_TYPE value, ExpressionType type, PrimitiveType ptype, char * str)
+void destroy_buffer(Buffer * buf)
 {
-    Expression * e = malloc(sizeof(Expression));
-    e->children = new_queue(NULL);
-    e->value = value;
-    e->type = type;
-    e->ptype = ptype;
-    e->str = str == NULL ? NULL : clone_string(str);
-    return e;
+    free(buf->data);
+    free(buf);
 }
 
-void destroy_expression(Expression * e)
+void buffer_write(Buffer * buf, const void * src, size_t len)
 {
-    queue_foreach(node, e->children) {
-        destroy_expression(node->data);
+    if (buf->len + len > buf->cap) {
+        while (buf->len + len > buf->cap) buf->cap *= 2;
+        buf->data = realloc(buf->data, buf->cap);
     }
-    if (e->str) free(e->str);
-    destroy_queue(e->children);
-    free(e);
+    memcpy(buf->data + buf->len, src, len);
+    buf->len += len;
 }
 
-void print_expression(Expression * e, HashTable * symbols, int d)
+void buffer_putc(Buffer * buf, char c)
 {
-    for (int i = 0; i < d; i++) printf("  ");
-    printf("%s : ", ExpressionTypeString[e->type]);
-    if (e->type == Primitive) {
-        if (e->ptype == PrimitiveString) {
-            printf("(\"%s\")\n", e->str);
-        } else if (e->ptype == PrimitiveNumber) {
-            printf("(%lld)\n", e->value);
-        } else {
-            HashTableItem * item = hashtable_find(symbols, e->value);
-            expect(item != NULL, "Error (internal): Primitive Expression should have token.\n");
-            printf("(%s)\n", (char *)item->value);
-        }
-    } else {
-        HashTableItem * item = hashtable_find(symbols, e->value);
-        expect(item != NULL, "Error (internal): Non-Primitive expression should have token.\n");
-        printf("%s : %s\n", ExpressionTypeString[e->type], (char *)item->value);
-    }
-    queue_foreach(node, e->children) {
-        print_expression(node->data, symbols, d+1);
-    }
+    buffer_write(buf, &c, 1);
 }
 
 
 /*******************
- *     LEXING      *
+ *     STRINGS     *
  *******************/
 
-HashTable * new_symbol_table()
+/* lifecycle:
+ *   - Creation: By the parser (string literals), or by slicing another String
+ *   - Destruction: When the last reference is released
+ * Strings are immutable and not null-terminated. A slice points into the buffer
+ * of its parent and holds a reference to the String that owns that buffer,
+ * so taking a substring never copies.
+ * The literals of a program live in its arena instead, and are not reference
+ * counted, since they last as long as the program (see new_literal_string()).
+ */
+struct String {
+    int refs;
+    size_t len;
+    char * data;
+    struct String * owner;  // NULL if this String owns data
+    HASH_TYPE hash;
+    bool hashed;
+    bool literal;
+} typedef String;
+
+String * string_retain(String * s);
+void string_release(String * s);
+
+String * new_string_from(char * src, size_t len)
 {
-    HashTable * symbols = new_hashtable(DEFAULT_HASHTABLE_SIZE);
-    hashtable_insert(symbols, HASH_OF_DEF,       clone_string("def"     ));
-    hashtable_insert(symbols, HASH_OF_LET,       clone_string("let"     ));
-    hashtable_insert(symbols, HASH_OF_DO,        clone_string("do"      ));
-    hashtable_insert(symbols, HASH_OF_MATCH,     clone_string("match"   ));
-    hashtable_insert(symbols, HASH_OF_TIMES,     clone_string("*"       ));
-    hashtable_insert(symbols, HASH_OF_PLUS,      clone_string("+"       ));
-    hashtable_insert(symbols, HASH_OF_MINUS,     clone_string("-"       ));
-    hashtable_insert(symbols, HASH_OF_DIVIDE,    clone_string("/"       ));
-    hashtable_insert(symbols, HASH_OF_PERCENT,   clone_string("%"       ));
-    hashtable_insert(symbols, HASH_OF_COMMA,     clone_string(","       ));
-    hashtable_insert(symbols, HASH_OF_EQUAL,     clone_string("="       ));
-    hashtable_insert(symbols, HASH_OF_COLON,     clone_string(":"       ));
-    hashtable_insert(symbols, HASH_OF_QUESTION,  clone_string("?"       ));
-    hashtable_insert(symbols, HASH_OF_READ_INT,  clone_string("read_int"));
-    hashtable_insert(symbols, HASH_OF_READ_CHAR, clone_string("read_char"));
-    hashtable_insert(symbols, HASH_OF_PRINT,     clone_string("print"   ));
-    hashtable_insert(symbols, HASH_OF_GET,       clone_string("get"     ));
-    return symbols;
+    String * s = heap_alloc(sizeof(String));
+    s->refs = 1;
+    s->len = len;
+    s->data = heap_alloc(len + 1);
+    memcpy(s->data, src, len);
+    s->data[len] = '\0';
+    s->owner = NULL;
+    s->hashed = false;
+    s->literal = false;
+    return s;
 }
 
-struct Lexer {
-    char * input;
-    int idx;
-    int prev_idx;
-    HashTable * symbols;
-} typedef Lexer;
+String * new_literal_string(Arena * arena, const char * src, size_t len)
+{
+    String * s = arena_alloc(arena, sizeof(String));
+    s->refs = 1;
+    s->len = len;
+    s->data = arena_alloc(arena, len + 1);
+    memcpy(s->data, src, len);
+    s->data[len] = '\0';
+    s->owner = NULL;
+    s->hashed = false;
+    s->literal = true;
+    return s;
+}
 
-Lexer * new_lexer(char * input)
+String * string_slice(String * parent, size_t l, size_t r)
 {
-    Lexer * lex = malloc(sizeof(Lexer));
-    lex->input = input;
-    lex->idx = 0;
-    lex->prev_idx = -1;
-    lex->symbols = new_symbol_table();
-    return lex;
+    expect(l <= r && r <= parent->len, "Error (internal): string_slice out of range.\n");
+    String * owner = parent->owner == NULL ? parent : parent->owner;
+    String * s = heap_alloc(sizeof(String));
+    s->refs = 1;
+    s->len = r - l;
+    s->data = parent->data + l;
+    s->owner = string_retain(owner);
+    s->hashed = false;
+    s->literal = false;
+    return s;
 }
 
-void destroy_lexer(Lexer * lex)
+String * string_retain(String * s)
 {
-    hashtable_foreach(node, lex->symbols) {
-        char * token = node->value;
-        expect(token != NULL, "Error (internal): destroy_lexer(): token is null.\n");
-        free(token);
+    if (!s->literal) s->refs++;
+    return s;
+}
+
+void string_release(String * s)
+{
+    if (s == NULL || s->literal || --s->refs > 0) return;
+    if (s->owner != NULL) {
+        string_release(s->owner);
+    } else {
+        heap_free(s->data, s->len + 1);
     }
-    destroy_hashtable(lex->symbols);
-    free(lex);
+    heap_free(s, sizeof(String));
 }
 
-char * lexer_seek(Lexer * lex)
+HASH_TYPE string_hash(String * s)
 {
-    int l, r, i = lex->idx;
-    char * token;
+    // same function as hash_string(), but cached and length-bounded
+    if (!s->hashed) {
+        HASH_TYPE h = 7;
+        for (size_t i = 0; i < s->len; i++) {
+            h += h * 31 + s->data[i];
+        }
+        s->hash = h;
+        s->hashed = true;
+    }
+    return s->hash;
+}
 
-    // skip whitespace
-    while (member_of(lex->input[i], " \r\n\t")) i++;
+bool string_equal(String * a, String * b)
+{
+    if (a == b) return true;
+    if (a->len != b->len) return false;
+    if (a->hashed && b->hashed && a->hash != b->hash) return false;
+    return memcmp(a->data, b->data, a->len) == 0;
+}
 
-    // skip comment
-    while (lex->input[i] == ';') {
-        while (lex->input[i] != '\n' && lex->input[i] != '\0') i++;
-        if (lex->input[i] == '\n') i++;
 
-        // skip whitespace after comment
-        while (member_of(lex->input[i], " \r\n\t")) i++;
-    }
+/*******************
+ *     BIGNUMS     *
+ *******************/
 
-    // if no token left
-    if (lex->input[i] == '\0') return NULL;
+/*
+ * Numbers are long longs, and only become BigInts when a result doesn't fit
+ * (see number_arith()), so ordinary arithmetic never pays for them. A BigInt
+ * is immutable and reference counted, like a String. Its limbs are in base
+ * 10^9, least significant first, so it is parsed and printed in linear time.
+ * Multiplication switches to Karatsuba's algorithm for long operands, and
+ * division is Knuth's algorithm D.
+ */
+#define BIGINT_BASE   1000000000U
+#define BIGINT_DIGITS 9   // decimal digits per limb
+#define KARATSUBA_MIN 32  // limbs of the shorter operand
+
+struct BigInt {
+    int refs;
+    bool negative;
+    size_t len;  // the most significant limb is not 0
+    size_t cap;
+    uint32_t limbs[];
+} typedef BigInt;
+
+BigInt * new_bigint(size_t cap)
+{
+    BigInt * b = heap_alloc(sizeof(BigInt) + cap * sizeof(uint32_t));
+    b->refs = 1;
+    b->negative = false;
+    b->len = cap;
+    b->cap = cap;
+    memset(b->limbs, 0, cap * sizeof(uint32_t));
+    return b;
+}
 
-    l = i;
+BigInt * bigint_retain(BigInt * b)
+{
+    b->refs++;
+    return b;
+}
 
-    // if single character token
-    if (member_of(lex->input[i], SINGLE_CHAR_TOKENS)) {
-        i++;
+void bigint_release(BigInt * b)
+{
+    if (b == NULL || --b->refs > 0) return;
+    heap_free(b, sizeof(BigInt) + b->cap * sizeof(uint32_t));
+}
 
-    } else if (lex->input[i] == '\"') { // string token
-        // TODO: escape sequences!
-        i++;
-        while (lex->input[i] != '\0' && lex->input[i] != '\"') {
-            i++;
-        }
-        expect(lex->input[i] == '\"', "Error: Unterminated string.\n");
-        i++;
-
-    } else { // multi character token
-        while (lex->input[i] != '\0'
-                && !member_of(lex->input[i], SINGLE_CHAR_TOKENS)
-                && !isspace(lex->input[i])
-                && lex->input[i] != '#') {
-            i++;
-        }
-    }
-    r = i;
-
-    // check length not zero
-    expect(l < r, "Token should not be empty string!\n");
+size_t mag_trim(const uint32_t * a, size_t len)
+{
+    while (len > 0 && a[len - 1] == 0) len--;
+    return len;
+}
 
-    // Add this token to the symbol table:
-    token = new_string(r-l+1);
-    substring(token, lex->input, l, r);
-    HASH_TYPE key = hash_string(token);
-    HashTableItem * item = hashtable_find(lex->symbols, key);
-    if (item == NULL) {
-        hashtable_insert(lex->symbols, key, token);
-    } else {
-        // destroy the string we made so we can output the already allocated token
-        destroy_string(token);
-        token = item->value;
+int mag_cmp(const uint32_t * a, size_t alen, const uint32_t * b, size_t blen)
+{
+    alen = mag_trim(a, alen);
+    blen = mag_trim(b, blen);
+    if (alen != blen) return alen < blen ? -1 : 1;
+    for (size_t i = alen; i-- > 0;) {
+        if (a[i] != b[i]) return a[i] < b[i] ? -1 : 1;
     }
-
-    lex->prev_idx = lex->idx;
-    lex->idx = i;
-    return token;
+    return 0;
 }
 
-void lexer_back(Lexer * lex)
+uint32_t mag_add_into(uint32_t * r, size_t rlen, const uint32_t * a, size_t alen)
 {
-    expect(lex->prev_idx != -1, "Error (internal): Lexer: Invalid call to lexer_back().\n");
-    lex->idx = lex->prev_idx;
-    lex->prev_idx = -1;
+    // r += a (with alen <= rlen), returning the carry out of r.
+    uint32_t carry = 0;
+    size_t i = 0;
+    for (; i < alen; i++) {
+        uint32_t s = r[i] + a[i] + carry;
+        carry = s >= BIGINT_BASE;
+        r[i] = carry ? s - BIGINT_BASE : s;
+    }
+    for (; carry && i < rlen; i++) {
+        carry = r[i] == BIGINT_BASE - 1;
+        r[i] = carry ? 0 : r[i] + 1;
+    }
+    return carry;
 }
 
-
-/*******************
- *     PARSING     *
- *******************/
-
-Expression * parse_program(Lexer * lex);
-bool parse_statement (Expression * root, Lexer * lex);
-bool parse_list      (Expression * root, Lexer * lex);
-bool parse_id        (Expression * root, Lexer * lex);
-bool parse_primitive (Expression * root, Lexer * lex);
-
-bool parse_primitive(Expression * root, Lexer * lex)
+uint32_t mag_sub_from(uint32_t * r, size_t rlen, const uint32_t * a, size_t alen)
 {
-    char * token = lexer_seek(lex);
-    expect(token != NULL, "Error: Expected token in primitive.\n");
-    int len = strlen(token);
-    bool is_num = strcmp(token, "0") == 0 ? true : atoi(token) != 0;
-    bool is_str = token[0] == '\"' && token[len-1] == '\"';
-    bool is_any = (strcmp(token, "ANY") == 0);
-    bool is_true = (strcmp(token, "TRUE") == 0);
-    bool is_false = (strcmp(token, "FALSE") == 0);
-    bool is_null = (strcmp(token, "NULL") == 0);
-    if (!(is_num || is_str || is_any || is_true || is_false || is_null)) {
-        lexer_back(lex);
-        return false;
+    // r -= a (with alen <= rlen), returning the borrow out of r.
+    uint32_t borrow = 0;
+    size_t i = 0;
+    for (; i < alen; i++) {
+        uint32_t sub = a[i] + borrow;
+        borrow = r[i] < sub;
+        r[i] = borrow ? r[i] + BIGINT_BASE - sub : r[i] - sub;
     }
-    PrimitiveType ptype;
-    if      (is_num)   ptype = PrimitiveNumber;
-    else if (is_str)   ptype = PrimitiveString;
-    else if (is_any)   ptype = PrimitiveANY;
-    else if (is_true)  ptype = PrimitiveTRUE;
-    else if (is_false) ptype = PrimitiveFALSE;
-    else if (is_null)  ptype = PrimitiveNULL;
-    else               ptype = PrimitiveANY;
-    HASH_TYPE key;
-    char * str;
-    if (is_str) {
-        key = 0;
-        int sz = strlen(token);
-        str = new_string(sz);
-        substring(str, token, 1, sz-1);
-    } else if (is_num) {
-        key = atoi(token);
-        str = NULL;
-    } else {
-        key = hash_string(token);
-        str = NULL;
+    for (; borrow && i < rlen; i++) {
+        borrow = r[i] == 0;
+        r[i] = borrow ? BIGINT_BASE - 1 : r[i] - 1;
     }
-    Expression * e = new_expression(key, Primitive, ptype, str);
-    queue_push(root->children, e);
-    if (str) destroy_string(str);
-    return true;
+    return borrow;
 }
 
-bool parse_id(Expression * root, Lexer * lex)
+void mag_mul_small(uint32_t * r, const uint32_t * a, size_t alen, uint32_t m)
 {
-    char * token = lexer_seek(lex);
-    expect(token != NULL, "Error: Expected token in id.\n");
-    HASH_TYPE key = hash_string(token);
-    Expression * e = new_expression(key, Id, PrimitiveANY, NULL);
-    bool is_id = true;
-    for (int i = 0; token[i] != '\0'; i++) {
-        if (!(isalpha(token[i]) ||
-                    member_of(token[i], SYSTEM_FUNCTION_TOKENS) ||
-                    token[i] == '_')) {
-            is_id = false;
-            break;
-        }
+    // r = a * m, where r has room for alen + 1 limbs.
+    uint64_t carry = 0;
+    for (size_t i = 0; i < alen; i++) {
+        uint64_t t = (uint64_t)a[i] * m + carry;
+        r[i] = t % BIGINT_BASE;
+        carry = t / BIGINT_BASE;
     }
-    if (!is_id) {
-        lexer_back(lex);
-        destroy_expression(e);
-        return false;
+    r[alen] = carry;
+}
+
+uint32_t mag_div_small(uint32_t * q, const uint32_t * a, size_t alen, uint32_t d)
+{
+    // q = a / d (q may be a), returning a % d.
+    uint64_t rem = 0;
+    for (size_t i = alen; i-- > 0;) {
+        uint64_t cur = rem * BIGINT_BASE + a[i];
+        q[i] = cur / d;
+        rem = cur % d;
     }
-    queue_push(root->children, e);
-    return true;
+    return rem;
 }
 
-bool parse_list(Expression * root, Lexer * lex)
+void mag_mul_school(uint32_t * r, const uint32_t * a, size_t alen, const uint32_t * b, size_t blen)
 {
-    char * token = lexer_seek(lex);
-    expect(token != NULL, "Error: Expected token in list.\n");
-    HASH_TYPE key = hash_string(token);
-    Expression * e = new_expression(key, List, PrimitiveANY, NULL);
-    if (strcmp(token, "[") != 0) {
-        lexer_back(lex);
-        destroy_expression(e);
-        return false;
+    memset(r, 0, (alen + blen) * sizeof(uint32_t));
+    for (size_t i = 0; i < alen; i++) {
+        uint64_t ai = a[i], carry = 0;
+        if (ai == 0) continue;
+        for (size_t j = 0; j < blen; j++) {
+            uint64_t t = ai * b[j] + r[i + j] + carry;
+            r[i + j] = t % BIGINT_BASE;
+            carry = t / BIGINT_BASE;
+        }
+        r[i + blen] = carry;
     }
-    while (parse_id(e, lex) ||
-           parse_statement(e, lex) ||
-           parse_list(e, lex) ||
-           parse_primitive(e, lex));
-    token = lexer_seek(lex);
-    expect(strcmp(token, "]") == 0, "Error: Expected closing paren!\n");
-    queue_push(root->children, e);
-    return true;
 }
 
-bool parse_statement(Expression * root, Lexer * lex)
+void mag_mul(uint32_t * r, const uint32_t * a, size_t alen, const uint32_t * b, size_t blen)
 {
-    char * token = lexer_seek(lex);
-    if (token == NULL) {
-        return false;
+    // r = a * b, where r has room for alen + blen limbs (the operands needn't be trimmed).
+    if (alen < blen) {
+        const uint32_t * t = a; a = b; b = t;
+        size_t tlen = alen; alen = blen; blen = tlen;
     }
-    HASH_TYPE key = hash_string(token);
-    Expression * e = new_expression(key, Statement, PrimitiveANY, NULL);
-    if (strcmp(token, "(") != 0 || !parse_id(e, lex)) {
-        lexer_back(lex);
-        destroy_expression(e);
-        return false;
+    if (blen < KARATSUBA_MIN) {
+        mag_mul_school(r, a, alen, b, blen);
+        return;
     }
-    while (parse_primitive(e, lex) ||
-           parse_id(e, lex) ||
-           parse_statement(e, lex) ||
-           parse_list(e, lex));
-    token = lexer_seek(lex);
-    expect(strcmp(token, ")") == 0, "Error: Expected closing paren!\n");
-    queue_push(root->children, e);
-    return true;
+    if (alen >= 2 * blen) {
+        // lopsided, so multiply b by slices of a as long as b:
+        memset(r, 0, (alen + blen) * sizeof(uint32_t));
+        uint32_t * t = malloc(2 * blen * sizeof(uint32_t));
+        for (size_t i = 0; i < alen; i += blen) {
+            size_t n = alen - i < blen ? alen - i : blen;
+            mag_mul(t, a + i, n, b, blen);
+            mag_add_into(r + i, alen + blen - i, t, n + blen);
+        }
+        free(t);
+        return;
+    }
+    // a = a1 B^m + a0 and b = b1 B^m + b0 (b1 isn't empty, since alen < 2 blen), so
+    // a b = z2 B^2m + z1 B^m + z0, with z1 = (a1 + a0)(b1 + b0) - z2 - z0:
+    size_t m = alen / 2, a1len = alen - m, b1len = blen - m;
+    size_t salen = a1len + 1, sblen = (b1len > m ? b1len : m) + 1;
+    mag_mul(r, a, m, b, m);
+    mag_mul(r + 2 * m, a + m, a1len, b + m, b1len);
+    uint32_t * sa = calloc(2 * (salen + sblen), sizeof(uint32_t));
+    uint32_t * sb = sa + salen, * z1 = sb + sblen;
+    memcpy(sa, a + m, a1len * sizeof(uint32_t));
+    mag_add_into(sa, salen, a, m);
+    memcpy(sb, b, m * sizeof(uint32_t));
+    mag_add_into(sb, sblen, b + m, b1len);
+    mag_mul(z1, sa, salen, sb, sblen);
+    mag_sub_from(z1, salen + sblen, r, 2 * m);
+    mag_sub_from(z1, salen + sblen, r + 2 * m, a1len + b1len);
+    mag_add_into(r + m, alen + blen - m, z1, mag_trim(z1, salen + sblen));
+    free(sa);
 }
 
-Expression * parse_program(Lexer * lex)
+void mag_divmod(uint32_t * q, uint32_t * rem, const uint32_t * a, size_t alen,
+        const uint32_t * b, size_t blen)
 {
-    Expression * e = new_expression(HASH_OF_TIMES, Program, PrimitiveANY, NULL);
-    while (parse_statement(e, lex));
-    return e;
+    /*
+     * q = a / b (alen - blen + 1 limbs) and rem = a % b (blen limbs), where
+     * b is trimmed, has at least 2 limbs, and alen >= blen. Both are scaled
+     * first, so that the top limb of b is at least BIGINT_BASE / 2, which
+     * makes each estimated quotient limb at most one too large.
+     */
+    uint32_t d = BIGINT_BASE / (b[blen - 1] + 1);
+    uint32_t * u = malloc((alen + 1 + blen + 1) * sizeof(uint32_t));
+    uint32_t * v = u + alen + 1;
+    mag_mul_small(u, a, alen, d);
+    mag_mul_small(v, b, blen, d);
+    uint64_t vtop = v[blen - 1], vnext = v[blen - 2];
+    for (size_t j = alen - blen + 1; j-- > 0;) {
+        uint64_t num = (uint64_t)u[j + blen] * BIGINT_BASE + u[j + blen - 1];
+        uint64_t qhat = num / vtop, rhat = num % vtop;
+        while (qhat >= BIGINT_BASE || qhat * vnext > rhat * BIGINT_BASE + u[j + blen - 2]) {
+            qhat--;
+            rhat += vtop;
+            if (rhat >= BIGINT_BASE) break;
+        }
+        // u[j .. j + blen] -= qhat v
+        uint64_t carry = 0;
+        int64_t borrow = 0;
+        for (size_t i = 0; i < blen; i++) {
+            uint64_t p = qhat * v[i] + carry;
+            carry = p / BIGINT_BASE;
+            int64_t t = (int64_t)u[i + j] - (int64_t)(p % BIGINT_BASE) - borrow;
+            borrow = t < 0;
+            u[i + j] = t < 0 ? t + BIGINT_BASE : t;
+        }
+        int64_t top = (int64_t)u[j + blen] - (int64_t)carry - borrow;
+        if (top < 0) {
+            // (qhat was one too large, so add v back)
+            qhat--;
+            mag_add_into(u + j, blen, v, blen);
+        }
+        u[j + blen] = 0;
+        q[j] = qhat;
+    }
+    mag_div_small(rem, u, blen, d);
+    free(u);
 }
 
+struct NumView {
+    bool negative;
+    size_t len;
+    const uint32_t * limbs;
+    uint32_t small[3];  // (a long long fits in 3 limbs)
+} typedef NumView;
 
-/*******************
- *    EXECUTION    *
- *******************/
-
-/* lifecycle:
- *   TODO: Figure out when to create/destroy these. GC??
- *   *** Result can only be used once ***
- *   TODO: Add function as a PrimitiveType so we can have first-class functions
- */
-struct Result {
-    long long num;
-    PrimitiveType type;
-    char * str;
-} typedef Result;
-
-/* lifecycle:
- *   - Creation: When statement "def" is executed
- *   - Destruction: Program termination
- *   TODO: Make functions scoped locally to a thunk
- */
-struct Function {
-    HASH_TYPE name;
-    Queue/*<HASH_TYPE>*/ * params;
-    Expression * def;
-} typedef Function;
-Queue/*<Function>*/ * ftable;
-
-/* lifecycle:
- *   - Creation: Before execution call
- *   - Destruction: After execution returns
- */
-struct Thunk {
-    HASH_TYPE name;  // variable name
-    Expression * e;
-    Result * res;
-    Queue/*<Thunk>*/ * context;
-} typedef Thunk;
+void num_view(NumView * v, long long num, BigInt * big)
+{
+    if (big != NULL) {
+        v->negative = big->negative;
+        v->len = big->len;
+        v->limbs = big->limbs;
+        return;
+    }
+    v->negative = num < 0;
+    unsigned long long mag = num < 0 ? -(unsigned long long)num : (unsigned long long)num;
+    v->len = 0;
+    while (mag != 0) {
+        v->small[v->len++] = mag % BIGINT_BASE;
+        mag /= BIGINT_BASE;
+    }
+    v->limbs = v->small;
+}
 
-Result * new_result(HASH_TYPE num, char * str, PrimitiveType type)
+bool bigint_to_ll(BigInt * b, long long * num)
 {
-    Result * res = malloc(sizeof(Result));
-    res->num = num;
-    res->type = type;
-    if (str != NULL) {
-        res->str = clone_string(str);
+    // Returns false if b doesn't fit in a long long.
+    if (b->len > 3) return false;
+    unsigned long long mag = 0;
+    for (size_t i = b->len; i-- > 0;) {
+        if (mag > (ULLONG_MAX - b->limbs[i]) / BIGINT_BASE) return false;
+        mag = mag * BIGINT_BASE + b->limbs[i];
+    }
+    if (b->negative) {
+        if (mag > (unsigned long long)LLONG_MAX + 1) return false;
+        *num = mag == (unsigned long long)LLONG_MAX + 1 ? LLONG_MIN : -(long long)mag;
     } else {
-        res->str = NULL;
+        if (mag > LLONG_MAX) return false;
+        *num = mag;
     }
-    return res;
+    return true;
 }
 
-void destroy_result(Result * res)
+BigInt * bigint_trim(BigInt * b)
 {
-    free(res->str);
-    free(res);
+    b->len = mag_trim(b->limbs, b->len);
+    if (b->len == 0) b->negative = false;
+    return b;
 }
 
-void print_result(Result * res)
+BigInt * bigint_add(NumView * a, NumView * b, bool negate_b)
 {
-    if      (res->type == PrimitiveANY)    printf("ANY\n");
-    else if (res->type == PrimitiveTRUE)   printf("TRUE\n");
-    else if (res->type == PrimitiveFALSE)  printf("FALSE\n");
-    else if (res->type == PrimitiveNULL)   printf("NULL\n");
-    else if (res->type == PrimitiveString) printf("%s\n", res->str);
-    else if (res->type == PrimitiveNumber) printf("%lld\n", res->num);
-    else if (res->type == PrimitiveChar)   printf("%c\n", (char)res->num);
+    bool bneg = b->negative != negate_b;
+    if (a->negative == bneg) {
+        size_t len = (a->len > b->len ? a->len : b->len) + 1;
+        BigInt * r = new_bigint(len);
+        memcpy(r->limbs, a->limbs, a->len * sizeof(uint32_t));
+        mag_add_into(r->limbs, len, b->limbs, b->len);
+        r->negative = a->negative;
+        return bigint_trim(r);
+    }
+    // (subtract the smaller magnitude from the larger)
+    bool a_larger = mag_cmp(a->limbs, a->len, b->limbs, b->len) >= 0;
+    NumView * x = a_larger ? a : b, * y = a_larger ? b : a;
+    BigInt * r = new_bigint(x->len);
+    memcpy(r->limbs, x->limbs, x->len * sizeof(uint32_t));
+    mag_sub_from(r->limbs, x->len, y->limbs, y->len);
+    r->negative = a_larger ? a->negative : bneg;
+    return bigint_trim(r);
 }
 
-bool result_equal(Result * a, Result * b)
+BigInt * bigint_mul(NumView * a, NumView * b)
 {
-    if (a->type == PrimitiveANY ||
-        b->type == PrimitiveANY)    return true;
-    if (a->type != b->type)         return false;
-    if (a->type == PrimitiveTRUE)   return true;
-    if (a->type == PrimitiveFALSE)  return true;
-    if (a->type == PrimitiveNULL)   return true;
-    if (a->type == PrimitiveString) return streq(a->str, b->str);
-    if (a->type == PrimitiveNumber) return a->num == b->num;
-    if (a->type == PrimitiveChar)   return a->num == b->num;
-    return false;
+    BigInt * r = new_bigint(a->len + b->len);
+    if (a->len != 0 && b->len != 0) mag_mul(r->limbs, a->limbs, a->len, b->limbs, b->len);
+    r->negative = a->negative != b->negative;
+    return bigint_trim(r);
 }
 
-bool result_is_true(Result * res)
+BigInt * bigint_divmod(NumView * a, NumView * b, bool want_rem)
 {
-    if (res->type == PrimitiveANY)    return true;
-    if (res->type == PrimitiveTRUE)   return true;
-    if (res->type == PrimitiveFALSE)  return false;
-    if (res->type == PrimitiveNULL)   return false;
-    if (res->type == PrimitiveString) return true;
-    if (res->type == PrimitiveNumber) return res->num != 0;
-    if (res->type == PrimitiveChar)   return res->num != 0;
-    return false;
+    // Truncates towards 0, like C: the remainder has the sign of a.
+    expect(b->len != 0, "Error: Division by zero.\n");
+    BigInt * q, * rem;
+    if (mag_cmp(a->limbs, a->len, b->limbs, b->len) < 0) {
+        q = new_bigint(0);
+        rem = new_bigint(a->len);
+        memcpy(rem->limbs, a->limbs, a->len * sizeof(uint32_t));
+    } else if (b->len == 1) {
+        q = new_bigint(a->len);
+        rem = new_bigint(1);
+        rem->limbs[0] = mag_div_small(q->limbs, a->limbs, a->len, b->limbs[0]);
+    } else {
+        q = new_bigint(a->len - b->len + 1);
+        rem = new_bigint(b->len);
+        mag_divmod(q->limbs, rem->limbs, a->limbs, a->len, b->limbs, b->len);
+    }
+    q->negative = a->negative != b->negative;
+    rem->negative = a->negative;
+    bigint_release(want_rem ? q : rem);
+    return bigint_trim(want_rem ? rem : q);
 }
 
-HASH_TYPE hash_result(Result * res)
+BigInt * bigint_parse(const char * digits, size_t len)
 {
-    // reserve first 3 bits for basic types:
-    if (res->type == PrimitiveNULL)   return 0;
-    if (res->type == PrimitiveANY)    return 1;
-    if (res->type == PrimitiveTRUE)   return 2;
-    if (res->type == PrimitiveFALSE)  return 3;
-    if (res->type == PrimitiveString) return 8 * hash_string(res->str);
-    if (res->type == PrimitiveNumber) return 8 * res->num;
-    if (res->type == PrimitiveChar)   return 8 * res->num;
-    return 0;
+    // From decimal digits (without a sign).
+    while (len > 1 && digits[0] == '0') {
+        digits++;
+        len--;
+    }
+    BigInt * b = new_bigint((len + BIGINT_DIGITS - 1) / BIGINT_DIGITS);
+    for (size_t i = 0; i < b->len; i++) {
+        // limb i holds the digits [end - 9, end)
+        size_t end = len - i * BIGINT_DIGITS;
+        size_t start = end > BIGINT_DIGITS ? end - BIGINT_DIGITS : 0;
+        uint32_t limb = 0;
+        for (size_t j = start; j < end; j++) limb = limb * 10 + (digits[j] - '0');
+        b->limbs[i] = limb;
+    }
+    return bigint_trim(b);
 }
 
-Function * new_function(HASH_TYPE name, Expression * e)
+char * bigint_format(BigInt * b, size_t * len)
 {
-    /*
-     * This function expects the sub-Expression queue to be formatted like so:
-     *   HEAD <-> Id("def") <-> Id(name) [ <-> Id(param1) <-> Id(param2) ... ]  \
-     *     <-> any(declaration) <-> TAIL
-     * Minimum expected queue size = 3 ("def", name, and declaration)
-     */
-    Function * f = malloc(sizeof(Function));
-    f->name = name;
-    f->params = new_queue(NULL);
-    int i = 0, len = queue_size(e->children);
-    queue_foreach(node, e->children) {
-        if (i > 1 && i != len-1) {
-            Expression * ec = node->data;
-            expect(ec->type == Id,
-                    "Error (internal): new_function :: Bad Expression tree.\n");
-            HASH_TYPE param = ec->value;
-            queue_push(f->params, (void *) param);
-        }
-        i++;
+    // To decimal digits (a new string, of *len characters).
+    char * s = new_string(b->len * BIGINT_DIGITS + 2);
+    size_t n = 0;
+    if (b->negative) s[n++] = '-';
+    n += sprintf(s + n, "%u", b->len == 0 ? 0 : b->limbs[b->len - 1]);
+    for (size_t i = b->len - 1; i-- > 0;) {
+        n += sprintf(s + n, "%09u", b->limbs[i]);
     }
-    f->def = queue_end(e->children)->prev->data;
-    return f;
+    *len = n;
+    return s;
 }
 
-void destroy_function(Function * f)
+bool bigint_equal(BigInt * a, BigInt * b)
 {
-    destroy_queue(f->params);
-    free(f);
+    return a->negative == b->negative && a->len == b->len &&
+           memcmp(a->limbs, b->limbs, a->len * sizeof(uint32_t)) == 0;
 }
 
-Thunk * new_thunk(HASH_TYPE name /*required*/, Expression * e, Queue/*<Thunk>*/ * context)
+HASH_TYPE bigint_hash(BigInt * b)
 {
-    Thunk * t = malloc(sizeof(Thunk));
-    t->e = e;
-    t->res = NULL;
-    t->name = name;
-    // This is tricky: Sometimes, we want a shared context between thunks,
-    // sometimes we want a completely new  and empty context,
-    // and sometimes we want a clone of the parent context (to avoid contamination).
-    // So, just keep a pointer, and let calling function determine the context.
-    t->context = context;
-    return t;
+    HASH_TYPE h = b->negative;
+    for (size_t i = 0; i < b->len; i++) h = h * 31 + b->limbs[i];
+    return h;
 }
 
-void destroy_thunk(Thunk * t)
+bool small_arith(HASH_TYPE op, long long a, long long b, long long * r)
 {
-    free(t);
+    // Returns false if the result doesn't fit in a long long (or b is 0 for / and %).
+    switch (op) {
+    case HASH_OF_PLUS:  return !__builtin_add_overflow(a, b, r);
+    case HASH_OF_MINUS: return !__builtin_sub_overflow(a, b, r);
+    case HASH_OF_TIMES: return !__builtin_mul_overflow(a, b, r);
+    case HASH_OF_DIVIDE:
+        if (b == 0 || (a == LLONG_MIN && b == -1)) return false;
+        *r = a / b;
+        return true;
+    case HASH_OF_PERCENT:
+        if (b == 0 || (a == LLONG_MIN && b == -1)) return false;
+        *r = a % b;
+        return true;
+    }
+    *r = 0;
+    return true;
 }
 
-Function * find_function(HASH_TYPE name)
+BigInt * big_arith(HASH_TYPE op, long long a, BigInt * abig, long long b, BigInt * bbig)
 {
-    queue_foreach(node, ftable) {
-        Function * f = node->data;
-        if (f->name == name) {
-            return f;
-        }
+    NumView x, y;
+    num_view(&x, a, abig);
+    num_view(&y, b, bbig);
+    switch (op) {
+    case HASH_OF_PLUS:    return bigint_add(&x, &y, false);
+    case HASH_OF_MINUS:   return bigint_add(&x, &y, true);
+    case HASH_OF_TIMES:   return bigint_mul(&x, &y);
+    case HASH_OF_DIVIDE:  return bigint_divmod(&x, &y, false);
+    case HASH_OF_PERCENT: return bigint_divmod(&x, &y, true);
     }
-    return NULL;
+    return new_bigint(0);
 }
 
-void execute(Thunk * t, HashTable * symbols)
-{
-    if (t->res != NULL) {
-        // do nothing, this has already been calculated
 
-    } else if (t->e->type == Program) {
-        Expression * ec;
-        Thunk * tc;
-        // Make a clone of context share variables in local scope,
-        // without contaminating parent scope.
-        Queue/*<Thunk>*/ * context = new_queue(t->context);
-        queue_foreach(node, t->e->children) {
-            ec = node->data;
-            tc = new_thunk(HASH_OF_TIMES, ec, context);
-            execute(tc, symbols);
-            t->res = tc->res;
-            destroy_thunk(tc);
-        }
-        destroy_queue(context);
+/*******************
+ *   EXPRESSIONS   *
+ *******************/
+
+enum ExpressionType;
+struct Expression;
+
+enum PrimitiveType {
+    PrimitiveANY = 0,
+    PrimitiveTRUE = 1,
+    PrimitiveFALSE = 2,
+    PrimitiveNULL = 3,
+    PrimitiveNumber = 4,
+    PrimitiveString = 5,
+    PrimitiveChar = 6,
+    PrimitiveList = 7,
+} typedef PrimitiveType;
+char * PrimitiveTypeString[8] = {
+    "PrimitiveANY",
+    "PrimitiveTRUE",
+    "PrimitiveFALSE",
+    "PrimitiveNULL",
+    "PrimitiveNumber",
+    "PrimitiveString",
+    "PrimitiveChar",
+    "PrimitiveList",
+};
+
+enum ExpressionType {
+    Program = 0,
+    Statement = 1,
+    List = 2,
+    Id = 3,
+    Primitive = 4,
+} typedef ExpressionType;
+char * ExpressionTypeString[5] = {
+    "Program",
+    "Statement",
+    "List",
+    "Id",
+    "Primitive",
+};
+
+// What the evaluator has learnt about a statement (see QUICKENING)
+enum {
+    QUICK_NONE = 0,   // not yet executed
+    QUICK_GENERIC,    // anything else
+    QUICK_ARITH,      // (+ a b), (- a b), ...
+    QUICK_ADD_INT,    // (+ a b), which so far had numbers which fit in a long long
+    QUICK_SUB_INT,    // (- a b), likewise
+    QUICK_EQUAL,      // (= a b)
+    QUICK_EQUAL_INT,  // (= a b), likewise
+    QUICK_QUESTION,   // (? test then else)
+    QUICK_CALL,       // a call of a function of the program or prelude
+};
+
+struct MatchTable;
+
+struct Expression {
+    HASH_TYPE value;
+    Queue/*<Expression>*/ * children;
+    ExpressionType type;
+    PrimitiveType ptype;
+    String * str;
+    struct MatchTable * match;  // for 'match' statements, built when first executed
+    int quick;                  // QUICK_*, set when first executed
+    struct Result * constant;   // for literals, their value, once executed
+    struct Function * callee;   // for calls, the function found last time,
+    unsigned long long callee_version;  // while in->functions_version is still this
+    int slot;                   // for the parameters of a function, their position
+                                // in its context (see QUICKENING), or -1
+    Arena * arena;  // where the expression lives, or NULL for the heap;
+                    // a Program owns its arena, and releases it when destroyed
+} typedef Expression;
+
+Expression * new_expression(HASH_TYPE value, ExpressionType type, PrimitiveType ptype, String * str);
+Expression * new_expression_in(Arena * arena,
+        HASH_TYPE value, ExpressionType type, PrimitiveType ptype, String * str);
+void destroy_expression(Expression * e);
+void destroy_match_table(struct MatchTable * mt);
+void destroy_result(struct Result * res);
+void print_expression(Expression * e, HashTable * symbols, int d);
+
+Expression * new_expression(HASH_TYPE value, ExpressionType type, PrimitiveType ptype, String * str)
+{
+    return new_expression_in(NULL, value, type, ptype, str);
+}
+
+Expression * new_expression_in(Arena * arena,
+        HASH_TYPE value, ExpressionType type, PrimitiveType ptype, String * str)
+{
+    Expression * e;
+    if (arena == NULL) {
+        e = heap_alloc(sizeof(Expression));
+        e->children = new_queue(NULL);
+    } else {
+        e = arena_alloc(arena, sizeof(Expression));
+        e->children = new_arena_queue(arena);
+    }
+    e->arena = arena;
+    e->value = value;
+    e->type = type;
+    e->ptype = ptype;
+    e->str = str == NULL ? NULL : string_retain(str);
+    e->match = NULL;
+    e->quick = 0;
+    e->constant = NULL;
+    e->callee = NULL;
+    e->callee_version = 0;
+    e->slot = -1;
+    return e;
+}
+
+void destroy_expression(Expression * e)
+{
+    queue_foreach(node, e->children) {
+        destroy_expression(node->data);
+    }
+    string_release(e->str);
+    if (e->match != NULL) destroy_match_table(e->match);
+    if (e->constant != NULL) destroy_result(e->constant);
+    if (e->arena == NULL) {
+        destroy_queue(e->children);
+        heap_free(e, sizeof(Expression));
+    } else if (e->type == Program) {
+        destroy_arena(e->arena);
+    }
+}
+
+void print_expression(Expression * e, HashTable * symbols, int d)
+{
+    for (int i = 0; i < d; i++) printf("  ");
+    printf("%s : ", ExpressionTypeString[e->type]);
+    if (e->type == Primitive) {
+        if (e->ptype == PrimitiveString) {
+            printf("(\"%.*s\")\n", (int)e->str->len, e->str->data);
+        } else if (e->ptype == PrimitiveNumber && e->str != NULL) {
+            printf("(%.*s)\n", (int)e->str->len, e->str->data);
+        } else if (e->ptype == PrimitiveNumber) {
+            printf("(%lld)\n", e->value);
+        } else {
+            HashTableItem * item = hashtable_find(symbols, e->value);
+            expect(item != NULL, "Error (internal): Primitive Expression should have token.\n");
+            printf("(%s)\n", (char *)item->value);
+        }
+    } else {
+        HashTableItem * item = hashtable_find(symbols, e->value);
+        expect(item != NULL, "Error (internal): Non-Primitive expression should have token.\n");
+        printf("%s : %s\n", ExpressionTypeString[e->type], (char *)item->value);
+    }
+    queue_foreach(node, e->children) {
+        print_expression(node->data, symbols, d+1);
+    }
+}
+
+
+/*******************
+ *     LEXING      *
+ *******************/
+
+HashTable * new_symbol_table()
+{
+    HashTable * symbols = new_hashtable(DEFAULT_HASHTABLE_SIZE);
+    hashtable_insert(symbols, HASH_OF_DEF,       clone_string("def"     ));
+    hashtable_insert(symbols, HASH_OF_LET,       clone_string("let"     ));
+    hashtable_insert(symbols, HASH_OF_DO,        clone_string("do"      ));
+    hashtable_insert(symbols, HASH_OF_MATCH,     clone_string("match"   ));
+    hashtable_insert(symbols, HASH_OF_TIMES,     clone_string("*"       ));
+    hashtable_insert(symbols, HASH_OF_PLUS,      clone_string("+"       ));
+    hashtable_insert(symbols, HASH_OF_MINUS,     clone_string("-"       ));
+    hashtable_insert(symbols, HASH_OF_DIVIDE,    clone_string("/"       ));
+    hashtable_insert(symbols, HASH_OF_PERCENT,   clone_string("%"       ));
+    hashtable_insert(symbols, HASH_OF_COMMA,     clone_string(","       ));
+    hashtable_insert(symbols, HASH_OF_EQUAL,     clone_string("="       ));
+    hashtable_insert(symbols, HASH_OF_COLON,     clone_string(":"       ));
+    hashtable_insert(symbols, HASH_OF_QUESTION,  clone_string("?"       ));
+    hashtable_insert(symbols, HASH_OF_READ_INT,  clone_string("read_int"));
+    hashtable_insert(symbols, HASH_OF_READ_CHAR, clone_string("read_char"));
+    hashtable_insert(symbols, HASH_OF_PRINT,     clone_string("print"   ));
+    hashtable_insert(symbols, HASH_OF_GET,       clone_string("get"     ));
+    hashtable_insert(symbols, HASH_OF_LEN,       clone_string("len"     ));
+    hashtable_insert(symbols, HASH_OF_AT,        clone_string("@"       ));
+    return symbols;
+}
+
+struct Lexer {
+    char * input;
+    int idx;
+    int prev_idx;
+    HashTable * symbols;
+    Arena * arena;  // for the syntax tree, see parse_program()
+    char * unshared;  // the last token, if its hash was taken by another token
+} typedef Lexer;
+
+void destroy_symbol_table(HashTable * symbols)
+{
+    hashtable_foreach(node, symbols) {
+        char * token = node->value;
+        expect(token != NULL, "Error (internal): destroy_symbol_table(): token is null.\n");
+        free(token);
+    }
+    destroy_hashtable(symbols);
+}
+
+Lexer * new_lexer(char * input, HashTable * symbols)
+{
+    // The symbol table is owned by the caller, so it can outlive the lexer.
+    Lexer * lex = malloc(sizeof(Lexer));
+    lex->input = input;
+    lex->idx = 0;
+    lex->prev_idx = -1;
+    lex->symbols = symbols;
+    lex->arena = NULL;
+    lex->unshared = NULL;
+    return lex;
+}
+
+void destroy_lexer(Lexer * lex)
+{
+    destroy_string(lex->unshared);
+    free(lex);
+}
+
+int scan_token(const char * input, int i, int * start)
+{
+    /*
+     * Finds the next token from input[i]: returns the index after it, and
+     * sets *start to its index, or returns -1 if there are no tokens left.
+     * (An unterminated string runs to the end of the input.)
+     */
+
+    // skip whitespace
+    while (member_of(input[i], " \r\n\t")) i++;
+
+    // skip comment
+    while (input[i] == ';') {
+        while (input[i] != '\n' && input[i] != '\0') i++;
+        if (input[i] == '\n') i++;
+
+        // skip whitespace after comment
+        while (member_of(input[i], " \r\n\t")) i++;
+    }
+
+    // if no token left
+    if (input[i] == '\0') return -1;
+
+    *start = i;
+
+    // if single character token
+    if (member_of(input[i], SINGLE_CHAR_TOKENS)) {
+        i++;
+
+    } else if (input[i] == '\"') { // string token
+        // TODO: escape sequences!
+        i++;
+        while (input[i] != '\0' && input[i] != '\"') {
+            i++;
+        }
+        if (input[i] == '\"') i++;
+
+    } else { // multi character token
+        while (input[i] != '\0'
+                && !member_of(input[i], SINGLE_CHAR_TOKENS)
+                && !isspace(input[i])
+                && input[i] != '#') {
+            i++;
+        }
+    }
+    return i;
+}
+
+char * lexer_seek(Lexer * lex)
+{
+    int l = 0, r;
+    char * token;
+
+    r = scan_token(lex->input, lex->idx, &l);
+    if (r == -1) return NULL;
+    expect(lex->input[l] != '\"' || (r - l >= 2 && lex->input[r - 1] == '\"'),
+            "Error: Unterminated string.\n");
+
+    // check length not zero
+    expect(l < r, "Token should not be empty string!\n");
+
+    // Add this token to the symbol table:
+    token = new_string(r-l+1);
+    substring(token, lex->input, l, r);
+    HASH_TYPE key = hash_string(token);
+    HashTableItem * item = hashtable_find(lex->symbols, key);
+    destroy_string(lex->unshared);
+    lex->unshared = NULL;
+    if (item == NULL) {
+        hashtable_insert(lex->symbols, key, token);
+    } else if (strcmp(item->value, token) != 0) {
+        // (long numbers can collide, and only their digits matter)
+        lex->unshared = token;
+    } else {
+        // destroy the string we made so we can output the already allocated token
+        destroy_string(token);
+        token = item->value;
+    }
+
+    lex->prev_idx = lex->idx;
+    lex->idx = r;
+    return token;
+}
+
+void lexer_back(Lexer * lex)
+{
+    expect(lex->prev_idx != -1, "Error (internal): Lexer: Invalid call to lexer_back().\n");
+    lex->idx = lex->prev_idx;
+    lex->prev_idx = -1;
+}
+
+
+/*******************
+ *     PARSING     *
+ *******************/
+
+Expression * parse_program(Lexer * lex);
+bool parse_statement (Expression * root, Lexer * lex);
+bool parse_list      (Expression * root, Lexer * lex);
+bool parse_id        (Expression * root, Lexer * lex);
+bool parse_primitive (Expression * root, Lexer * lex);
+
+bool parse_primitive(Expression * root, Lexer * lex)
+{
+    char * token = lexer_seek(lex);
+    expect(token != NULL, "Error: Expected token in primitive.\n");
+    int len = strlen(token);
+    bool is_num = len > 0;
+    for (int i = 0; token[i] != '\0'; i++) {
+        if (!isdigit(token[i])) is_num = false;
+    }
+    bool is_str = token[0] == '\"' && token[len-1] == '\"';
+    bool is_any = (strcmp(token, "ANY") == 0);
+    bool is_true = (strcmp(token, "TRUE") == 0);
+    bool is_false = (strcmp(token, "FALSE") == 0);
+    bool is_null = (strcmp(token, "NULL") == 0);
+    if (!(is_num || is_str || is_any || is_true || is_false || is_null)) {
+        lexer_back(lex);
+        return false;
+    }
+    PrimitiveType ptype;
+    if      (is_num)   ptype = PrimitiveNumber;
+    else if (is_str)   ptype = PrimitiveString;
+    else if (is_any)   ptype = PrimitiveANY;
+    else if (is_true)  ptype = PrimitiveTRUE;
+    else if (is_false) ptype = PrimitiveFALSE;
+    else if (is_null)  ptype = PrimitiveNULL;
+    else               ptype = PrimitiveANY;
+    HASH_TYPE key;
+    String * str;
+    if (is_str) {
+        key = 0;
+        str = new_literal_string(lex->arena, token + 1, len - 2);
+    } else if (is_num) {
+        // (a number too large for a long long keeps its digits, see number_literal())
+        errno = 0;
+        key = strtoll(token, NULL, 10);
+        str = errno == ERANGE ? new_literal_string(lex->arena, token, len) : NULL;
+    } else {
+        key = hash_string(token);
+        str = NULL;
+    }
+    Expression * e = new_expression_in(lex->arena, key, Primitive, ptype, str);
+    queue_push(root->children, e);
+    return true;
+}
+
+bool parse_id(Expression * root, Lexer * lex)
+{
+    char * token = lexer_seek(lex);
+    expect(token != NULL, "Error: Expected token in id.\n");
+    bool is_id = true;
+    for (int i = 0; token[i] != '\0'; i++) {
+        if (!(isalpha(token[i]) ||
+                    member_of(token[i], SYSTEM_FUNCTION_TOKENS) ||
+                    token[i] == '_')) {
+            is_id = false;
+            break;
+        }
+    }
+    if (!is_id) {
+        lexer_back(lex);
+        return false;
+    }
+    HASH_TYPE key = hash_string(token);
+    Expression * e = new_expression_in(lex->arena, key, Id, PrimitiveANY, NULL);
+    queue_push(root->children, e);
+    return true;
+}
+
+bool parse_list(Expression * root, Lexer * lex)
+{
+    char * token = lexer_seek(lex);
+    expect(token != NULL, "Error: Expected token in list.\n");
+    if (strcmp(token, "[") != 0) {
+        lexer_back(lex);
+        return false;
+    }
+    HASH_TYPE key = hash_string(token);
+    Expression * e = new_expression_in(lex->arena, key, List, PrimitiveANY, NULL);
+    while (parse_primitive(e, lex) ||
+           parse_id(e, lex) ||
+           parse_statement(e, lex) ||
+           parse_list(e, lex));
+    token = lexer_seek(lex);
+    expect(strcmp(token, "]") == 0, "Error: Expected closing paren!\n");
+    queue_push(root->children, e);
+    return true;
+}
+
+bool parse_statement(Expression * root, Lexer * lex)
+{
+    char * token = lexer_seek(lex);
+    if (token == NULL) {
+        return false;
+    }
+    if (strcmp(token, "(") != 0) {
+        lexer_back(lex);
+        return false;
+    }
+    HASH_TYPE key = hash_string(token);
+    Expression * e = new_expression_in(lex->arena, key, Statement, PrimitiveANY, NULL);
+    if (!parse_id(e, lex)) {
+        lexer_back(lex);
+        destroy_expression(e);  // (its memory stays in the arena until the program is destroyed)
+        return false;
+    }
+    while (parse_primitive(e, lex) ||
+           parse_id(e, lex) ||
+           parse_statement(e, lex) ||
+           parse_list(e, lex));
+    token = lexer_seek(lex);
+    expect(strcmp(token, ")") == 0, "Error: Expected closing paren!\n");
+    queue_push(root->children, e);
+    return true;
+}
+
+Expression * parse_program(Lexer * lex)
+{
+    /*
+     * The whole syntax tree is allocated in one arena, which the Program
+     * expression owns, so it is released at once by destroy_expression().
+     */
+    lex->arena = new_arena();
+    Expression * e = new_expression_in(lex->arena, HASH_OF_TIMES, Program, PrimitiveANY, NULL);
+    while (parse_statement(e, lex));
+    return e;
+}
+
+int scan_form(const char * input, int len, int * pos, int * depth, bool more)
+{
+    /*
+     * Finds the end of the top-level form being read (see lang_run_stream()),
+     * going on from *pos with the bracket *depth reached so far. Returns 1
+     * when the form is complete (and ends at *pos), 0 if more input is needed,
+     * and -1 if no form starts there, which ends the program as in
+     * parse_program(). At the end of the input (!more), an unfinished form
+     * counts as complete, so that parsing it reports the error.
+     */
+    int start;
+    for (;;) {
+        int r = scan_token(input, *pos, &start);
+        if (r == -1 && !more && *depth > 0) {
+            *depth = 0;
+            return 1;
+        }
+        if (r == -1) return more ? 0 : -1;
+        // (a token running up to the end of what has been read may go on)
+        if (r == len && more && !member_of(input[start], SINGLE_CHAR_TOKENS)) return 0;
+        if (*depth == 0 && input[start] != '(') return -1;
+        if (input[start] == '(' || input[start] == '[') (*depth)++;
+        if (input[start] == ')' || input[start] == ']') (*depth)--;
+        *pos = r;
+        if (*depth == 0) return 1;
+    }
+}
+
+
+/*******************
+ *  SERIALIZATION  *
+ *******************/
+
+/*
+ * A compact binary form of a parsed program, so it can be loaded without
+ * lexing or parsing. Layout (integers are LEB128 varints, signed ones zigzag):
+ *   "LANG" version
+ *   nsymbols { hash len bytes }*     -- names of the Ids used by the program
+ *   expression                        -- pre-order:
+ *     type ptype value [len bytes] nchildren expression*
+ * The string bytes are only present for PrimitiveString expressions, and for
+ * PrimitiveNumber ones (len 0 if the number fits in the value).
+ */
+#define SERIAL_MAGIC   "LANG"
+#define SERIAL_VERSION 2
+
+struct Reader {
+    const unsigned char * data;
+    size_t len;
+    size_t pos;
+    Arena * arena;     // for the syntax tree
+    const char * what; // what is being read (for errors)
+} typedef Reader;
+
+void write_varint(Buffer * buf, unsigned long long v)
+{
+    while (v >= 0x80) {
+        buffer_putc(buf, (char)((v & 0x7f) | 0x80));
+        v >>= 7;
+    }
+    buffer_putc(buf, (char)v);
+}
+
+void write_number(Buffer * buf, long long v)
+{
+    write_varint(buf, ((unsigned long long)v << 1) ^ (unsigned long long)(v >> 63));
+}
+
+unsigned long long read_varint(Reader * r)
+{
+    unsigned long long v = 0;
+    for (int shift = 0; ; shift += 7) {
+        expect(r->pos < r->len && shift < 64, "Error: Corrupt %s.\n", r->what);
+        unsigned char c = r->data[r->pos++];
+        v |= (unsigned long long)(c & 0x7f) << shift;
+        if (!(c & 0x80)) return v;
+    }
+}
+
+long long read_number(Reader * r)
+{
+    unsigned long long v = read_varint(r);
+    return (long long)(v >> 1) ^ -(long long)(v & 1);
+}
+
+const unsigned char * read_bytes(Reader * r, size_t len)
+{
+    expect(len <= r->len - r->pos, "Error: Corrupt %s.\n", r->what);
+    const unsigned char * p = r->data + r->pos;
+    r->pos += len;
+    return p;
+}
+
+void collect_symbols(Expression * e, HashTable * symbols, HashTable * used)
+{
+    bool named = e->type == Id ||
+        (e->type == Primitive && e->ptype != PrimitiveNumber && e->ptype != PrimitiveString);
+    if (named && hashtable_find(used, e->value) == NULL) {
+        HashTableItem * item = hashtable_find(symbols, e->value);
+        if (item != NULL) hashtable_insert(used, e->value, item->value);
+    }
+    queue_foreach(node, e->children) {
+        collect_symbols(node->data, symbols, used);
+    }
+}
+
+void serialize_expression(Buffer * buf, Expression * e)
+{
+    write_varint(buf, e->type);
+    write_varint(buf, e->ptype);
+    write_number(buf, e->value);
+    if (e->type == Primitive && e->ptype == PrimitiveString) {
+        write_varint(buf, e->str->len);
+        buffer_write(buf, e->str->data, e->str->len);
+    } else if (e->type == Primitive && e->ptype == PrimitiveNumber) {
+        size_t len = e->str == NULL ? 0 : e->str->len;
+        write_varint(buf, len);
+        if (len > 0) buffer_write(buf, e->str->data, len);
+    }
+    write_varint(buf, queue_size(e->children));
+    queue_foreach(node, e->children) {
+        serialize_expression(buf, node->data);
+    }
+}
+
+Buffer * serialize_program(Expression * program, HashTable * symbols)
+{
+    Buffer * buf = new_buffer();
+    buffer_write(buf, SERIAL_MAGIC, strlen(SERIAL_MAGIC));
+    write_varint(buf, SERIAL_VERSION);
+
+    HashTable * used = new_hashtable(DEFAULT_HASHTABLE_SIZE);
+    collect_symbols(program, symbols, used);
+    write_varint(buf, hashtable_size(used));
+    hashtable_foreach(item, used) {
+        char * token = item->value;
+        write_number(buf, item->key);
+        write_varint(buf, strlen(token));
+        buffer_write(buf, token, strlen(token));
+    }
+    destroy_hashtable(used);
+
+    serialize_expression(buf, program);
+    return buf;
+}
+
+Expression * deserialize_expression(Reader * r)
+{
+    ExpressionType type = read_varint(r);
+    PrimitiveType ptype = read_varint(r);
+    expect(type <= Primitive && ptype <= PrimitiveList, "Error: Corrupt compiled program.\n");
+    HASH_TYPE value = read_number(r);
+    String * str = NULL;
+    if (type == Primitive && ptype == PrimitiveString) {
+        size_t len = read_varint(r);
+        str = new_literal_string(r->arena, (char *)read_bytes(r, len), len);
+    } else if (type == Primitive && ptype == PrimitiveNumber) {
+        size_t len = read_varint(r);
+        if (len > 0) str = new_literal_string(r->arena, (char *)read_bytes(r, len), len);
+    }
+    Expression * e = new_expression_in(r->arena, value, type, ptype, str);
+    size_t nchildren = read_varint(r);
+    for (size_t i = 0; i < nchildren; i++) {
+        queue_push(e->children, deserialize_expression(r));
+    }
+    return e;
+}
+
+Expression * deserialize_program(const unsigned char * data, size_t len, HashTable * symbols)
+{
+    /*
+     * Symbols which are not known yet are added to the symbol table,
+     * exactly as if the lexer had seen them.
+     */
+    Reader r = { data, len, 0, NULL, "compiled program" };
+    size_t magic_len = strlen(SERIAL_MAGIC);
+    expect(len >= magic_len && memcmp(data, SERIAL_MAGIC, magic_len) == 0,
+            "Error: Not a compiled program.\n");
+    r.pos = magic_len;
+    expect(read_varint(&r) == SERIAL_VERSION, "Error: Compiled program has the wrong version.\n");
+
+    size_t nsymbols = read_varint(&r);
+    for (size_t i = 0; i < nsymbols; i++) {
+        HASH_TYPE key = read_number(&r);
+        size_t tlen = read_varint(&r);
+        const unsigned char * bytes = read_bytes(&r, tlen);
+        if (hashtable_find(symbols, key) == NULL) {
+            char * token = new_string(tlen);
+            memcpy(token, bytes, tlen);
+            token[tlen] = '\0';
+            expect(hash_string(token) == key, "Error: Corrupt compiled program.\n");
+            hashtable_insert(symbols, key, token);
+        }
+    }
+
+    r.arena = new_arena();
+    Expression * program = deserialize_expression(&r);
+    expect(program->type == Program && r.pos == r.len, "Error: Corrupt compiled program.\n");
+    return program;
+}
+
+
+/*******************
+ *   INTERPRETER   *
+ *******************/
+
+/* lifecycle:
+ *   - Creation: lang_create()
+ *   - Destruction: lang_destroy()
+ * Holds all of the state of one interpreter, so that any number of them
+ * can run in one process (one at a time per thread).
+ */
+struct Interp {
+    HashTable * symbols;
+    Queue/*<Function>*/ * ftable;
+    Expression * program;
+    Expression * prelude;
+    char * cache_dir;
+
+    // The stdin of the program, or NULL to read the real stdin:
+    const char * input;
+    size_t input_pos;
+
+    // Output goes to write(), or to the output buffer if it is NULL:
+    Buffer * output;
+    lang_write_fn write;
+    void * write_data;
+
+    // Limits (0 if unlimited):
+    long long timeout;   // in milliseconds
+    long long deadline;  // in nanoseconds (see now_ns()), set by lang_run()
+    unsigned long long max_steps;
+
+    // Memory (see HELPERS): the prelude is on the heap, and the program (with
+    // what it keeps between runs) on the program heap, released when it is
+    // unloaded. What a run makes is on the run heap, released when it ends:
+    Heap heap;
+    Heap program_heap;
+    Heap run_heap;       // (includes the heap limit)
+
+    unsigned optimizations;          // LANG_OPT_* flags
+    size_t inline_size;              // the largest function body to inline
+    int parse_threads;               // for large sources (0 for one per core)
+    unsigned long long functions_version;  // changes whenever ftable does (see QUICKENING)
+    HashTable * live_functions;      // the functions the program may call (NULL if unknown)
+    HashTable * shadowed;            // see find_shadowed()
+    unsigned long long fresh_names;  // for names made up by the optimizations
+
+    // Checkpoints (see CHECKPOINTS):
+    char * checkpoint_fname;               // NULL if disabled
+    unsigned long long checkpoint_every;   // steps between checkpoints (0 if only on request)
+    unsigned long long checkpoint_steps;   // the steps at the last checkpoint
+    volatile sig_atomic_t checkpoint_request;  // CHECKPOINT_*, set by lang_request_checkpoint()
+    bool keep_frames;                      // if thunks run in frames (see execute_in_frame())
+    struct Thunk * entering;               // the thunk whose frame was just made
+    struct Frame * frame;                  // the innermost one, NULL between statements
+    struct Result ** frame_results;        // the results kept by the frames, innermost last
+    size_t nframe_results, frame_results_size;
+    struct Replay * replay;                // the frames of the statement being resumed
+    size_t statement;                      // the top-level statement running
+    Queue/*<Thunk>*/ * statement_context;  // and the context of the top level
+    unsigned long long statement_functions;  // functions_version when it started
+
+    // Statistics:
+    unsigned long long steps;
+
+    char error[512];
+    jmp_buf * error_handler;
+    struct Interp * prev_active;  // the interpreter that was active before this one
+    Heap * prev_heap;             // and its heap
+};
+
+// The interpreter which is running on this thread (used to report errors):
+_Thread_local Interp * active_interp = NULL;
+
+void vfail(int status, const char * fmt, va_list args)
+{
+    Interp * in = active_interp;
+    if (in == NULL || in->error_handler == NULL) {
+        // not inside an interpreter (e.g. building the prelude):
+        vfprintf(stderr, fmt, args);
+        exit(EXIT_FAILURE);
+    }
+    int len = vsnprintf(in->error, sizeof(in->error), fmt, args);
+    if (status != LANG_ERROR && len >= 0 && (size_t)len < sizeof(in->error)) {
+        // a limit was exceeded, so report how far the run got:
+        snprintf(in->error + len, sizeof(in->error) - len,
+                "  steps: %llu, heap: %zu bytes (peak: %zu bytes)\n",
+                in->steps, in->run_heap.bytes, in->run_heap.peak);
+    }
+    longjmp(*in->error_handler, status);
+}
+
+void fail(const char * fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vfail(LANG_ERROR, fmt, args);
+}
+
+void fail_with(int status, const char * fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vfail(status, fmt, args);
+}
+
+long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Only look at the clock every so many steps, since that is comparatively slow:
+#define STEPS_PER_CHECK 1024
+
+void check_limits(Interp * in)
+{
+    in->steps++;
+    if (in->max_steps != 0 && in->steps > in->max_steps) {
+        fail_with(LANG_OUT_OF_FUEL, "Error: Step limit of %llu exceeded.\n", in->max_steps);
+    }
+    if (in->deadline != 0 && in->steps % STEPS_PER_CHECK == 0 && now_ns() > in->deadline) {
+        fail_with(LANG_TIMEOUT, "Error: Time limit exceeded.\n");
+    }
+#ifdef __EMSCRIPTEN__
+    if (in->steps % STEPS_PER_CHECK == 0) flush_output();
+#endif
+}
+
+void interp_write(Interp * in, const char * data, size_t len)
+{
+    if (in->write != NULL) {
+        in->write(in->write_data, data, len);
+    } else {
+        buffer_write(in->output, data, len);
+    }
+}
+
+void interp_printf(Interp * in, const char * fmt, ...)
+{
+    char small[64];
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(small, sizeof(small), fmt, args);
+    va_end(args);
+    if ((size_t)len < sizeof(small)) {
+        interp_write(in, small, len);
+    } else {
+        char * big = new_string(len);
+        va_start(args, fmt);
+        vsnprintf(big, len + 1, fmt, args);
+        va_end(args);
+        interp_write(in, big, len);
+        destroy_string(big);
+    }
+}
+
+
+/*******************
+ *    EXECUTION    *
+ *******************/
+
+/* lifecycle:
+ *   - Creation: When an expression is evaluated
+ *   - Destruction: When the last reference is released
+ * Results, thunks and contexts are reference counted: a thunk owns its result,
+ * its context and its alias, a context owns its thunks, and a list owns its
+ * context. There are no cycles, since the context a thunk is evaluated in
+ * never contains the thunk itself. A 'let' or a parameter lets go of its
+ * context and alias once it is evaluated (see force_binding()).
+ *   TODO: Add function as a PrimitiveType so we can have first-class functions
+ */
+struct Sequence;
+
+struct Result {
+    long long num;
+    PrimitiveType type;
+    size_t refs;  // (constants are shared by every run, see execute())
+    String * str;
+    struct Sequence * seq;
+    BigInt * big;  // numbers which don't fit in num
+} typedef Result;
+
+/* lifecycle:
+ *   - Creation: When statement "def" is executed
+ *   - Destruction: When the run ends (see end_run())
+ *   TODO: Make functions scoped locally to a thunk
+ */
+struct Function {
+    HASH_TYPE name;
+    Queue/*<HASH_TYPE>*/ * params;
+    Expression * def;
+    bool prelude;  // defined by the prelude, so a program may redefine it
+} typedef Function;
+
+/* lifecycle:
+ *   - Creation: For a 'let', a function argument or a list item
+ *   - Destruction: When the last reference is released (list items go with their list)
+ */
+struct Thunk {
+    HASH_TYPE name;  // variable name
+    Expression * e;
+    Result * res;
+    Queue/*<Thunk>*/ * context;
+    struct Thunk * alias;  // the thunk this one stands for, or NULL
+    int refs;
+} typedef Thunk;
+
+/* lifecycle:
+ *   - Creation: When a List expression is executed, or by slicing another Sequence
+ *   - Destruction: When the last reference is released
+ * The elements of a list are thunks stored in one contiguous block, so they are
+ * evaluated lazily (at most once), and length and indexing are O(1).
+ * Like Strings, a slice (e.g. the tail) points into the block of its parent,
+ * and holds a reference to the Sequence that owns the block.
+ */
+struct Sequence {
+    int refs;
+    size_t len;
+    Thunk * items;
+    Queue/*<Thunk>*/ * context;  // shared by all items, NULL for slices
+    struct Sequence * owner;     // NULL if this Sequence owns items
+} typedef Sequence;
+
+/* lifecycle:
+ *   - Creation: When a thunk is executed, while checkpoints may be made or resumed
+ *   - Destruction: When it has been executed (frames live on the C stack)
+ * What a checkpoint needs to continue a statement part way through (see CHECKPOINTS).
+ */
+struct Replay;
+
+struct Frame {
+    Thunk * t;
+    struct Frame * parent;
+    size_t results;          // where the results of the thunks it ran start, in in->frame_results
+    Thunk * call;            // the thunk of the function it called, once made
+    Queue/*<Thunk>*/ * context;  // the context of its 'do', once made
+    struct Replay * replay;  // what it did before the checkpoint being resumed, or NULL
+} typedef Frame;
+
+/* lifecycle:
+ *   - Creation: When a checkpoint made inside a statement is read
+ *   - Destruction: When the run ends
+ * A frame as it was saved, from the root of the statement down.
+ */
+struct Replay {
+    Expression * e;  // (NULL for an alias, whose expression isn't saved)
+    size_t nresults;
+    Result ** results;
+    Thunk * call;
+    Queue/*<Thunk>*/ * context;
+    struct Replay * next;  // the frame of the thunk it was running, NULL for the innermost
+} typedef Replay;
+
+void execute(Thunk * t, Interp * in);
+
+Result * new_result(HASH_TYPE num, String * str, PrimitiveType type)
+{
+    Result * res = heap_alloc(sizeof(Result));
+    res->num = num;
+    res->type = type;
+    res->refs = 1;
+    // Strings are immutable, so the result can share the buffer:
+    res->str = str == NULL ? NULL : string_retain(str);
+    res->seq = NULL;
+    res->big = NULL;
+    return res;
+}
+
+Result * new_number_result(BigInt * big)
+{
+    // (takes the reference to big, and keeps it only if it doesn't fit in a long long)
+    long long num;
+    if (bigint_to_ll(big, &num)) {
+        bigint_release(big);
+        return new_result(num, NULL, PrimitiveNumber);
+    }
+    Result * res = new_result(0, NULL, PrimitiveNumber);
+    res->big = big;
+    return res;
+}
+
+bool is_small_number(Result * res)
+{
+    return res->type == PrimitiveNumber && res->big == NULL;
+}
+
+Result * number_arith(HASH_TYPE op, Result * a, Result * b)
+{
+    long long num;
+    if (a->big == NULL && b->big == NULL && small_arith(op, a->num, b->num, &num)) {
+        return new_result(num, NULL, PrimitiveNumber);
+    }
+    return new_number_result(big_arith(op, a->num, a->big, b->num, b->big));
+}
+
+Result * number_literal(Expression * e)
+{
+    // (the digits of a literal too large for a long long are kept in e->str)
+    if (e->str == NULL) return new_result(e->value, NULL, PrimitiveNumber);
+    return new_number_result(bigint_parse(e->str->data, e->str->len));
+}
+
+Sequence * sequence_retain(Sequence * seq);
+void sequence_release(Sequence * seq);
+
+Result * new_list_result(Sequence * seq)
+{
+    Result * res = new_result(0, NULL, PrimitiveList);
+    res->seq = sequence_retain(seq);
+    return res;
+}
+
+void destroy_result(Result * res)
+{
+    string_release(res->str);
+    sequence_release(res->seq);
+    if (res->big != NULL) bigint_release(res->big);
+    heap_free(res, sizeof(Result));
+}
+
+Result * result_retain(Result * res)
+{
+    res->refs++;
+    return res;
+}
+
+void result_release(Result * res)
+{
+    if (res == NULL || --res->refs > 0) return;
+    destroy_result(res);
+}
+
+struct Thunk * thunk_retain(struct Thunk * t);
+void thunk_release(struct Thunk * t);
+
+Queue/*<Thunk>*/ * new_context(Queue/*<Thunk>*/ * parent)
+{
+    // A context with the bindings of parent (if any), which it keeps alive.
+    Queue * context = new_queue(parent);
+    queue_foreach(node, context) {
+        thunk_retain(node->data);
+    }
+    return context;
+}
+
+Queue/*<Thunk>*/ * context_retain(Queue/*<Thunk>*/ * context)
+{
+    context->refs++;
+    return context;
+}
+
+void context_release(Queue/*<Thunk>*/ * context)
+{
+    if (context == NULL || --context->refs > 0) return;
+    queue_foreach(node, context) {
+        thunk_release(node->data);
+    }
+    destroy_queue(context);
+}
+
+Sequence * new_sequence(Expression * e, Queue/*<Thunk>*/ * context)
+{
+    Sequence * seq = heap_alloc(sizeof(Sequence));
+    seq->refs = 1;
+    seq->len = queue_size(e->children);
+    seq->items = heap_alloc(seq->len * sizeof(Thunk));
+    // The items must not see bindings made after the list was created:
+    seq->context = new_context(context);
+    seq->owner = NULL;
+    size_t i = 0;
+    queue_foreach(node, e->children) {
+        Thunk * item = seq->items + i++;
+        item->name = HASH_OF_TIMES;
+        item->e = node->data;
+        item->res = NULL;
+        item->context = seq->context;  // (held once, by the sequence)
+        item->alias = NULL;
+        item->refs = 1;
+    }
+    return seq;
+}
+
+Sequence * sequence_slice(Sequence * parent, size_t l, size_t r)
+{
+    expect(l <= r && r <= parent->len, "Error (internal): sequence_slice out of range.\n");
+    Sequence * owner = parent->owner == NULL ? parent : parent->owner;
+    Sequence * seq = heap_alloc(sizeof(Sequence));
+    seq->refs = 1;
+    seq->len = r - l;
+    seq->items = parent->items + l;
+    seq->context = NULL;
+    seq->owner = sequence_retain(owner);
+    return seq;
+}
+
+Sequence * sequence_retain(Sequence * seq)
+{
+    seq->refs++;
+    return seq;
+}
+
+void sequence_release(Sequence * seq)
+{
+    if (seq == NULL || --seq->refs > 0) return;
+    if (seq->owner != NULL) {
+        sequence_release(seq->owner);
+    } else {
+        for (size_t i = 0; i < seq->len; i++) {
+            result_release(seq->items[i].res);
+        }
+        heap_free(seq->items, seq->len * sizeof(Thunk));
+        context_release(seq->context);
+    }
+    heap_free(seq, sizeof(Sequence));
+}
+
+void force_result(Result * res, Interp * in)
+{
+    // Evaluate every item of a list (recursively).
+    if (res->type != PrimitiveList) return;
+    for (size_t i = 0; i < res->seq->len; i++) {
+        Thunk * item = res->seq->items + i;
+        execute(item, in);
+        force_result(item->res, in);
+    }
+}
+
+void print_value(Interp * in, Result * res)
+{
+    if      (res->type == PrimitiveANY)    interp_write(in, "ANY", 3);
+    else if (res->type == PrimitiveTRUE)   interp_write(in, "TRUE", 4);
+    else if (res->type == PrimitiveFALSE)  interp_write(in, "FALSE", 5);
+    else if (res->type == PrimitiveNULL)   interp_write(in, "NULL", 4);
+    else if (res->type == PrimitiveString) interp_write(in, res->str->data, res->str->len);
+    else if (res->type == PrimitiveNumber && res->big != NULL) {
+        size_t len;
+        char * digits = bigint_format(res->big, &len);
+        interp_write(in, digits, len);
+        destroy_string(digits);
+    }
+    else if (res->type == PrimitiveNumber) interp_printf(in, "%lld", res->num);
+    else if (res->type == PrimitiveChar)   interp_printf(in, "%c", (char)res->num);
+    else if (res->type == PrimitiveList) {
+        // expects the list to be forced
+        interp_write(in, "[", 1);
+        for (size_t i = 0; i < res->seq->len; i++) {
+            if (i != 0) interp_write(in, " ", 1);
+            print_value(in, res->seq->items[i].res);
+        }
+        interp_write(in, "]", 1);
+    }
+}
+
+void print_result(Interp * in, Result * res)
+{
+    print_value(in, res);
+    interp_write(in, "\n", 1);
+}
+
+bool result_equal(Result * a, Result * b);
+
+bool sequence_equal(Sequence * a, Sequence * b)
+{
+    if (a->len != b->len)     return false;
+    if (a->items == b->items) return true;
+    for (size_t i = 0; i < a->len; i++) {
+        Result * ra = a->items[i].res, * rb = b->items[i].res;
+        expect(ra != NULL && rb != NULL, "Error (internal): sequence_equal on unforced list.\n");
+        if (!result_equal(ra, rb)) return false;
+    }
+    return true;
+}
+
+bool result_equal(Result * a, Result * b)
+{
+    if (a->type == PrimitiveANY ||
+        b->type == PrimitiveANY)    return true;
+    if (a->type != b->type)         return false;
+    if (a->type == PrimitiveTRUE)   return true;
+    if (a->type == PrimitiveFALSE)  return true;
+    if (a->type == PrimitiveNULL)   return true;
+    if (a->type == PrimitiveString) return string_equal(a->str, b->str);
+    if (a->type == PrimitiveNumber && (a->big != NULL || b->big != NULL)) {
+        return a->big != NULL && b->big != NULL && bigint_equal(a->big, b->big);
+    }
+    if (a->type == PrimitiveNumber) return a->num == b->num;
+    if (a->type == PrimitiveChar)   return a->num == b->num;
+    if (a->type == PrimitiveList)   return sequence_equal(a->seq, b->seq);
+    return false;
+}
+
+bool result_is_true(Result * res)
+{
+    if (res->type == PrimitiveANY)    return true;
+    if (res->type == PrimitiveTRUE)   return true;
+    if (res->type == PrimitiveFALSE)  return false;
+    if (res->type == PrimitiveNULL)   return false;
+    if (res->type == PrimitiveString) return true;
+    if (res->type == PrimitiveNumber) return res->num != 0 || res->big != NULL;
+    if (res->type == PrimitiveChar)   return res->num != 0;
+    if (res->type == PrimitiveList)   return res->seq->len != 0;
+    return false;
+}
+
+HASH_TYPE hash_result(Result * res)
+{
+    // reserve first 3 bits for basic types:
+    if (res->type == PrimitiveNULL)   return 0;
+    if (res->type == PrimitiveANY)    return 1;
+    if (res->type == PrimitiveTRUE)   return 2;
+    if (res->type == PrimitiveFALSE)  return 3;
+    if (res->type == PrimitiveString) return 8 * string_hash(res->str);
+    if (res->type == PrimitiveNumber && res->big != NULL) return 8 * bigint_hash(res->big);
+    if (res->type == PrimitiveNumber) return 8 * res->num;
+    if (res->type == PrimitiveChar)   return 8 * res->num;
+    if (res->type == PrimitiveList)   return 8 * res->seq->len + 4;
+    return 0;
+}
+
+void find_slots(Expression * e, Queue/*<HASH_TYPE>*/ * params);
+
+Function * new_function(HASH_TYPE name, Expression * e)
+{
+    /*
+     * This function expects the sub-Expression queue to be formatted like so:
+     *   HEAD <-> Id("def") <-> Id(name) [ <-> Id(param1) <-> Id(param2) ... ]  \
+     *     <-> any(declaration) <-> TAIL
+     * Minimum expected queue size = 3 ("def", name, and declaration)
+     */
+    Function * f = heap_alloc(sizeof(Function));
+    f->name = name;
+    f->params = new_queue(NULL);
+    int i = 0, len = queue_size(e->children);
+    queue_foreach(node, e->children) {
+        if (i > 1 && i != len-1) {
+            Expression * ec = node->data;
+            expect(ec->type == Id,
+                    "Error (internal): new_function :: Bad Expression tree.\n");
+            HASH_TYPE param = ec->value;
+            queue_push(f->params, (void *) param);
+        }
+        i++;
+    }
+    f->def = queue_end(e->children)->prev->data;
+    f->prelude = false;
+    find_slots(f->def, f->params);
+    return f;
+}
+
+void destroy_function(Function * f)
+{
+    destroy_queue(f->params);
+    heap_free(f, sizeof(Function));
+}
+
+Thunk * new_thunk(HASH_TYPE name /*required*/, Expression * e, Queue/*<Thunk>*/ * context)
+{
+    Thunk * t = heap_alloc(sizeof(Thunk));
+    t->e = e;
+    t->res = NULL;
+    t->name = name;
+    // This is tricky: Sometimes, we want a shared context between thunks,
+    // sometimes we want a completely new  and empty context,
+    // and sometimes we want a clone of the parent context (to avoid contamination).
+    // So, just keep a pointer (and a reference), and let calling function determine the context.
+    t->context = context == NULL ? NULL : context_retain(context);
+    t->alias = NULL;
+    t->refs = 1;
+    return t;
+}
+
+Thunk * thunk_retain(Thunk * t)
+{
+    t->refs++;
+    return t;
+}
+
+void thunk_release(Thunk * t)
+{
+    if (t == NULL || --t->refs > 0) return;
+    result_release(t->res);
+    context_release(t->context);
+    thunk_release(t->alias);
+    heap_free(t, sizeof(Thunk));
+}
+
+int input_getc(Interp * in)
+{
+    if (in->input == NULL) return getchar();
+    if (in->input[in->input_pos] == '\0') return EOF;
+    return (unsigned char)in->input[in->input_pos++];
+}
+
+void input_ungetc(Interp * in, int c)
+{
+    if (c == EOF) return;
+    if (in->input == NULL) ungetc(c, stdin);
+    else in->input_pos--;
+}
+
+Result * read_input_number(Interp * in)
+{
+    // Reads an integer like scanf(" %lld"), but of any size, or returns NULL.
+    int c = input_getc(in);
+    while (c != EOF && isspace(c)) c = input_getc(in);
+    bool negative = c == '-';
+    if (c == '-' || c == '+') c = input_getc(in);
+    Buffer * digits = new_buffer();
+    while (c != EOF && isdigit(c)) {
+        buffer_putc(digits, c);
+        c = input_getc(in);
+    }
+    input_ungetc(in, c);
+    Result * res = NULL;
+    long long num = 0;
+    if (digits->len == 0) {
+        res = NULL;
+    } else if (digits->len < 19) {
+        for (size_t i = 0; i < digits->len; i++) num = num * 10 + (digits->data[i] - '0');
+        res = new_result(negative ? -num : num, NULL, PrimitiveNumber);
+    } else {
+        BigInt * big = bigint_parse(digits->data, digits->len);
+        big->negative = negative && big->len != 0;
+        res = new_number_result(big);
+    }
+    destroy_buffer(digits);
+    return res;
+}
+
+bool read_input_char(Interp * in, char * c)
+{
+    if (in->input == NULL) return scanf(" %c", c) == 1;
+    int n = 0;
+    if (sscanf(in->input + in->input_pos, " %c%n", c, &n) != 1) return false;
+    in->input_pos += n;
+    return true;
+}
+
+Thunk * find_binding(Queue/*<Thunk>*/ * context, HASH_TYPE name)
+{
+    // The thunk a name refers to in a context (the first bound), or NULL.
+    queue_foreach(node, context) {
+        Thunk * tc = node->data;
+        if (tc->name == name) return tc;
+    }
+    return NULL;
+}
+
+Function * find_function(Interp * in, HASH_TYPE name, bool prelude)
+{
+    // Calls in the prelude find only its own functions; calls in the program
+    // find the program's, or else the prelude's.
+    Function * found = NULL;
+    queue_foreach(node, in->ftable) {
+        Function * f = node->data;
+        if (f->name != name) continue;
+        if (f->prelude == prelude) return f;
+        if (!prelude) found = f;
+    }
+    return found;
+}
+
+bool in_prelude(Interp * in, Expression * e)
+{
+    return in->prelude != NULL && e->arena == in->prelude->arena;
+}
+
+void clear_functions(Interp * in)
+{
+    queue_foreach(node, in->ftable) {
+        destroy_function(node->data);
+    }
+    destroy_queue(in->ftable);
+    in->ftable = new_queue(NULL);
+    in->functions_version++;
+}
+
+/*
+ * A 'match' statement is compiled into a MatchTable the first time it runs.
+ * Arms whose tests are literals (numbers, chars, strings, TRUE, FALSE, NULL)
+ * go into a hash table from value to the first arm with that value, so they
+ * are found without evaluating every test. The other arms are kept in order,
+ * and only those before the literal hit (if any) are evaluated, so the first
+ * matching arm still wins.
+ */
+struct MatchArm {
+    Expression * test;
+    Expression * answer;
+} typedef MatchArm;
+
+struct MatchSlot {
+    Result * key;  // NULL if empty
+    size_t arm;
+} typedef MatchSlot;
+
+struct MatchTable {
+    size_t narms;
+    MatchArm * arms;
+    size_t ndynamic;
+    size_t * dynamic;     // indices of the non-literal arms, in order
+    size_t first_literal; // narms if none
+    size_t cap;           // a power of two, or 0
+    MatchSlot * slots;
+} typedef MatchTable;
+
+bool is_literal_test(Expression * e)
+{
+    if (e->type != Primitive) return false;
+    return e->ptype == PrimitiveNumber || e->ptype == PrimitiveChar ||
+           e->ptype == PrimitiveString || e->ptype == PrimitiveTRUE ||
+           e->ptype == PrimitiveFALSE  || e->ptype == PrimitiveNULL;
+}
+
+size_t match_slot(MatchTable * mt, HASH_TYPE hash)
+{
+    // (number keys are multiples of 8, so mix the bits before masking)
+    return ((unsigned long long)hash * 0x9E3779B97F4A7C15ULL >> 32) & (mt->cap - 1);
+}
+
+MatchTable * new_match_table(Expression * e)
+{
+    // TODO: Add match to grammar, and move this sanitization to the parser...
+    expect(queue_size(e->children) >= 2,
+            "Error: Too few parameters to 'match' statement.\n");
+    size_t nargs = queue_size(e->children) - 2;
+    expect(nargs % 3 == 0, "Error: Expected (test : answer) triplets in match statement.\n");
+    // (checked before anything is allocated, so an error leaks nothing)
+    for (Node * cur = queue_begin(e->children)->next->next; cur != queue_end(e->children);
+            cur = cur->next->next->next) {
+        Expression * ec_sep = cur->next->data;
+        expect(ec_sep->type == Id && ec_sep->value == HASH_OF_COLON,
+                "Error: Expected ':' token in match statement.\n");
+    }
+
+    MatchTable * mt = malloc(sizeof(MatchTable));
+    mt->narms = nargs / 3;
+    mt->arms = malloc(mt->narms * sizeof(MatchArm));
+    mt->dynamic = malloc(mt->narms * sizeof(size_t));
+    mt->ndynamic = 0;
+    mt->first_literal = mt->narms;
+    size_t nliterals = 0;
+    Node * cur = queue_begin(e->children)->next->next;
+    for (size_t i = 0; i < mt->narms; i++) {
+        Expression * ec_test = cur->data;
+        mt->arms[i].test = ec_test;
+        mt->arms[i].answer = cur->next->next->data;
+        cur = cur->next->next->next;
+        if (is_literal_test(ec_test)) {
+            if (mt->first_literal == mt->narms) mt->first_literal = i;
+            nliterals++;
+        } else {
+            mt->dynamic[mt->ndynamic++] = i;
+        }
+    }
+
+    // hash the literal arms, keeping only the first arm for each value:
+    mt->cap = 0;
+    mt->slots = NULL;
+    if (nliterals == 0) return mt;
+    mt->cap = 4;
+    while (mt->cap < 2 * nliterals) mt->cap *= 2;
+    mt->slots = calloc(mt->cap, sizeof(MatchSlot));
+    for (size_t i = 0; i < mt->narms; i++) {
+        Expression * ec = mt->arms[i].test;
+        if (!is_literal_test(ec)) continue;
+        Result * key = ec->ptype == PrimitiveNumber ? number_literal(ec)
+                                                    : new_result(ec->value, ec->str, ec->ptype);
+        size_t slot = match_slot(mt, hash_result(key));
+        while (mt->slots[slot].key != NULL && !result_equal(mt->slots[slot].key, key)) {
+            slot = (slot + 1) & (mt->cap - 1);
+        }
+        if (mt->slots[slot].key != NULL) {
+            destroy_result(key);  // shadowed by an earlier arm
+            continue;
+        }
+        mt->slots[slot].key = key;
+        mt->slots[slot].arm = i;
+    }
+    return mt;
+}
+
+void destroy_match_table(MatchTable * mt)
+{
+    for (size_t i = 0; i < mt->cap; i++) {
+        if (mt->slots[i].key != NULL) destroy_result(mt->slots[i].key);
+    }
+    free(mt->slots);
+    free(mt->dynamic);
+    free(mt->arms);
+    free(mt);
+}
+
+size_t match_table_find(MatchTable * mt, Result * res)
+{
+    // Returns the first literal arm equal to res, or narms if there is none.
+    if (res->type == PrimitiveANY) return mt->first_literal;  // equal to anything
+    if (mt->cap == 0) return mt->narms;
+    size_t slot = match_slot(mt, hash_result(res));
+    while (mt->slots[slot].key != NULL) {
+        if (result_equal(mt->slots[slot].key, res)) return mt->slots[slot].arm;
+        slot = (slot + 1) & (mt->cap - 1);
+    }
+    return mt->narms;
+}
+
+void maybe_checkpoint(Interp * in, size_t next, Queue/*<Thunk>*/ * context);
+
+Result * evaluate(Expression * e, Queue/*<Thunk>*/ * context, Interp * in);
+
+Result * execute_statement(Interp * in, Expression * e, Queue/*<Thunk>*/ * context)
+{
+    // Runs a top-level statement, with the given context for its 'let's.
+    return evaluate(e, context, in);
+}
+
+void execute_statements(Thunk * t, Interp * in, size_t first, Queue/*<Thunk>*/ * context)
+{
+    // Runs the statements of a program from the given one on.
+    // The run can be saved in between, or in one (see CHECKPOINTS).
+    Frame * frame = in->frame;
+    in->frame = NULL;  // (each statement is the root of its frames)
+    in->statement_context = context;
+    size_t i = 0;
+    queue_foreach(node, t->e->children) {
+        if (i++ < first) continue;
+        in->statement = i - 1;
+        in->statement_functions = in->functions_version;
+        Result * res = execute_statement(in, node->data, context);
+        result_release(t->res);
+        t->res = res;
+        maybe_checkpoint(in, i, context);
+    }
+    in->frame = frame;
+}
+
+/*******************
+ *   QUICKENING    *
+ *******************/
+
+/*
+ * The first time a statement runs, it is classified by its head and number
+ * of children (see quicken()), and from then on the common shapes go
+ * straight to their code in execute_quick(), skipping the chain of builtin
+ * names and the checks already made. A call remembers the function it found,
+ * for as long as in->functions_version says the ftable hasn't changed
+ * (a 'def' may replace a function of the prelude). A literal keeps its
+ * Result, since results are never modified.
+ * Statements of any other shape take the general path, which still reports
+ * their errors.
+ *
+ * '+', '-' and '=' are specialized further once they have seen two numbers
+ * which fit in a long long: they then work on those directly, as long as
+ * their operands still do (and the sum does), and go back to the general
+ * case when they don't, e.g. for a big number.
+ *
+ * The parameters of a function are always the first bindings of the
+ * contexts its body runs in (its 'let's come after them, and lookups find
+ * the first binding of a name), so when a 'def' runs, the names in its body
+ * which refer to its parameters are given their position (see find_slots()).
+ * The binding there is still checked, and any other name is looked up.
+ */
+
+bool is_builtin(HASH_TYPE name);
+
+void find_slots(Expression * e, Queue/*<HASH_TYPE>*/ * params)
+{
+    // Gives the names in e which refer to one of params its position.
+    if (e->type == Id) {
+        int i = 0;
+        queue_foreach(node, params) {
+            if ((HASH_TYPE)node->data == e->value) {
+                e->slot = i;
+                break;
+            }
+            i++;
+        }
+    }
+    Expression * head = queue_size(e->children) == 0 ? NULL : queue_begin(e->children)->data;
+    // (the names in a 'def' inside e are its own)
+    if (e->type == Statement && head != NULL && head->type == Id && head->value == HASH_OF_DEF) return;
+    queue_foreach(node, e->children) {
+        find_slots(node->data, params);
+    }
+}
+
+Thunk * find_slot(Queue/*<Thunk>*/ * context, Expression * e)
+{
+    // The thunk a name refers to, at its position if it has one.
+    if (e->slot >= 0 && (size_t)e->slot < context->size) {
+        Node * node = queue_begin(context);
+        for (int i = 0; i < e->slot; i++) node = node->next;
+        Thunk * tc = node->data;
+        if (tc->name == e->value) return tc;
+    }
+    return find_binding(context, e->value);
+}
+
+void quicken(Expression * e)
+{
+    Expression * head = queue_begin(e->children)->data;
+    int n = queue_size(e->children);
+    HASH_TYPE name = head->value;
+    if (head->type == Id && !is_builtin(name)) {
+        e->quick = QUICK_CALL;
+    } else if (n == 3 && (name == HASH_OF_PLUS || name == HASH_OF_MINUS || name == HASH_OF_TIMES ||
+                          name == HASH_OF_DIVIDE || name == HASH_OF_PERCENT)) {
+        e->quick = QUICK_ARITH;
+    } else if (n == 3 && name == HASH_OF_EQUAL) {
+        e->quick = QUICK_EQUAL;
+    } else if (n == 4 && name == HASH_OF_QUESTION) {
+        e->quick = QUICK_QUESTION;
+    } else {
+        e->quick = QUICK_GENERIC;
+    }
+}
+
+Result * evaluate(Expression * e, Queue/*<Thunk>*/ * context, Interp * in)
+{
+    // The value of e, for expressions whose thunk isn't kept.
+    // (the thunk borrows the context, and the caller releases the result)
+    Thunk t = { HASH_OF_TIMES, e, NULL, context, NULL, 1 };
+    execute(&t, in);
+    return t.res;
+}
+
+void call_function(Thunk * t, Interp * in, HASH_TYPE name, Function * userfunc);
+
+void execute_quick(Thunk * t, Interp * in)
+{
+    Node * first = queue_begin(t->e->children);
+    HASH_TYPE name = ((Expression *) first->data)->value;
+    switch (t->e->quick) {
+    case QUICK_ARITH: {
+        Result * a = evaluate(first->next->data, t->context, in);
+        Result * b = evaluate(first->next->next->data, t->context, in);
+        t->res = number_arith(name, a, b);
+        if (is_small_number(a) && is_small_number(b) && is_small_number(t->res)) {
+            if (name == HASH_OF_PLUS) t->e->quick = QUICK_ADD_INT;
+            if (name == HASH_OF_MINUS) t->e->quick = QUICK_SUB_INT;
+        }
+        result_release(a);
+        result_release(b);
+        break;
+    }
+    case QUICK_ADD_INT:
+    case QUICK_SUB_INT: {
+        Result * a = evaluate(first->next->data, t->context, in);
+        Result * b = evaluate(first->next->next->data, t->context, in);
+        long long num;
+        if (is_small_number(a) && is_small_number(b) &&
+                !(t->e->quick == QUICK_ADD_INT ? __builtin_add_overflow(a->num, b->num, &num)
+                                               : __builtin_sub_overflow(a->num, b->num, &num))) {
+            t->res = new_result(num, NULL, PrimitiveNumber);
+        } else {
+            t->e->quick = QUICK_ARITH;
+            t->res = number_arith(name, a, b);
+        }
+        result_release(a);
+        result_release(b);
+        break;
+    }
+    case QUICK_EQUAL: {
+        Result * a = evaluate(first->next->data, t->context, in);
+        Result * b = evaluate(first->next->next->data, t->context, in);
+        force_result(a, in);
+        force_result(b, in);
+        t->res = new_result(0, NULL, result_equal(a, b) ? PrimitiveTRUE : PrimitiveFALSE);
+        if (is_small_number(a) && is_small_number(b)) t->e->quick = QUICK_EQUAL_INT;
+        result_release(a);
+        result_release(b);
+        break;
+    }
+    case QUICK_EQUAL_INT: {
+        Result * a = evaluate(first->next->data, t->context, in);
+        Result * b = evaluate(first->next->next->data, t->context, in);
+        if (is_small_number(a) && is_small_number(b)) {
+            t->res = new_result(0, NULL, a->num == b->num ? PrimitiveTRUE : PrimitiveFALSE);
+        } else {
+            t->e->quick = QUICK_EQUAL;
+            force_result(a, in);
+            force_result(b, in);
+            t->res = new_result(0, NULL, result_equal(a, b) ? PrimitiveTRUE : PrimitiveFALSE);
+        }
+        result_release(a);
+        result_release(b);
+        break;
+    }
+    case QUICK_QUESTION: {
+        Result * test = evaluate(first->next->data, t->context, in);
+        Node * branch = result_is_true(test) ? first->next->next : first->next->next->next;
+        result_release(test);
+        t->res = evaluate(branch->data, t->context, in);
+        break;
+    }
+    case QUICK_CALL:
+        if (t->e->callee == NULL || t->e->callee_version != in->functions_version) {
+            t->e->callee = find_function(in, name, in_prelude(in, t->e));
+            t->e->callee_version = in->functions_version;
+        }
+        call_function(t, in, name, t->e->callee);
+        break;
+    }
+}
+
+void call_function(Thunk * t, Interp * in, HASH_TYPE name, Function * userfunc)
+{
+    // Runs t, a call of userfunc (the function found for name, or NULL).
+    expect(userfunc != NULL,
+            "Error: Couldn't find function named %s!\n",
+            (char *)hashtable_find(in->symbols, name)->value);
+    int num_params_expected = queue_size(userfunc->params);
+    int num_params_supplied = queue_size(t->e->children) - 1; // ignore the function name
+    expect(num_params_expected == num_params_supplied,
+            "Error: Expected %d parameters for function %s, but got %d.\n",
+            num_params_expected,
+            (char *)hashtable_find(in->symbols, name)->value,
+            num_params_supplied);
+    // (a checkpoint can be made here, in the middle of a statement)
+    if (in->checkpoint_fname != NULL) maybe_checkpoint(in, in->statement, in->statement_context);
+    // When resuming, the call may have been made before the checkpoint:
+    Frame * frame = in->frame;
+    Thunk * tf = frame != NULL && frame->replay != NULL ? frame->replay->call : NULL;
+    if (tf == NULL) {
+        // Create a new thunk, with an empty context.
+        Queue/*<Thunk>*/ * context = new_context(NULL);
+        tf = new_thunk(HASH_OF_TIMES, userfunc->def, context);
+        context_release(context);
+        // For each function parameter, create a new thunk with the context
+        // of the current thunk being executed,
+        // and add it to the function thunk's context.
+        // That way, the only Ids visible in the function execution are the parameters.
+        Node * cur = queue_begin(t->e->children)->next;
+        queue_foreach(node, userfunc->params) {
+            HASH_TYPE param_id = (HASH_TYPE)node->data;
+            Expression * ec = cur->data;
+            // A name passed straight through stands for the caller's thunk
+            // (the one it stands for, if it is itself an alias), so using it
+            // takes one step however deep the recursion, and it doesn't keep
+            // the caller's context alive.
+            Thunk * alias = ec->type == Id ? find_binding(t->context, ec->value) : NULL;
+            if (alias != NULL && alias->alias != NULL) alias = alias->alias;
+            Thunk * tp = new_thunk(param_id, ec, alias == NULL ? t->context : NULL);
+            if (alias != NULL) tp->alias = thunk_retain(alias);
+            queue_push(tf->context, tp);
+            cur = cur->next;
+        }
+    }
+    if (frame != NULL) frame->call = tf;
+    execute(tf, in);
+    t->res = tf->res;
+    tf->res = NULL;
+    // The items of a returned list may still refer to the parameters,
+    // in which case the list keeps them (and their context) alive:
+    thunk_release(tf);
+}
+
+void force_binding(Thunk * t, Interp * in)
+{
+    // Evaluates a 'let' or a parameter, which then needs neither its context
+    // nor its alias: keeping them would keep the frames they belong to alive.
+    execute(t, in);
+    context_release(t->context);
+    t->context = NULL;
+    thunk_release(t->alias);
+    t->alias = NULL;
+}
+
+void grow_frame_results(Interp * in)
+{
+    size_t size = in->frame_results_size == 0 ? 64 : in->frame_results_size * 2;
+    Result ** results = heap_alloc(size * sizeof(Result *));
+    if (in->frame_results != NULL) {
+        memcpy(results, in->frame_results, in->nframe_results * sizeof(Result *));
+        heap_free(in->frame_results, in->frame_results_size * sizeof(Result *));
+    }
+    in->frame_results = results;
+    in->frame_results_size = size;
+}
+
+void push_frame_result(Interp * in, Result * res)
+{
+    if (in->nframe_results == in->frame_results_size) grow_frame_results(in);
+    in->frame_results[in->nframe_results++] = result_retain(res);
+}
+
+void execute_in_frame(Thunk * t, Interp * in)
+{
+    // Runs t in a frame, which keeps the result of each thunk t runs until t
+    // is done. When resuming, t may be one its parent ran before the
+    // checkpoint, whose result is already known.
+    if (t->res == NULL && (t->alias != NULL || t->e->type == Id)) {
+        // A name (or an alias) runs just its binding, whatever it did before
+        // the checkpoint, so it needs no frame: its binding is kept in its place.
+        in->entering = t;
+        execute(t, in);
+        return;
+    }
+    Frame * parent = in->frame;
+    Replay * replay = in->replay;
+    in->replay = NULL;  // (only the root of the statement takes it)
+    if (parent != NULL && parent->replay != NULL) {
+        size_t done = in->nframe_results - parent->results;
+        if (done < parent->replay->nresults) {
+            if (t->res == NULL) t->res = result_retain(parent->replay->results[done]);
+            push_frame_result(in, t->res);
+            return;
+        }
+        // (the thunk it was running then, after which it runs as usual)
+        if (done == parent->replay->nresults) replay = parent->replay->next;
+    }
+    if (t->res != NULL || (t->alias == NULL && (t->e->type == Primitive || t->e->type == List))) {
+        // (it runs no other thunk, so it needs no frame)
+        in->entering = t;
+        execute(t, in);
+        if (parent != NULL) push_frame_result(in, t->res);
+        return;
+    }
+    expect(replay == NULL || t->e == NULL || replay->e == NULL || t->e == replay->e,
+            "Error: Corrupt checkpoint.\n");
+    Frame f = { t, parent, in->nframe_results, NULL, NULL, replay };
+    in->frame = &f;
+    in->entering = t;
+    execute(t, in);
+    in->frame = parent;
+    while (in->nframe_results > f.results) {
+        result_release(in->frame_results[--in->nframe_results]);
+    }
+    if (replay != NULL) {
+        for (size_t i = 0; i < replay->nresults; i++) result_release(replay->results[i]);
+    }
+    if (parent != NULL) push_frame_result(in, t->res);
+}
+
+void execute(Thunk * t, Interp * in)
+{
+    if (in->keep_frames) {
+        // (t goes through execute_in_frame() first, which then runs it here)
+        if (in->entering != t) {
+            execute_in_frame(t, in);
+            return;
+        }
+        in->entering = NULL;
+    }
+    check_limits(in);
+    if (t->res != NULL) {
+        // do nothing, this has already been calculated
+
+    } else if (t->alias != NULL) {
+        force_binding(t->alias, in);
+        t->res = result_retain(t->alias->res);
+
+    } else if (t->e->type == Program) {
+        // Make a clone of context share variables in local scope,
+        // without contaminating parent scope.
+        Queue/*<Thunk>*/ * context = new_context(t->context);
+        execute_statements(t, in, 0, context);
+        context_release(context);
 
     } else if (t->e->type == Statement) {
         expect(queue_size(t->e->children) >= 1,
                 "Error: Expected Statement to have more children.\n");
+        if (t->e->quick == QUICK_NONE) quicken(t->e);
+        if (t->e->quick != QUICK_GENERIC) {
+            execute_quick(t, in);
+            return;
+        }
         HASH_TYPE name = ((Expression *) queue_begin(t->e->children)->data)->value;
         if (name == HASH_OF_DEF) {
             // add function to ftable
@@ -884,310 +3090,3895 @@ void execute(Thunk * t, HashTable * symbols)
                     expect(ec->type == Id, "Error: Expected function parameter to be id.\n");
                     i++;
                 }
-            } while (0);
-            HASH_TYPE fname = ((Expression *) queue_begin(t->e->children)->next->data)->value;
-            // check if function already exists by name:
-            expect(find_function(fname) == NULL,
-                    "Error: function '%s' redeclaration not allowed!\n",
-                    (char *)hashtable_find(symbols, fname)->value);
+            } while (0);
+            HASH_TYPE fname = ((Expression *) queue_begin(t->e->children)->next->data)->value;
+            // check if function already exists by name:
+            // (programs may shadow functions of the prelude, which keeps calling its own)
+            Function * existing = find_function(in, fname, false);
+            expect(existing == NULL || existing->prelude,
+                    "Error: function '%s' redeclaration not allowed!\n",
+                    (char *)hashtable_find(in->symbols, fname)->value);
+
+            Function * f = new_function(fname, t->e);
+            queue_push(in->ftable, f);
+            in->functions_version++;
+
+        } else if (name == HASH_OF_DO) {
+            int i = 0;
+            // (or the one it had made before the checkpoint being resumed)
+            Frame * frame = in->frame;
+            Queue/*<Thunk>*/ * context = frame != NULL && frame->replay != NULL ? frame->replay->context : NULL;
+            if (context == NULL) context = new_context(t->context);
+            if (frame != NULL) frame->context = context;
+            // (t has no result until it is done, which a checkpoint relies on)
+            Result * res = NULL;
+            queue_foreach(node, t->e->children) {
+                if (i != 0) {
+                    result_release(res);
+                    res = evaluate(node->data, context, in);
+                }
+                i++;
+            }
+            t->res = res;
+            context_release(context);
+
+        } else if (name == HASH_OF_LET) {
+            expect(queue_size(t->e->children) == 3,
+                    "Error: Expected 'let' statement to be given 2 parameters.\n");
+            Expression * id = queue_begin(t->e->children)->next->data;
+            Expression * ec = queue_begin(t->e->children)->next->next->data;
+            expect(id->type == Id, "Error: Expected parameter 1 of 'let' statement to be Id.\n");
+            // This thunk shouldn't see itself (so t->context is cloned first):
+            Queue/*<Thunk>*/ * context = new_context(t->context);
+            Thunk * tc = new_thunk(id->value, ec, context);
+            context_release(context);
+            queue_push(t->context, tc);
+            t->res = new_result(0, NULL, PrimitiveNULL);
+
+        } else if (name == HASH_OF_GET) {
+            // (get s i) is the i-th (0-indexed) character or item of s,
+            // or NULL if out of range
+            expect(queue_size(t->e->children) == 3,
+                    "Invalid number of arguments for 'get' function.\n");
+            Expression * ea = queue_begin(t->e->children)->next->data;
+            Expression * eb = queue_begin(t->e->children)->next->next->data;
+            Result * a = evaluate(ea, t->context, in);
+            Result * b = evaluate(eb, t->context, in);
+            expect(a->type == PrimitiveString || a->type == PrimitiveList,
+                    "Error: Expected parameter 1 of 'get' to be a string or list.\n");
+            expect(b->type == PrimitiveNumber,
+                    "Error: Expected parameter 2 of 'get' to be a number.\n");
+            long long i = b->big == NULL ? b->num : -1;  // (big is out of range)
+            if (a->type == PrimitiveString) {
+                String * str = a->str;
+                if (i >= 0 && (size_t)i < str->len) {
+                    t->res = new_result((unsigned char)str->data[i], NULL, PrimitiveChar);
+                } else {
+                    t->res = new_result(0, NULL, PrimitiveNULL);
+                }
+            } else {
+                Sequence * seq = a->seq;
+                if (i >= 0 && (size_t)i < seq->len) {
+                    execute(seq->items + i, in);
+                    t->res = result_retain(seq->items[i].res);
+                } else {
+                    t->res = new_result(0, NULL, PrimitiveNULL);
+                }
+            }
+            result_release(a);
+            result_release(b);
+
+        } else if (name == HASH_OF_AT) {
+            // (@ s 1) is the first character (or item) of s, and (@ s 2) is the rest of s.
+            // Both are NULL if s is empty. The rest is a view into s, so walking
+            // a string or list this way is linear and never copies.
+            expect(queue_size(t->e->children) == 3,
+                    "Invalid number of arguments for '@' function.\n");
+            Expression * ea = queue_begin(t->e->children)->next->data;
+            Expression * eb = queue_begin(t->e->children)->next->next->data;
+            Result * a = evaluate(ea, t->context, in);
+            Result * b = evaluate(eb, t->context, in);
+            expect(a->type == PrimitiveString || a->type == PrimitiveList,
+                    "Error: Expected parameter 1 of '@' to be a string or list.\n");
+            expect(b->type == PrimitiveNumber && b->big == NULL && (b->num == 1 || b->num == 2),
+                    "Error: Expected parameter 2 of '@' to be 1 or 2.\n");
+            if (a->type == PrimitiveString) {
+                String * str = a->str;
+                if (str->len == 0) {
+                    t->res = new_result(0, NULL, PrimitiveNULL);
+                } else if (b->num == 1) {
+                    t->res = new_result((unsigned char)str->data[0], NULL, PrimitiveChar);
+                } else {
+                    String * rest = string_slice(str, 1, str->len);
+                    t->res = new_result(1, rest, PrimitiveString);
+                    string_release(rest);
+                }
+            } else {
+                Sequence * seq = a->seq;
+                if (seq->len == 0) {
+                    t->res = new_result(0, NULL, PrimitiveNULL);
+                } else if (b->num == 1) {
+                    execute(seq->items, in);
+                    t->res = result_retain(seq->items[0].res);
+                } else {
+                    Sequence * rest = sequence_slice(seq, 1, seq->len);
+                    t->res = new_list_result(rest);
+                    sequence_release(rest);
+                }
+            }
+            result_release(a);
+            result_release(b);
+
+        } else if (name == HASH_OF_LEN) {
+            expect(queue_size(t->e->children) == 2,
+                    "Invalid number of arguments for 'len' function.\n");
+            Expression * ec = queue_begin(t->e->children)->next->data;
+            Result * a = evaluate(ec, t->context, in);
+            expect(a->type == PrimitiveString || a->type == PrimitiveList,
+                    "Error: Expected parameter of 'len' to be a string or list.\n");
+            if (a->type == PrimitiveString) {
+                t->res = new_result(a->str->len, NULL, PrimitiveNumber);
+            } else {
+                t->res = new_result(a->seq->len, NULL, PrimitiveNumber);
+            }
+            result_release(a);
+
+        } else if (name == HASH_OF_READ_INT) {
+            expect(queue_size(t->e->children) == 1,
+                    "Error: Function 'read_int' expects no parameters.\n");
+            t->res = read_input_number(in);
+            expect(t->res != NULL, "Error: read_int reached end of file.\n");
+
+        } else if (name == HASH_OF_READ_CHAR) {
+            expect(queue_size(t->e->children) == 1,
+                    "Error: Function 'read_char' expects no parameters.\n");
+            char c;
+            expect(read_input_char(in, &c), "Error: read_char reached end of file.\n");
+            t->res = new_result(c, NULL, PrimitiveChar);
+
+        } else if (name == HASH_OF_PRINT) {
+            expect(queue_size(t->e->children) == 2,
+                    "Invalid number of arguments for 'print' function.\n");
+            Expression * ec = queue_begin(t->e->children)->next->data;
+            Result * a = evaluate(ec, t->context, in);
+            // perform print:
+            force_result(a, in);
+            print_result(in, a);
+            result_release(a);
+            t->res = new_result(0, NULL, PrimitiveNULL);
+
+        } else if (name == HASH_OF_MATCH) {
+            if (t->e->match == NULL) {
+                // (as with constants, the table outlives the run)
+                Heap * run_heap = active_heap;
+                active_heap = t->e->arena->heap;
+                t->e->match = new_match_table(t->e);
+                active_heap = run_heap;
+            }
+            MatchTable * mt = t->e->match;
+
+            Expression * ec_given = queue_begin(t->e->children)->next->data;
+            Result * res_given = evaluate(ec_given, t->context, in);
+            force_result(res_given, in);
+
+            // The literal arms need no evaluation, so look them up first,
+            // then try the non-literal arms that come before the hit:
+            size_t hit = match_table_find(mt, res_given);
+            for (size_t i = 0; i < mt->ndynamic && mt->dynamic[i] < hit; i++) {
+                MatchArm * arm = &mt->arms[mt->dynamic[i]];
+                Result * res_test = evaluate(arm->test, t->context, in);
+                force_result(res_test, in);
+                bool matched = result_equal(res_given, res_test);
+                result_release(res_test);
+                if (matched) {
+                    hit = mt->dynamic[i];
+                    break;
+                }
+            }
+            result_release(res_given);
+            if (hit < mt->narms) {
+                t->res = evaluate(mt->arms[hit].answer, t->context, in);
+            } else {
+                t->res = new_result(0, NULL, PrimitiveNULL);
+            }
+
+        } else if (name == HASH_OF_QUESTION) {
+            expect(queue_size(t->e->children) == 4,
+                    "Expected 4 arguments for '?' statement.\n");
+            Expression * e_test = queue_begin(t->e->children)->next->data;
+            Result * test = evaluate(e_test, t->context, in);
+            Expression * ec;
+            if (result_is_true(test)) {
+                ec = queue_begin(t->e->children)->next->next->data;
+            } else {
+                ec = queue_begin(t->e->children)->next->next->next->data;
+            }
+            result_release(test);
+            t->res = evaluate(ec, t->context, in);
+
+        } else if (name == HASH_OF_PLUS   ||
+                   name == HASH_OF_MINUS  ||
+                   name == HASH_OF_TIMES  ||
+                   name == HASH_OF_DIVIDE ||
+                   name == HASH_OF_PERCENT) {
+            expect(queue_size(t->e->children) == 3,
+                    "Invalid number of arguments for '%s' function.\n",
+                    (char *)hashtable_find(in->symbols, name)->value);
+            Expression * ea = queue_begin(t->e->children)->next->data;
+            Expression * eb = queue_begin(t->e->children)->next->next->data;
+            Result * a = evaluate(ea, t->context, in);
+            Result * b = evaluate(eb, t->context, in);
+            t->res = number_arith(name, a, b);
+            result_release(a);
+            result_release(b);
+
+        } else if (name == HASH_OF_EQUAL) {
+            expect(queue_size(t->e->children) == 3,
+                    "Invalid number of arguments for '=' function.\n");
+            Expression * ea = queue_begin(t->e->children)->next->data;
+            Expression * eb = queue_begin(t->e->children)->next->next->data;
+            Result * a = evaluate(ea, t->context, in);
+            Result * b = evaluate(eb, t->context, in);
+            force_result(a, in);
+            force_result(b, in);
+            if (result_equal(a, b)) {
+                t->res = new_result(0, NULL, PrimitiveTRUE);
+            } else {
+                t->res = new_result(0, NULL, PrimitiveFALSE);
+            }
+            result_release(a);
+            result_release(b);
+
+        } else {
+            call_function(t, in, name, find_function(in, name, in_prelude(in, t->e)));
+        }
+
+    } else if (t->e->type == List) {
+        Sequence * seq = new_sequence(t->e, t->context);
+        t->res = new_list_result(seq);
+        sequence_release(seq);
+
+    } else if (t->e->type == Id) {
+        HASH_TYPE name = t->e->value;
+        Thunk * tc = find_slot(t->context, t->e);
+        expect(tc != NULL,
+                "Error: Symbol %s not found.\n",
+                (char *)hashtable_find(in->symbols, name)->value);
+        force_binding(tc, in);
+        t->res = result_retain(tc->res);
+
+    } else if (t->e->type == Primitive && t->e->constant != NULL) {
+        t->res = result_retain(t->e->constant);
+
+    } else if (t->e->type == Primitive) {
+        // (the constant outlives the run, so it goes with the expression)
+        Heap * run_heap = active_heap;
+        active_heap = t->e->arena->heap;
+        if (t->e->ptype == PrimitiveNULL) {
+            t->res = new_result(0, NULL, PrimitiveNULL);
+
+        } else if (t->e->ptype == PrimitiveANY) {
+            t->res = new_result(1, NULL, PrimitiveANY);
+
+        } else if (t->e->ptype == PrimitiveTRUE) {
+            t->res = new_result(1, NULL, PrimitiveTRUE);
+
+        } else if (t->e->ptype == PrimitiveFALSE) {
+            t->res = new_result(0, NULL, PrimitiveFALSE);
+
+        } else if (t->e->ptype == PrimitiveString) {
+            t->res = new_result(1, t->e->str, PrimitiveString);
+
+        } else if (t->e->ptype == PrimitiveNumber) {
+            t->res = number_literal(t->e);
+
+        } else if (t->e->ptype == PrimitiveChar) {
+            t->res = new_result(t->e->value, NULL, PrimitiveChar);
+
+        } else {
+            expect(false,
+                    "Error: Couldn't match primitive expression '%s'.\n",
+                    (char *)hashtable_find(in->symbols, t->e->value)->value);
+        }
+        t->e->constant = result_retain(t->res);
+        active_heap = run_heap;
+    }
+}
+
+
+/*******************
+ *     PRELUDE     *
+ *******************/
+
+/*
+ * The prelude (stl.lang) is parsed when the interpreter is built
+ * (`lang --build-prelude`, see compile.sh), and embedded as prelude.h.
+ * At startup its functions are deserialized, without lexing or parsing.
+ */
+#ifdef NO_PRELUDE
+const unsigned char * PRELUDE = NULL;
+const size_t PRELUDE_LEN = 0;
+#else
+#include "prelude.h"
+#endif
+
+bool is_definition(Expression * e)
+{
+    if (e->type != Statement || queue_size(e->children) < 3) return false;
+    Expression * name = queue_begin(e->children)->data;
+    return name->type == Id && name->value == HASH_OF_DEF;
+}
+
+bool is_valid_definition(Expression * def)
+{
+    // (as checked by the interpreter when the 'def' runs)
+    if (queue_size(def->children) < 3) return false;
+    queue_foreach(node, def->children) {
+        if (node->next != queue_end(def->children) && ((Expression *)node->data)->type != Id) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void build_prelude(char * out_fname, int nfiles, char ** fnames)
+{
+    // concatenate the prelude files:
+    Buffer * source = new_buffer();
+    for (int i = 0; i < nfiles; i++) {
+        char * input = read_file(fnames[i]);
+        buffer_write(source, input, strlen(input));
+        buffer_putc(source, '\n');
+        destroy_string(input);
+    }
+    buffer_putc(source, '\0');
+
+    HashTable * symbols = new_symbol_table();
+    Lexer * lex = new_lexer(source->data, symbols);
+    Expression * program = parse_program(lex);
+    expect(lexer_seek(lex) == NULL, "Error: Prelude could not be parsed.\n");
+
+    // the prelude may only define functions (each once):
+    HashTable * names = new_hashtable(DEFAULT_HASHTABLE_SIZE);
+    queue_foreach(node, program->children) {
+        Expression * e = node->data;
+        expect(is_definition(e), "Error: Prelude may only contain function definitions.\n");
+        Expression * fname = queue_begin(e->children)->next->data;
+        expect(fname->type == Id, "Error: Expected function name to be id.\n");
+        char * token = hashtable_find(symbols, fname->value)->value;
+        expect(hashtable_find(names, fname->value) == NULL,
+                "Error: function '%s' redeclaration not allowed!\n", token);
+        hashtable_insert(names, fname->value, token);
+    }
+    destroy_hashtable(names);
+
+    Buffer * buf = serialize_program(program, symbols);
+    FILE * fp = fopen(out_fname, "w");
+    expect(fp != NULL, "Error: Failed to open file %s.\n", out_fname);
+    fprintf(fp, "/* Generated by `lang --build-prelude`. Do not edit. */\n");
+    fprintf(fp, "const unsigned char PRELUDE[] = {");
+    for (size_t i = 0; i < buf->len; i++) {
+        fprintf(fp, "%s0x%02x,", i % 16 == 0 ? "\n    " : " ", (unsigned char)buf->data[i]);
+    }
+    fprintf(fp, "\n};\nconst size_t PRELUDE_LEN = %zu;\n", buf->len);
+    fclose(fp);
+
+    destroy_buffer(buf);
+    destroy_expression(program);
+    destroy_lexer(lex);
+    destroy_symbol_table(symbols);
+    destroy_buffer(source);
+}
+
+Expression * load_prelude(HashTable * symbols)
+{
+    if (PRELUDE_LEN == 0) return NULL;
+    return deserialize_program(PRELUDE, PRELUDE_LEN, symbols);
+}
+
+HASH_TYPE function_key(Interp * in, Expression * e, HASH_TYPE name);
+
+void define_prelude(Interp * in)
+{
+    if (in->prelude == NULL) return;
+    queue_foreach(node, in->prelude->children) {
+        Expression * e = node->data;
+        HASH_TYPE fname = ((Expression *) queue_begin(e->children)->next->data)->value;
+        if (in->live_functions != NULL &&
+                hashtable_find(in->live_functions, function_key(in, e, fname)) == NULL) {
+            continue;  // never called (see eliminate_dead_code())
+        }
+        Function * f = new_function(fname, e);
+        f->prelude = true;
+        queue_push(in->ftable, f);
+    }
+}
+
+
+/*******************
+ *  OPTIMIZATION   *
+ *******************/
+
+/*
+ * Optional passes over a loaded program (see lang_set_optimizations()).
+ * They rewrite the syntax tree in place, allocating new expressions in the
+ * program's arena. Names they introduce start with '#', which the lexer never
+ * produces, so they can't clash with the program's own names.
+ */
+
+HASH_TYPE fresh_symbol(Interp * in, const char * prefix)
+{
+    char token[64];
+    snprintf(token, sizeof(token), "#%s%llu", prefix, ++in->fresh_names);
+    HASH_TYPE key = hash_string(token);
+    if (hashtable_find(in->symbols, key) == NULL) {
+        hashtable_insert(in->symbols, key, clone_string(token));
+    }
+    return key;
+}
+
+HASH_TYPE statement_name(Expression * e)
+{
+    // The name of the function or builtin a statement applies, or 0.
+    if (e->type != Statement || queue_size(e->children) == 0) return 0;
+    Expression * head = queue_begin(e->children)->data;
+    return head->type == Id ? head->value : 0;
+}
+
+Expression * definition_body(Expression * def)
+{
+    return queue_end(def->children)->prev->data;
+}
+
+Queue/*<HASH_TYPE>*/ * definition_params(Expression * def)
+{
+    Queue * params = new_queue(NULL);
+    int i = 0, len = queue_size(def->children);
+    queue_foreach(node, def->children) {
+        Expression * ec = node->data;
+        if (i > 1 && i != len - 1 && ec->type == Id) queue_push(params, (void *)ec->value);
+        i++;
+    }
+    return params;
+}
+
+bool is_builtin(HASH_TYPE name)
+{
+    return name == HASH_OF_DEF      || name == HASH_OF_LET       || name == HASH_OF_DO     ||
+           name == HASH_OF_MATCH    || name == HASH_OF_QUESTION  || name == HASH_OF_PRINT  ||
+           name == HASH_OF_READ_INT || name == HASH_OF_READ_CHAR || name == HASH_OF_GET    ||
+           name == HASH_OF_LEN      || name == HASH_OF_AT        || name == HASH_OF_EQUAL  ||
+           name == HASH_OF_PLUS     || name == HASH_OF_MINUS     || name == HASH_OF_TIMES  ||
+           name == HASH_OF_DIVIDE   || name == HASH_OF_PERCENT;
+}
+
+bool has_side_effects(HASH_TYPE name)
+{
+    return name == HASH_OF_DEF || name == HASH_OF_PRINT ||
+           name == HASH_OF_READ_INT || name == HASH_OF_READ_CHAR;
+}
+
+void collect_nested_definitions(HashTable * names, Expression * e, bool top);
+
+void find_shadowed(Interp * in, Expression * program)
+{
+    /*
+     * The prelude's functions which the program defines again. The prelude
+     * still calls its own, so the optimizations know each of these by a name
+     * of its own, "#<name>", wherever the prelude calls it (see function_key()).
+     */
+    in->shadowed = new_hashtable(DEFAULT_HASHTABLE_SIZE);
+    if (in->prelude == NULL) return;
+    HashTable * names = new_hashtable(DEFAULT_HASHTABLE_SIZE);
+    collect_nested_definitions(names, program, false);
+    queue_foreach(node, in->prelude->children) {
+        HASH_TYPE name = ((Expression *)queue_begin(((Expression *)node->data)->children)->next->data)->value;
+        if (hashtable_find(names, name) == NULL) continue;
+        char * token = hashtable_find(in->symbols, name)->value;
+        char * own = new_string(strlen(token) + 1);
+        sprintf(own, "#%s", token);
+        HASH_TYPE key = hash_string(own);
+        if (hashtable_find(in->symbols, key) == NULL) {
+            hashtable_insert(in->symbols, key, own);
+        } else {
+            destroy_string(own);
+        }
+        hashtable_insert(in->shadowed, name, (void *)key);
+    }
+    destroy_hashtable(names);
+}
+
+HASH_TYPE function_key(Interp * in, Expression * e, HASH_TYPE name)
+{
+    // How the optimizations know the function called name, as called (or defined) by e.
+    if (in->shadowed == NULL || !in_prelude(in, e)) return name;
+    HashTableItem * item = hashtable_find(in->shadowed, name);
+    return item == NULL ? name : (HASH_TYPE)item->value;
+}
+
+HASH_TYPE prelude_key(Interp * in, HASH_TYPE name)
+{
+    // The key of the prelude's function called name, or 0 if the program doesn't shadow it.
+    HashTableItem * item = in->shadowed == NULL ? NULL : hashtable_find(in->shadowed, name);
+    return item == NULL ? 0 : (HASH_TYPE)item->value;
+}
+
+HASH_TYPE definition_key(Interp * in, Expression * def)
+{
+    return function_key(in, def, ((Expression *)queue_begin(def->children)->next->data)->value);
+}
+
+void collect_definitions(Interp * in, HashTable * defs, Expression * program)
+{
+    // Maps the key of each top-level function to its definition.
+    if (program == NULL) return;
+    queue_foreach(node, program->children) {
+        Expression * e = node->data;
+        if (!is_definition(e)) continue;
+        HASH_TYPE key = definition_key(in, e);
+        HashTableItem * item = hashtable_find(defs, key);
+        if (item != NULL) {
+            item->value = e;
+        } else {
+            hashtable_insert(defs, key, e);
+        }
+    }
+}
+
+bool is_pure(Interp * in, Expression * e, HashTable * pure)
+{
+    // Whether evaluating e can't print, read input or define functions.
+    if (e->type == Statement) {
+        HASH_TYPE name = statement_name(e);
+        if (has_side_effects(name)) return false;
+        if (!is_builtin(name) && hashtable_find(pure, function_key(in, e, name)) == NULL) return false;
+    }
+    queue_foreach(node, e->children) {
+        if (!is_pure(in, node->data, pure)) return false;
+    }
+    return true;
+}
+
+void remove_impure_functions(Interp * in, HashTable * defs, HashTable * pure)
+{
+    // Removes the functions of defs which call something impure, until nothing changes.
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        hashtable_foreach(item, defs) {
+            if (hashtable_find(pure, item->key) == NULL) continue;
+            if (!is_pure(in, definition_body(item->value), pure)) {
+                hashtable_remove(pure, item->key);
+                changed = true;
+            }
+        }
+    }
+}
+
+HashTable * find_pure_functions(Interp * in, Expression * program)
+{
+    /*
+     * Starts from every function defined at the top level, and removes those
+     * which call something impure, until nothing changes. Functions defined
+     * elsewhere (inside other functions) are never considered pure. The
+     * prelude only calls its own functions, so it goes first; a function the
+     * program shadows may still be called before it is defined again, so it
+     * is only pure if both are.
+     */
+    HashTable * pure = new_hashtable(DEFAULT_HASHTABLE_SIZE);
+    HashTable * defs = new_hashtable(DEFAULT_HASHTABLE_SIZE);
+    collect_definitions(in, defs, in->prelude);
+    hashtable_foreach(item, defs) {
+        hashtable_insert(pure, item->key, item->value);
+    }
+    remove_impure_functions(in, defs, pure);
+    destroy_hashtable(defs);
+
+    defs = new_hashtable(DEFAULT_HASHTABLE_SIZE);
+    collect_definitions(in, defs, program);
+    hashtable_foreach(item, defs) {
+        HASH_TYPE shadowed = prelude_key(in, item->key);
+        if (shadowed != 0 && hashtable_find(pure, shadowed) == NULL) continue;
+        hashtable_insert(pure, item->key, item->value);
+    }
+    remove_impure_functions(in, defs, pure);
+    destroy_hashtable(defs);
+    return pure;
+}
+
+HASH_TYPE hash_expression(Expression * e)
+{
+    HASH_TYPE h = e->type * 8 + e->ptype;
+    h += h * 31 + (e->str != NULL ? (HASH_TYPE)string_hash(e->str) : e->value);
+    queue_foreach(node, e->children) {
+        h += h * 31 + hash_expression(node->data);
+    }
+    return h;
+}
+
+bool expression_equal(Expression * a, Expression * b)
+{
+    if (a->type != b->type || a->ptype != b->ptype || a->value != b->value) return false;
+    if ((a->str == NULL) != (b->str == NULL)) return false;
+    if (a->str != NULL && !string_equal(a->str, b->str)) return false;
+    if (queue_size(a->children) != queue_size(b->children)) return false;
+    for (Node * x = queue_begin(a->children), * y = queue_begin(b->children);
+            x != queue_end(a->children); x = x->next, y = y->next) {
+        if (!expression_equal(x->data, y->data)) return false;
+    }
+    return true;
+}
+
+size_t expression_size(Expression * e)
+{
+    size_t size = 1;
+    queue_foreach(node, e->children) {
+        size += expression_size(node->data);
+    }
+    return size;
+}
+
+/*
+ * Common subexpression elimination: in each function body, a pure
+ * expression which occurs more than once is bound once, by a 'let' at the
+ * start of the body, and each occurrence becomes a reference to it:
+ *
+ *   (def f n (+ (g (- n 1)) (h (- n 1))))
+ *   =>
+ *   (def f n (do (let #cse1 (- n 1)) (+ (g #cse1) (h #cse1))))
+ *
+ * Since 'let' is lazy, the expression is evaluated at most once per call,
+ * and only if it is used. Only expressions over the function's parameters
+ * are shared: those mean the same thing anywhere in the body, because a
+ * parameter is found before any 'let' of the same name.
+ *
+ * The 'do' and 'let' cost about as much as a few builtins, so only
+ * expressions which call a user function are worth sharing.
+ */
+
+struct Occurrence {
+    Node * node;  // in the parent's children
+    HASH_TYPE hash;
+    size_t size;
+    size_t index; // in program order
+} typedef Occurrence;
+
+struct Occurrences {
+    Occurrence * items;
+    size_t len, cap;
+} typedef Occurrences;
+
+bool calls_function(Expression * e)
+{
+    if (e->type == Statement && !is_builtin(statement_name(e))) return true;
+    queue_foreach(node, e->children) {
+        if (calls_function(node->data)) return true;
+    }
+    return false;
+}
+
+bool is_shareable(Expression * e, Queue/*<HASH_TYPE>*/ * params, HashTable * pure)
+{
+    if (e->type == Id) {
+        if (e->value == HASH_OF_COLON) return true;  // (in 'match')
+        queue_foreach(node, params) {
+            if ((HASH_TYPE)node->data == e->value) return true;
+        }
+        return false;
+    }
+    if (e->type == Statement) {
+        HASH_TYPE name = statement_name(e);
+        if (name == 0 || name == HASH_OF_DO || name == HASH_OF_LET || has_side_effects(name)) {
+            return false;
+        }
+        if (!is_builtin(name) && hashtable_find(pure, name) == NULL) return false;
+        Node * args = queue_begin(e->children)->next;
+        for (Node * cur = args; cur != queue_end(e->children); cur = cur->next) {
+            if (!is_shareable(cur->data, params, pure)) return false;
+        }
+        return true;
+    }
+    queue_foreach(node, e->children) {
+        if (!is_shareable(node->data, params, pure)) return false;
+    }
+    return true;
+}
+
+void collect_occurrences(Occurrences * occs, Node * node, Queue * params, HashTable * pure)
+{
+    Expression * e = node->data;
+    if (statement_name(e) == HASH_OF_DEF) return;  // (a different scope)
+    if (e->type == Statement && calls_function(e) && is_shareable(e, params, pure)) {
+        if (occs->len == occs->cap) {
+            occs->cap = occs->cap == 0 ? 16 : 2 * occs->cap;
+            occs->items = realloc(occs->items, occs->cap * sizeof(Occurrence));
+        }
+        Occurrence occ = { node, hash_expression(e), expression_size(e), occs->len };
+        occs->items[occs->len++] = occ;
+    }
+    for (Node * cur = queue_begin(e->children); cur != queue_end(e->children); cur = cur->next) {
+        collect_occurrences(occs, cur, params, pure);
+    }
+}
+
+int compare_occurrences(const void * pa, const void * pb)
+{
+    // by hash, then largest first, then in program order
+    const Occurrence * a = pa, * b = pb;
+    if (a->hash != b->hash) return a->hash < b->hash ? -1 : 1;
+    if (a->size != b->size) return a->size > b->size ? -1 : 1;
+    return a->index < b->index ? -1 : a->index > b->index;
+}
+
+bool share_largest_repeat(Interp * in, Expression * def, Queue * params, HashTable * pure)
+{
+    // Shares the largest expression which occurs more than once, if any.
+    Occurrences occs = { NULL, 0, 0 };
+    collect_occurrences(&occs, queue_end(def->children)->prev, params, pure);
+    qsort(occs.items, occs.len, sizeof(Occurrence), compare_occurrences);
+    size_t best = 0, best_count = 0, best_size = 0;
+    for (size_t i = 0, j; i < occs.len; i = j) {
+        // (with a hash collision, only the first of the colliding expressions is counted)
+        size_t count = 1;
+        for (j = i + 1; j < occs.len && occs.items[j].hash == occs.items[i].hash; j++) {
+            if (expression_equal(occs.items[i].node->data, occs.items[j].node->data)) count++;
+        }
+        if (count > 1 && occs.items[i].size > best_size) {
+            best = i;
+            best_count = count;
+            best_size = occs.items[i].size;
+        }
+    }
+    if (best_count == 0) {
+        free(occs.items);
+        return false;
+    }
+
+    Arena * arena = def->arena;
+    Expression * shared = occs.items[best].node->data;
+    HASH_TYPE name = fresh_symbol(in, "cse");
+    for (size_t i = best; i < occs.len && occs.items[i].hash == occs.items[best].hash; i++) {
+        Node * node = occs.items[i].node;
+        Expression * e = node->data;
+        if (e != shared && !expression_equal(e, shared)) continue;
+        node->data = new_expression_in(arena, name, Id, PrimitiveANY, NULL);
+        if (e != shared) destroy_expression(e);
+    }
+    free(occs.items);
+
+    // bind it at the start of the body:
+    Node * body_node = queue_end(def->children)->prev;
+    Expression * body = body_node->data;
+    if (statement_name(body) != HASH_OF_DO) {
+        Expression * block = new_expression_in(arena, HASH_OF_TIMES, Statement, PrimitiveANY, NULL);
+        queue_push(block->children, new_expression_in(arena, HASH_OF_DO, Id, PrimitiveANY, NULL));
+        queue_push(block->children, body);
+        body_node->data = body = block;
+    }
+    Expression * let = new_expression_in(arena, HASH_OF_TIMES, Statement, PrimitiveANY, NULL);
+    queue_push(let->children, new_expression_in(arena, HASH_OF_LET, Id, PrimitiveANY, NULL));
+    queue_push(let->children, new_expression_in(arena, name, Id, PrimitiveANY, NULL));
+    queue_push(let->children, shared);
+    queue_insert_after(body->children, queue_begin(body->children), let);
+    return true;
+}
+
+void eliminate_common_subexpressions(Interp * in, Expression * program)
+{
+    HashTable * pure = find_pure_functions(in, program);
+    queue_foreach(node, program->children) {
+        Expression * def = node->data;
+        if (!is_definition(def)) continue;
+        Queue * params = definition_params(def);
+        while (share_largest_repeat(in, def, params, pure));
+        destroy_queue(params);
+    }
+    destroy_hashtable(pure);
+}
+
+/*
+ * Inlining: a call to a small function is replaced by the function's body,
+ * with each parameter bound to its argument by a 'let':
+ *
+ *   (def square x (* x x))
+ *   (square (+ a 1))  =>  (do (let #inl1 (+ a 1)) (* #inl1 #inl1))
+ *
+ * Since 'let' is lazy, each argument is still evaluated at most once, and only
+ * if it is used. An argument which is used at most once, or is a name or a
+ * literal, is substituted directly instead. A function is only inlined if
+ *   - its body has at most in->inline_size expressions, and it is not recursive,
+ *   - its body refers to nothing but its parameters (it has no 'let' or 'def'),
+ *     so it means the same thing at the call site,
+ * and only where the function is known to be defined: after its (only)
+ * top-level definition, or anywhere for the prelude.
+ */
+
+struct Inliner {
+    Interp * in;
+    Arena * arena;
+    HashTable * defs;       // name -> definition, of the functions which may be inlined
+    HashTable * bodies;     // name -> a copy of the body, from before any inlining
+    HashTable * positions;  // name -> 1 + index of its top-level definition (if in the program)
+} typedef Inliner;
+
+bool refers_only_to(Expression * e, Queue/*<HASH_TYPE>*/ * params)
+{
+    // Whether e uses no names but params (and has no 'let' or 'def').
+    HASH_TYPE name = statement_name(e);
+    if (name == HASH_OF_LET || name == HASH_OF_DEF) return false;
+    if (e->type == Id && e->value != HASH_OF_COLON) {
+        queue_foreach(node, params) {
+            if ((HASH_TYPE)node->data == e->value) return true;
+        }
+        return false;
+    }
+    Node * cur = queue_begin(e->children);
+    if (e->type == Statement && name != 0) cur = cur->next;  // (the function's name)
+    for (; cur != queue_end(e->children); cur = cur->next) {
+        if (!refers_only_to(cur->data, params)) return false;
+    }
+    return true;
+}
+
+bool reaches(Interp * in, HashTable * defs, Expression * e, HASH_TYPE target, HashTable * seen)
+{
+    // Whether evaluating e may call the function target (through the functions in defs).
+    HASH_TYPE name = statement_name(e);
+    if (name != 0 && !is_builtin(name)) {
+        HASH_TYPE key = function_key(in, e, name);
+        if (key == target) return true;
+        HashTableItem * def = hashtable_find(defs, key);
+        if (def != NULL && hashtable_find(seen, key) == NULL) {
+            hashtable_insert(seen, key, NULL);
+            if (reaches(in, defs, definition_body(def->value), target, seen)) return true;
+        }
+    }
+    queue_foreach(node, e->children) {
+        if (reaches(in, defs, node->data, target, seen)) return true;
+    }
+    return false;
+}
+
+bool calls_shadowed(Interp * in, Expression * e)
+{
+    // Whether e calls a function of the prelude which the program defines again.
+    if (prelude_key(in, statement_name(e)) != 0) return true;
+    queue_foreach(node, e->children) {
+        if (calls_shadowed(in, node->data)) return true;
+    }
+    return false;
+}
+
+void collect_nested_definitions(HashTable * names, Expression * e, bool top)
+{
+    if (!top && statement_name(e) == HASH_OF_DEF && queue_size(e->children) >= 3) {
+        Expression * fname = queue_begin(e->children)->next->data;
+        hashtable_insert(names, fname->value, NULL);
+    }
+    queue_foreach(node, e->children) {
+        collect_nested_definitions(names, node->data, top && e->type == Program);
+    }
+}
+
+Expression * argument_of(Queue/*<HASH_TYPE>*/ * params, Expression ** args, HASH_TYPE name)
+{
+    // The argument for the parameter called name, or NULL if it isn't one.
+    if (params == NULL) return NULL;
+    size_t i = 0;
+    queue_foreach(node, params) {
+        if ((HASH_TYPE)node->data == name) return args[i];
+        i++;
+    }
+    return NULL;
+}
+
+size_t count_uses(Expression * e, HASH_TYPE name)
+{
+    if (e->type == Id) return e->value == name;
+    size_t count = 0;
+    Node * cur = queue_begin(e->children);
+    if (statement_name(e) != 0) cur = cur->next;
+    for (; cur != queue_end(e->children); cur = cur->next) {
+        count += count_uses(cur->data, name);
+    }
+    return count;
+}
+
+Expression * copy_expression(Arena * arena, Expression * e,
+        Queue/*<HASH_TYPE>*/ * params, Expression ** args)
+{
+    // Copies e, replacing the parameters with (copies of) their arguments.
+    if (e->type == Id && params != NULL) {
+        Expression * arg = argument_of(params, args, e->value);
+        if (arg != NULL) return copy_expression(arena, arg, NULL, NULL);
+    }
+    String * str = e->str;
+    if (str != NULL && e->arena != arena) {
+        // (a literal lives in the arena of its program)
+        str = new_literal_string(arena, str->data, str->len);
+    }
+    Expression * copy = new_expression_in(arena, e->value, e->type, e->ptype, str);
+    bool head = statement_name(e) != 0;
+    queue_foreach(node, e->children) {
+        queue_push(copy->children,
+                copy_expression(arena, node->data, head ? NULL : params, args));
+        head = false;
+    }
+    return copy;
+}
+
+Expression * new_let(Arena * arena, HASH_TYPE name, Expression * value)
+{
+    Expression * let = new_expression_in(arena, HASH_OF_TIMES, Statement, PrimitiveANY, NULL);
+    queue_push(let->children, new_expression_in(arena, HASH_OF_LET, Id, PrimitiveANY, NULL));
+    queue_push(let->children, new_expression_in(arena, name, Id, PrimitiveANY, NULL));
+    queue_push(let->children, value);
+    return let;
+}
+
+bool inline_call(Inliner * inl, Node * node, size_t position)
+{
+    // Replaces the call in node by the body of the function, if it may be inlined there.
+    Expression * call = node->data;
+    HASH_TYPE name = statement_name(call);
+    HashTableItem * def = name == 0 ? NULL : hashtable_find(inl->defs, name);
+    if (def == NULL) return false;
+    HashTableItem * defined_at = hashtable_find(inl->positions, name);
+    if (defined_at != NULL && (size_t)defined_at->value >= position) return false;
+    Queue/*<HASH_TYPE>*/ * params = definition_params(def->value);
+    size_t nparams = queue_size(params);
+    Expression * body = hashtable_find(inl->bodies, name)->value;
+    Expression ** args = malloc((nparams + 1) * sizeof(Expression *));
+    size_t i = 0;
+    for (Node * cur = queue_begin(call->children)->next; cur != queue_end(call->children);
+            cur = cur->next) {
+        if (i < nparams) args[i] = cur->data;
+        i++;
+    }
+    // (with the wrong number of arguments, the call reports the error)
+    if (i != nparams) {
+        free(args);
+        destroy_queue(params);
+        return false;
+    }
+
+    // Bind the arguments which are used more than once, and are worth sharing:
+    Arena * arena = inl->arena;
+    Expression * block = NULL;
+    i = 0;
+    queue_foreach(param, params) {
+        Expression * arg = args[i];
+        if (arg->type != Id && arg->type != Primitive &&
+                count_uses(body, (HASH_TYPE)param->data) > 1) {
+            HASH_TYPE fresh = fresh_symbol(inl->in, "inl");
+            if (block == NULL) {
+                block = new_expression_in(arena, HASH_OF_TIMES, Statement, PrimitiveANY, NULL);
+                queue_push(block->children, new_expression_in(arena, HASH_OF_DO, Id, PrimitiveANY, NULL));
+            }
+            queue_push(block->children, new_let(arena, fresh, copy_expression(arena, arg, NULL, NULL)));
+            args[i] = new_expression_in(arena, fresh, Id, PrimitiveANY, NULL);
+        }
+        i++;
+    }
+    Expression * result = copy_expression(arena, body, params, args);
+    if (block != NULL) {
+        queue_push(block->children, result);
+        result = block;
+    }
+    node->data = result;
+    destroy_expression(call);
+    destroy_queue(params);
+    free(args);
+    return true;
+}
+
+void inline_calls(Inliner * inl, Node * node, size_t position)
+{
+    // Inlines the calls in the expression in node, which is part of the
+    // top-level statement at the given position (from 1).
+    Expression * e = node->data;
+    for (Node * cur = queue_begin(e->children); cur != queue_end(e->children); cur = cur->next) {
+        inline_calls(inl, cur, position);
+    }
+    // (the copied body may call functions which can be inlined too)
+    if (inline_call(inl, node, position)) inline_calls(inl, node, position);
+}
+
+bool may_inline(Interp * in, Expression * def, HashTable * defs)
+{
+    Queue/*<HASH_TYPE>*/ * params = definition_params(def);
+    Expression * body = definition_body(def);
+    HashTable * seen = new_hashtable(DEFAULT_HASHTABLE_SIZE);
+    // (in the program, a body of the prelude would call the program's functions)
+    bool ok = queue_size(params) == queue_size(def->children) - 3 &&
+              expression_size(body) <= in->inline_size &&
+              refers_only_to(body, params) &&
+              !reaches(in, defs, body, definition_key(in, def), seen) &&
+              !(in_prelude(in, def) && calls_shadowed(in, body));
+    destroy_hashtable(seen);
+    destroy_queue(params);
+    return ok;
+}
+
+void inline_functions(Interp * in, Expression * program)
+{
+    Inliner inl;
+    inl.in = in;
+    inl.arena = program->arena;
+    inl.defs = new_hashtable(DEFAULT_HASHTABLE_SIZE);
+    inl.bodies = new_hashtable(DEFAULT_HASHTABLE_SIZE);
+    inl.positions = new_hashtable(DEFAULT_HASHTABLE_SIZE);
+
+    HashTable * defs = new_hashtable(DEFAULT_HASHTABLE_SIZE);
+    collect_definitions(in, defs, in->prelude);
+    collect_definitions(in, defs, program);
+    // Functions defined more than once, or inside other functions, are left alone:
+    HashTable * excluded = new_hashtable(DEFAULT_HASHTABLE_SIZE);
+    collect_nested_definitions(excluded, program, true);
+    size_t position = 0;
+    queue_foreach(node, program->children) {
+        position++;
+        Expression * def = node->data;
+        if (!is_definition(def)) continue;
+        HASH_TYPE name = ((Expression *)queue_begin(def->children)->next->data)->value;
+        if (hashtable_find(inl.positions, name) != NULL) {
+            hashtable_insert(excluded, name, NULL);
+        } else {
+            hashtable_insert(inl.positions, name, (void *)position);
+        }
+    }
+    hashtable_foreach(item, defs) {
+        if (hashtable_find(excluded, item->key) != NULL) continue;
+        if (!may_inline(in, item->value, defs)) continue;
+        hashtable_insert(inl.defs, item->key, item->value);
+        Expression * body = definition_body(item->value);
+        hashtable_insert(inl.bodies, item->key, copy_expression(inl.arena, body, NULL, NULL));
+    }
+
+    position = 0;
+    queue_foreach(node, program->children) {
+        inline_calls(&inl, node, ++position);
+    }
+
+    destroy_hashtable(excluded);
+    destroy_hashtable(defs);
+    destroy_hashtable(inl.defs);
+    destroy_hashtable(inl.bodies);
+    destroy_hashtable(inl.positions);
+}
+
+/*
+ * Dead code elimination: a 'let' whose name nothing after it uses, and a
+ * top-level function which no statement can call, are removed:
+ *
+ *   (def unused x (* x x))
+ *   (print (do (let a (f 1)) (let b 2) b))  =>  (print (do (let b 2) b))
+ *
+ * Since 'let' is lazy, the value of a removed 'let' would never have been
+ * evaluated, so no 'print' or 'read_int' is lost. A 'let' which ends a 'do'
+ * is its value, so it stays. Functions of the prelude which can't be called
+ * are not defined at all (see define_prelude()).
+ */
+
+bool is_valid_let(Expression * e)
+{
+    return statement_name(e) == HASH_OF_LET && queue_size(e->children) == 3 &&
+           ((Expression *)queue_begin(e->children)->next->data)->type == Id;
+}
+
+void collect_uses(HashTable * used, Expression * e)
+{
+    // Adds the names e refers to (not the functions it calls) to used.
+    if (e->type == Id) {
+        if (hashtable_find(used, e->value) == NULL) hashtable_insert(used, e->value, NULL);
+        return;
+    }
+    Node * cur = queue_begin(e->children);
+    if (statement_name(e) != 0) cur = cur->next;
+    for (; cur != queue_end(e->children); cur = cur->next) {
+        collect_uses(used, cur->data);
+    }
+}
+
+void remove_dead_lets(Expression * e)
+{
+    queue_foreach(node, e->children) {
+        remove_dead_lets(node->data);
+    }
+    if (e->type != Program && statement_name(e) != HASH_OF_DO) return;
+    // (a binding is seen by the statements after it in the block, so go backwards)
+    Node * stop = queue_begin(e->children);  // (the 'do')
+    if (e->type == Program) stop = stop->prev;
+    Node * last = queue_end(e->children)->prev;
+    HashTable * used = new_hashtable(DEFAULT_HASHTABLE_SIZE);
+    for (Node * cur = last, * prev; cur != stop; cur = prev) {
+        prev = cur->prev;
+        Expression * ec = cur->data;
+        Expression * name = is_valid_let(ec) ? queue_begin(ec->children)->next->data : NULL;
+        if (cur != last && name != NULL && hashtable_find(used, name->value) == NULL) {
+            queue_remove(e->children, cur);
+            destroy_expression(ec);
+        } else {
+            collect_uses(used, ec);
+        }
+    }
+    destroy_hashtable(used);
+}
+
+void mark_live_calls(Interp * in, HashTable * live, Expression * e, HashTable * defs, HashTable * prelude_defs);
+
+void mark_live(Interp * in, HashTable * live, HASH_TYPE key, HashTable * defs, HashTable * prelude_defs)
+{
+    if (hashtable_find(live, key) != NULL) return;
+    hashtable_insert(live, key, NULL);
+    HashTableItem * def = hashtable_find(defs, key);
+    if (def != NULL) mark_live_calls(in, live, definition_body(def->value), defs, prelude_defs);
+    def = hashtable_find(prelude_defs, key);
+    if (def != NULL) mark_live_calls(in, live, definition_body(def->value), defs, prelude_defs);
+}
+
+void mark_live_calls(Interp * in, HashTable * live, Expression * e, HashTable * defs, HashTable * prelude_defs)
+{
+    // Adds the functions which evaluating e may call to live (by their keys, see
+    // function_key(); before the program defines a function of the prelude
+    // again, its calls still find the prelude's).
+    HASH_TYPE name = statement_name(e);
+    if (name != 0 && !is_builtin(name)) {
+        mark_live(in, live, function_key(in, e, name), defs, prelude_defs);
+        if (prelude_key(in, name) != 0) mark_live(in, live, prelude_key(in, name), defs, prelude_defs);
+    }
+    queue_foreach(node, e->children) {
+        mark_live_calls(in, live, node->data, defs, prelude_defs);
+    }
+}
+
+void eliminate_dead_code(Interp * in, Expression * program)
+{
+    remove_dead_lets(program);
+
+    // Only functions defined once, at the top level, and correctly may be removed
+    // (the others run into errors, which must still happen):
+    HashTable * defs = new_hashtable(DEFAULT_HASHTABLE_SIZE);
+    HashTable * kept = new_hashtable(DEFAULT_HASHTABLE_SIZE);
+    collect_nested_definitions(kept, program, true);
+    queue_foreach(node, program->children) {
+        Expression * e = node->data;
+        if (!is_definition(e)) continue;
+        HASH_TYPE name = ((Expression *)queue_begin(e->children)->next->data)->value;
+        if (!is_valid_definition(e) || hashtable_find(defs, name) != NULL) {
+            if (hashtable_find(kept, name) == NULL) hashtable_insert(kept, name, NULL);
+        } else {
+            hashtable_insert(defs, name, e);
+        }
+    }
+    HashTable * prelude_defs = new_hashtable(DEFAULT_HASHTABLE_SIZE);
+    collect_definitions(in, prelude_defs, in->prelude);
+
+    // Every other statement may run, and so may the functions it calls:
+    HashTable * live = new_hashtable(DEFAULT_HASHTABLE_SIZE);
+    queue_foreach(node, program->children) {
+        Expression * e = node->data;
+        if (!is_definition(e)) {
+            mark_live_calls(in, live, e, defs, prelude_defs);
+        } else {
+            HASH_TYPE name = ((Expression *)queue_begin(e->children)->next->data)->value;
+            if (hashtable_find(kept, name) != NULL) mark_live_calls(in, live, e, defs, prelude_defs);
+        }
+    }
+    Node * cur = queue_begin(program->children);
+    while (cur != queue_end(program->children)) {
+        Node * next = cur->next;
+        Expression * e = cur->data;
+        if (is_definition(e)) {
+            HASH_TYPE name = ((Expression *)queue_begin(e->children)->next->data)->value;
+            if (hashtable_find(kept, name) == NULL && hashtable_find(live, name) == NULL) {
+                queue_remove(program->children, cur);
+                destroy_expression(e);
+            }
+        }
+        cur = next;
+    }
+    in->live_functions = live;
+
+    destroy_hashtable(prelude_defs);
+    destroy_hashtable(kept);
+    destroy_hashtable(defs);
+}
+
+void optimize_program(Interp * in, Expression * program)
+{
+    if (in->optimizations & LANG_OPT_CSE) eliminate_common_subexpressions(in, program);
+    // (after CSE, which only shares calls of functions)
+    if (in->optimizations & LANG_OPT_INLINE) inline_functions(in, program);
+    // (last, since inlining may leave functions which are no longer called)
+    if (in->optimizations & LANG_OPT_DCE) eliminate_dead_code(in, program);
+}
+
+
+/*******************
+ *      CACHE      *
+ *******************/
+
+/*
+ * Parsed programs can be cached on disk (--cache-dir, or $LANG_CACHE_DIR)
+ * in their serialized form, so a later run of the same source skips the
+ * lexer and parser. The file name is a hash of the source and the
+ * interpreter version, so stale entries are simply never looked up again.
+ */
+
+void cache_path(char * dst, size_t size, char * dir, char * source)
+{
+    char version[32];
+    snprintf(version, sizeof(version), "%s/%d", LANG_VERSION, SERIAL_VERSION);
+    unsigned long long h = fnv1a(FNV_OFFSET_BASIS, version, strlen(version));
+    size_t len = strlen(source);
+    h = fnv1a(h, source, len);
+    snprintf(dst, size, "%s/%016llx-%zu.langc", dir, h, len);
+}
+
+Expression * cache_load(Interp * in, char * path)
+{
+    // Returns NULL if there is no entry, or it can't be read (e.g. it is corrupt):
+    // the source is then parsed again, and the entry replaced.
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return NULL;
+    struct stat st;
+    Expression * program = NULL;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void * data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            jmp_buf handler;
+            jmp_buf * outer = in->error_handler;
+            in->error_handler = &handler;
+            if (setjmp(handler) == 0) {
+                program = deserialize_program(data, st.st_size, in->symbols);
+            } else {
+                program = NULL;  // (what was read of it goes with the program's heap)
+                in->error[0] = '\0';
+            }
+            in->error_handler = outer;
+            munmap(data, st.st_size);
+        }
+    }
+    close(fd);
+    return program;
+}
+
+bool replace_file(const char * path, Buffer * buf)
+{
+    /*
+     * Writes buf to a temporary file of its own next to path, and renames it
+     * over path, so that readers, and other writers (in this process or
+     * another), never see a partial file. Returns whether it succeeded.
+     */
+    char tmp[PATH_MAX];
+    if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= (int)sizeof(tmp)) return false;
+    int fd = mkstemp(tmp);
+    if (fd == -1) return false;
+    FILE * fp = fdopen(fd, "wb");
+    if (fp == NULL) {
+        close(fd);
+        unlink(tmp);
+        return false;
+    }
+    bool ok = fwrite(buf->data, 1, buf->len, fp) == buf->len;
+    ok = fclose(fp) == 0 && ok;
+    ok = ok && rename(tmp, path) == 0;
+    if (!ok) unlink(tmp);
+    return ok;
+}
+
+void cache_store(char * path, Expression * program, HashTable * symbols)
+{
+    // Failures are ignored: the cache is only an optimization.
+    Buffer * buf = serialize_program(program, symbols);
+    replace_file(path, buf);
+    destroy_buffer(buf);
+}
+
+
+/*******************
+ * PARALLEL PARSING *
+ *******************/
+
+/*
+ * Large sources are parsed on several threads: a quick scan of the tokens
+ * splits the source between top-level statements into chunks, which are
+ * parsed in parallel, each into its own arena and symbol table, and then
+ * joined in order. The program is the same as parse_program() would make,
+ * and so is the error reported, since a chunk is only used if the ones
+ * before it were parsed to the end.
+ */
+#ifndef __EMSCRIPTEN__
+
+#define PARALLEL_PARSE_MIN (1024 * 1024)  // smaller sources are parsed on one thread
+#define PARSE_CHUNK_MIN    (64 * 1024)
+
+void interp_enter(Interp * in, jmp_buf * handler);
+void interp_leave(Interp * in);
+
+struct ParseChunk {
+    char * source;        // (a copy)
+    Expression * program; // NULL after an error
+    Arena * arena;        // where the program is
+    HashTable * symbols;
+    bool complete;        // whether the whole chunk was statements
+    int status;
+    char error[512];
+    Heap heap;            // where the chunk was parsed
+} typedef ParseChunk;
+
+struct ParsePool {
+    ParseChunk * chunks;
+    size_t nchunks;
+    size_t next;  // the next chunk to parse
+    Arena * arena;  // of the whole program
+    pthread_mutex_t lock;
+} typedef ParsePool;
+
+Queue/*<size_t>*/ * split_statements(const char * source, size_t chunk_size)
+{
+    // Returns where to split the source, so each piece is at least chunk_size bytes.
+    Queue * splits = new_queue(NULL);
+    int depth = 0, start = 0, i = 0, last = 0;
+    while ((i = scan_token(source, i, &start)) != -1) {
+        char c = source[start];
+        if (c == '(' || c == '[') {
+            depth++;
+        } else if (c == ')' || c == ']') {
+            // (unbalanced, so parsing stops or fails somewhere here)
+            if (--depth < 0) break;
+            if (depth == 0 && (size_t)(i - last) >= chunk_size) {
+                queue_push(splits, (void *)(size_t)i);
+                last = i;
+            }
+        }
+    }
+    return splits;
+}
+
+void move_to_arena(Expression * e, Arena * arena)
+{
+    // Makes e allocate its new children from arena (its memory stays where it is).
+    e->arena = arena;
+    e->children->arena = arena;
+    queue_foreach(node, e->children) {
+        move_to_arena(node->data, arena);
+    }
+}
+
+void parse_chunk(ParseChunk * chunk, ParsePool * pool)
+{
+    // Like lang_load(), catches errors with an interpreter of its own.
+    Interp local;
+    memset(&local, 0, sizeof(local));
+    init_heap(&local.heap, 0);
+    Lexer * volatile lex = NULL;
+
+    jmp_buf handler;
+    interp_enter(&local, &handler);
+    chunk->status = setjmp(handler);
+    if (chunk->status == 0) {
+        chunk->symbols = new_hashtable(DEFAULT_HASHTABLE_SIZE);
+        lex = new_lexer(chunk->source, chunk->symbols);
+        chunk->program = parse_program(lex);
+        chunk->arena = lex->arena;
+        chunk->complete = lexer_seek(lex) == NULL;
+        move_to_arena(chunk->program, pool->arena);
+    } else {
+        memcpy(chunk->error, local.error, sizeof(chunk->error));
+        chunk->program = NULL;
+        if (lex != NULL && lex->arena != NULL) destroy_arena(lex->arena);
+    }
+    if (lex) destroy_lexer(lex);
+    interp_leave(&local);
+    // (local only lives as long as this function)
+    init_heap(&chunk->heap, 0);
+    heap_adopt(&chunk->heap, &local.heap);
+}
+
+void * parse_worker(void * arg)
+{
+    ParsePool * pool = arg;
+    while (true) {
+        pthread_mutex_lock(&pool->lock);
+        ParseChunk * chunk = pool->next < pool->nchunks ? pool->chunks + pool->next++ : NULL;
+        pthread_mutex_unlock(&pool->lock);
+        if (chunk == NULL) break;
+        parse_chunk(chunk, pool);
+    }
+    return NULL;
+}
+
+void merge_symbols(HashTable * symbols, HashTable * chunk_symbols)
+{
+    hashtable_foreach(item, chunk_symbols) {
+        if (hashtable_find(symbols, item->key) == NULL) {
+            hashtable_insert(symbols, item->key, item->value);
+        } else {
+            free(item->value);
+        }
+    }
+    destroy_hashtable(chunk_symbols);
+}
+
+Expression * parse_program_parallel(Interp * in, const char * source)
+{
+    // Returns NULL if the source is better parsed by parse_program().
+    int nthreads = in->parse_threads != 0 ? in->parse_threads : sysconf(_SC_NPROCESSORS_ONLN);
+    size_t len = strlen(source);
+    if (nthreads < 2 || len < PARALLEL_PARSE_MIN) return NULL;
+    // (a few chunks per thread, so that they finish at about the same time)
+    size_t chunk_size = len / (4 * nthreads);
+    if (chunk_size < PARSE_CHUNK_MIN) chunk_size = PARSE_CHUNK_MIN;
+    Queue * splits = split_statements(source, chunk_size);
+    if (queue_size(splits) == 0) {
+        destroy_queue(splits);
+        return NULL;
+    }
+
+    ParsePool pool;
+    pool.nchunks = queue_size(splits) + 1;
+    pool.chunks = calloc(pool.nchunks, sizeof(ParseChunk));
+    pool.next = 0;
+    pool.arena = new_arena();
+    size_t start = 0, i = 0;
+    queue_push(splits, (void *)len);
+    queue_foreach(node, splits) {
+        size_t stop = (size_t)node->data;
+        pool.chunks[i].source = new_string(stop - start);
+        memcpy(pool.chunks[i].source, source + start, stop - start);
+        pool.chunks[i].source[stop - start] = '\0';
+        start = stop;
+        i++;
+    }
+    destroy_queue(splits);
+
+    pthread_mutex_init(&pool.lock, NULL);
+    if ((size_t)nthreads > pool.nchunks) nthreads = pool.nchunks;
+    pthread_t * threads = malloc(nthreads * sizeof(pthread_t));
+    int started = 0;
+    for (; started < nthreads - 1; started++) {
+        if (pthread_create(threads + started, NULL, parse_worker, &pool) != 0) break;
+    }
+    parse_worker(&pool);  // (this thread helps, and carries on if no thread started)
+    for (int t = 0; t < started; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    free(threads);
+    pthread_mutex_destroy(&pool.lock);
+
+    // Join the chunks in order, up to the first which was not all statements:
+    Expression * program = new_expression_in(pool.arena, HASH_OF_TIMES, Program, PrimitiveANY, NULL);
+    ParseChunk * failed = NULL;
+    bool done = false;
+    for (i = 0; i < pool.nchunks; i++) {
+        ParseChunk * chunk = pool.chunks + i;
+        if (chunk->program != NULL && !done) {
+            queue_foreach(node, chunk->program->children) {
+                queue_push(program->children, node->data);
+            }
+            arena_adopt(pool.arena, chunk->arena);
+            merge_symbols(in->symbols, chunk->symbols);
+            done = !chunk->complete;
+        } else {
+            if (chunk->program == NULL && !done) failed = chunk;
+            done = true;
+            if (chunk->program != NULL) {
+                // (not destroy_expression(chunk->program), which would free pool.arena)
+                queue_foreach(node, chunk->program->children) {
+                    destroy_expression(node->data);
+                }
+                destroy_arena(chunk->arena);
+            }
+            if (chunk->symbols != NULL) destroy_symbol_table(chunk->symbols);
+        }
+        // (the memory of every chunk joins the program's from now on)
+        heap_adopt(active_heap, &chunk->heap);
+        destroy_string(chunk->source);
+    }
+    int status = failed == NULL ? LANG_OK : failed->status;
+    char error[sizeof(failed->error)];
+    if (failed != NULL) memcpy(error, failed->error, sizeof(error));
+    free(pool.chunks);
+    if (status != LANG_OK) {
+        destroy_expression(program);
+        fail_with(status, "%s", error);
+    }
+    return program;
+}
+
+#endif
+
+
+/*******************
+ *   CHECKPOINTS   *
+ *******************/
+
+/*
+ * A long run can be saved to a file (lang_set_checkpoint()), and continued
+ * by another process (lang_resume()), e.g. after it was preempted.
+ * Checkpoints are made between top-level statements, where the state of a run
+ * is the function table, the top-level 'let's, the position in the input, and
+ * everything the thunks of the 'let's can reach: contexts, thunks (with their
+ * results, once evaluated), results and lists.
+ * They are also made at the calls inside a statement, so that one which runs
+ * for long can be saved too. The rest of its state is then on the C stack, so
+ * while checkpoints are enabled each thunk runs in a frame (see
+ * execute_in_frame()), which keeps the results of the thunks it runs itself
+ * and what it makes (the thunk of a call, the context of a 'do'), and those
+ * are saved too. Resuming runs the statement again from its start, but each
+ * frame takes the results it kept instead of running those thunks again, and
+ * what it made instead of making it again, down to the call the checkpoint
+ * was made at. A frame does the same as before, since what it does depends
+ * only on its thunk, the results of the thunks it runs, and the state of the
+ * run, which has since gained only 'let's (and lookups find the first binding
+ * of a name). Nothing is printed twice, since 'print' evaluates its argument
+ * first, nor read twice, since reading runs nothing. A 'def' run by the
+ * statement may change the function a call finds, so then the checkpoint
+ * waits until the statement is done.
+ * The state is a graph, so each kind of object is written as a table, and
+ * objects refer to each other by index (from 1, or 0 for none), which keeps
+ * shared objects shared. Expressions are referred to by their pre-order index
+ * in the program (then the prelude), so a checkpoint can only be resumed with
+ * the same program (which is checked).
+ * Layout (integers are varints, as in SERIALIZATION):
+ *   "LCKP" version program-hash
+ *   next-statement steps input-pos input-hash
+ *   ncontexts nthunks nsequences nresults
+ *   nfunctions { name prelude nparams param* body }*
+ *   contexts:  { nthunks thunk* }*
+ *   thunks:    { name result [alias [expression context]] }*
+ *                          -- alias if result is 0, the rest if alias is 0 too
+ *   sequences: { owner offset len }*                  -- slices (owner != 0)
+ *              { 0 len context { result [expression] }* }*
+ *   results:   { type num [len bytes | sequence] }*   -- strings | lists
+ *              { type num nlimbs [negative limb*] }*  -- numbers (nlimbs 0 if small)
+ *   context                                           -- of the top level
+ *   nframes { expression nresults result* call context }*
+ *                          -- from the innermost, none between statements
+ * A slice always comes after its owner.
+ */
+#define CHECKPOINT_MAGIC   "LCKP"
+#define CHECKPOINT_VERSION 4
+
+// Requests (see lang_request_checkpoint()):
+#define CHECKPOINT_NONE 0
+#define CHECKPOINT_WRITE 1
+#define CHECKPOINT_STOP 2
+
+enum CheckpointKind {
+    CheckpointContext = 0,
+    CheckpointThunk = 1,
+    CheckpointSequence = 2,
+    CheckpointResult = 3,
+} typedef CheckpointKind;
+#define CHECKPOINT_KINDS 4
+
+struct CheckpointWriter {
+    HashTable * expressions;                 // Expression -> index
+    HashTable * ids[CHECKPOINT_KINDS];       // object -> index
+    Queue * objects[CHECKPOINT_KINDS];       // the objects, in order of index
+    bool ok;  // false if something could not be written
+} typedef CheckpointWriter;
+
+HASH_TYPE pointer_key(void * p)
+{
+    // (the low bits of a pointer are always 0, so move them out of the way)
+    unsigned long long k = (unsigned long long)(size_t)p;
+    return (HASH_TYPE)(k >> 4 | k << 60);
+}
+
+void number_expressions(Expression * e, HashTable * indices, Queue * list)
+{
+    // Numbers the expressions in pre-order, from 1, into indices (when writing)
+    // or list (when reading).
+    if (list != NULL) queue_push(list, e);
+    if (indices != NULL) {
+        hashtable_insert(indices, pointer_key(e), (void *)(hashtable_size(indices) + 1));
+    }
+    queue_foreach(node, e->children) {
+        number_expressions(node->data, indices, list);
+    }
+}
+
+unsigned long long program_hash(Interp * in)
+{
+    Buffer * buf = serialize_program(in->program, in->symbols);
+    unsigned long long h = fnv1a(FNV_OFFSET_BASIS, buf->data, buf->len);
+    destroy_buffer(buf);
+    if (in->prelude != NULL) {
+        buf = serialize_program(in->prelude, in->symbols);
+        h = fnv1a(h, buf->data, buf->len);
+        destroy_buffer(buf);
+    }
+    return h;
+}
+
+size_t checkpoint_id(CheckpointWriter * w, CheckpointKind kind, void * p)
+{
+    if (p == NULL) return 0;
+    HashTableItem * item = hashtable_find(w->ids[kind], pointer_key(p));
+    return item == NULL ? 0 : (size_t)item->value;
+}
+
+bool checkpoint_add(CheckpointWriter * w, CheckpointKind kind, void * p)
+{
+    // Gives an object its index, or returns false if it already has one.
+    if (checkpoint_id(w, kind, p) != 0) return false;
+    queue_push(w->objects[kind], p);
+    hashtable_insert(w->ids[kind], pointer_key(p), (void *)queue_size(w->objects[kind]));
+    return true;
+}
+
+void visit_result(CheckpointWriter * w, Result * res);
+
+void visit_context(CheckpointWriter * w, Queue/*<Thunk>*/ * context);
+
+void visit_thunk(CheckpointWriter * w, Thunk * t)
+{
+    if (!checkpoint_add(w, CheckpointThunk, t)) return;
+    // (an evaluated thunk has no context, and an alias needs none)
+    if (t->res != NULL) {
+        visit_result(w, t->res);
+    } else if (t->alias != NULL) {
+        visit_thunk(w, t->alias);
+    } else {
+        visit_context(w, t->context);
+    }
+}
+
+void visit_context(CheckpointWriter * w, Queue/*<Thunk>*/ * context)
+{
+    if (!checkpoint_add(w, CheckpointContext, context)) return;
+    queue_foreach(node, context) {
+        visit_thunk(w, node->data);
+    }
+}
+
+void visit_sequence(CheckpointWriter * w, Sequence * seq)
+{
+    if (checkpoint_id(w, CheckpointSequence, seq) != 0) return;
+    if (seq->owner != NULL) {
+        visit_sequence(w, seq->owner);
+        checkpoint_add(w, CheckpointSequence, seq);
+        return;
+    }
+    checkpoint_add(w, CheckpointSequence, seq);
+    bool forced = true;
+    for (size_t i = 0; i < seq->len; i++) {
+        if (seq->items[i].res != NULL) {
+            visit_result(w, seq->items[i].res);
+        } else {
+            forced = false;
+        }
+    }
+    if (!forced) visit_context(w, seq->context);
+}
+
+void visit_result(CheckpointWriter * w, Result * res)
+{
+    if (!checkpoint_add(w, CheckpointResult, res)) return;
+    if (res->type == PrimitiveList) visit_sequence(w, res->seq);
+}
+
+void write_object_id(CheckpointWriter * w, Buffer * buf, CheckpointKind kind, void * p)
+{
+    write_varint(buf, checkpoint_id(w, kind, p));
+}
+
+void write_expression_id(CheckpointWriter * w, Buffer * buf, Expression * e)
+{
+    HashTableItem * item = hashtable_find(w->expressions, pointer_key(e));
+    if (item == NULL) w->ok = false;  // (not part of the program)
+    write_varint(buf, item == NULL ? 0 : (size_t)item->value);
+}
+
+void write_function(CheckpointWriter * w, Buffer * buf, Function * f)
+{
+    write_number(buf, f->name);
+    write_varint(buf, f->prelude);
+    write_varint(buf, queue_size(f->params));
+    queue_foreach(node, f->params) {
+        write_number(buf, (HASH_TYPE)node->data);
+    }
+    write_expression_id(w, buf, f->def);
+}
+
+void write_context(CheckpointWriter * w, Buffer * buf, Queue/*<Thunk>*/ * context)
+{
+    write_varint(buf, queue_size(context));
+    queue_foreach(node, context) {
+        write_object_id(w, buf, CheckpointThunk, node->data);
+    }
+}
+
+void write_sequence(CheckpointWriter * w, Buffer * buf, Sequence * seq)
+{
+    if (seq->owner != NULL) {
+        write_object_id(w, buf, CheckpointSequence, seq->owner);
+        write_varint(buf, seq->items - seq->owner->items);
+        write_varint(buf, seq->len);
+        return;
+    }
+    write_varint(buf, 0);
+    write_varint(buf, seq->len);
+    // (0 if every item is evaluated, see visit_sequence())
+    write_object_id(w, buf, CheckpointContext, seq->context);
+    for (size_t i = 0; i < seq->len; i++) {
+        Thunk * item = seq->items + i;
+        write_object_id(w, buf, CheckpointResult, item->res);
+        if (item->res == NULL) write_expression_id(w, buf, item->e);
+    }
+}
+
+void write_result(CheckpointWriter * w, Buffer * buf, Result * res)
+{
+    write_varint(buf, res->type);
+    write_number(buf, res->num);
+    if (res->type == PrimitiveString) {
+        write_varint(buf, res->str->len);
+        buffer_write(buf, res->str->data, res->str->len);
+    } else if (res->type == PrimitiveList) {
+        write_object_id(w, buf, CheckpointSequence, res->seq);
+    } else if (res->type == PrimitiveNumber) {
+        write_varint(buf, res->big == NULL ? 0 : res->big->len);
+        if (res->big == NULL) return;
+        write_varint(buf, res->big->negative);
+        for (size_t i = 0; i < res->big->len; i++) write_varint(buf, res->big->limbs[i]);
+    }
+}
+
+Buffer * serialize_checkpoint(Interp * in, size_t next, Queue/*<Thunk>*/ * context)
+{
+    // Returns NULL if the run cannot be saved.
+    CheckpointWriter w;
+    w.expressions = new_hashtable(DEFAULT_HASHTABLE_SIZE);
+    number_expressions(in->program, w.expressions, NULL);
+    if (in->prelude != NULL) number_expressions(in->prelude, w.expressions, NULL);
+    for (int k = 0; k < CHECKPOINT_KINDS; k++) {
+        w.ids[k] = new_hashtable(DEFAULT_HASHTABLE_SIZE);
+        w.objects[k] = new_queue(NULL);
+    }
+    w.ok = true;
+    visit_context(&w, context);
+    // (and what the frames of the statement keep, if it is saved part way through)
+    for (size_t i = 0; i < in->nframe_results; i++) {
+        visit_result(&w, in->frame_results[i]);
+    }
+    size_t nframes = 0;
+    for (Frame * f = in->frame; f != NULL; f = f->parent) {
+        if (f->call != NULL) visit_thunk(&w, f->call);
+        if (f->context != NULL) visit_context(&w, f->context);
+        nframes++;
+    }
+
+    Buffer * buf = new_buffer();
+    buffer_write(buf, CHECKPOINT_MAGIC, strlen(CHECKPOINT_MAGIC));
+    write_varint(buf, CHECKPOINT_VERSION);
+    write_varint(buf, program_hash(in));
+    write_varint(buf, next);
+    write_varint(buf, in->steps);
+    write_varint(buf, in->input_pos);
+    write_varint(buf, fnv1a(FNV_OFFSET_BASIS, in->input, in->input_pos));
+    for (int k = 0; k < CHECKPOINT_KINDS; k++) {
+        write_varint(buf, queue_size(w.objects[k]));
+    }
+
+    write_varint(buf, queue_size(in->ftable));
+    queue_foreach(node, in->ftable) {
+        write_function(&w, buf, node->data);
+    }
+    queue_foreach(node, w.objects[CheckpointContext]) {
+        write_context(&w, buf, node->data);
+    }
+    queue_foreach(node, w.objects[CheckpointThunk]) {
+        Thunk * t = node->data;
+        write_number(buf, t->name);
+        write_object_id(&w, buf, CheckpointResult, t->res);
+        if (t->res == NULL) write_object_id(&w, buf, CheckpointThunk, t->alias);
+        if (t->res == NULL && t->alias == NULL) {
+            write_expression_id(&w, buf, t->e);
+            write_object_id(&w, buf, CheckpointContext, t->context);
+        }
+    }
+    queue_foreach(node, w.objects[CheckpointSequence]) {
+        write_sequence(&w, buf, node->data);
+    }
+    queue_foreach(node, w.objects[CheckpointResult]) {
+        write_result(&w, buf, node->data);
+    }
+    write_object_id(&w, buf, CheckpointContext, context);
+    write_varint(buf, nframes);
+    size_t end = in->nframe_results;
+    for (Frame * f = in->frame; f != NULL; f = f->parent) {
+        if (f->t->e == NULL) write_varint(buf, 0);
+        else write_expression_id(&w, buf, f->t->e);
+        write_varint(buf, end - f->results);
+        for (size_t i = f->results; i < end; i++) {
+            write_object_id(&w, buf, CheckpointResult, in->frame_results[i]);
+        }
+        write_object_id(&w, buf, CheckpointThunk, f->call);
+        write_object_id(&w, buf, CheckpointContext, f->context);
+        end = f->results;
+    }
+
+    destroy_hashtable(w.expressions);
+    for (int k = 0; k < CHECKPOINT_KINDS; k++) {
+        destroy_hashtable(w.ids[k]);
+        destroy_queue(w.objects[k]);
+    }
+    if (!w.ok) {
+        destroy_buffer(buf);
+        return NULL;
+    }
+    return buf;
+}
+
+bool write_checkpoint(Interp * in, size_t next, Queue/*<Thunk>*/ * context)
+{
+    // The output so far must not be lost if the process is killed afterwards:
+    fflush(stdout);
+    Buffer * buf = serialize_checkpoint(in, next, context);
+    if (buf == NULL) return false;
+    // (the last checkpoint stays intact until the new one is complete)
+    bool ok = replace_file(in->checkpoint_fname, buf);
+    destroy_buffer(buf);
+    return ok;
+}
+
+void maybe_checkpoint(Interp * in, size_t next, Queue/*<Thunk>*/ * context)
+{
+    // Called after each top-level statement, and at each call within one.
+    if (in->checkpoint_fname == NULL) return;
+    // (a 'def' may have changed which function a call finds, see CHECKPOINTS)
+    if (in->frame != NULL && in->functions_version != in->statement_functions) return;
+    int request = in->checkpoint_request;
+    bool due = in->checkpoint_every != 0 &&
+               in->steps - in->checkpoint_steps >= in->checkpoint_every;
+    if (request == CHECKPOINT_NONE && !due) return;
+    in->checkpoint_request = CHECKPOINT_NONE;
+    in->checkpoint_steps = in->steps;
+    // (if a checkpoint fails, the last one is kept, and the run goes on)
+    bool ok = write_checkpoint(in, next, context);
+    if (request == CHECKPOINT_STOP) {
+        fail_with(LANG_STOPPED, ok ? "Stopped, after saving the run to %s.\n"
+                                   : "Stopped, but failed to save the run to %s.\n",
+                in->checkpoint_fname);
+    }
+}
+
+struct CheckpointReader {
+    Reader r;
+    Expression ** expressions;  // by index - 1
+    size_t nexpressions;
+    void ** objects[CHECKPOINT_KINDS];
+    size_t n[CHECKPOINT_KINDS];
+} typedef CheckpointReader;
+
+void * read_object(CheckpointReader * cr, CheckpointKind kind, bool required)
+{
+    size_t id = read_varint(&cr->r);
+    expect(id <= cr->n[kind] && (id != 0 || !required), "Error: Corrupt checkpoint.\n");
+    return id == 0 ? NULL : cr->objects[kind][id - 1];
+}
+
+Expression * read_expression_id(CheckpointReader * cr)
+{
+    size_t id = read_varint(&cr->r);
+    expect(id != 0 && id <= cr->nexpressions, "Error: Corrupt checkpoint.\n");
+    return cr->expressions[id - 1];
+}
+
+void read_sequence(CheckpointReader * cr, size_t i)
+{
+    Sequence * seq = cr->objects[CheckpointSequence][i];
+    size_t owner = read_varint(&cr->r);
+    if (owner != 0) {
+        expect(owner <= i, "Error: Corrupt checkpoint.\n");
+        seq->owner = sequence_retain(cr->objects[CheckpointSequence][owner - 1]);
+        size_t offset = read_varint(&cr->r);
+        seq->len = read_varint(&cr->r);
+        expect(offset <= seq->owner->len && seq->len <= seq->owner->len - offset,
+                "Error: Corrupt checkpoint.\n");
+        seq->items = seq->owner->items + offset;
+        return;
+    }
+    seq->len = read_varint(&cr->r);
+    expect(seq->len <= cr->r.len, "Error: Corrupt checkpoint.\n");
+    seq->items = heap_alloc(seq->len * sizeof(Thunk));
+    // (only the sequence uses its context)
+    seq->context = read_object(cr, CheckpointContext, false);
+    if (seq->context == NULL) seq->context = new_context(NULL);
+    else context_retain(seq->context);
+    for (size_t j = 0; j < seq->len; j++) {
+        Thunk * item = seq->items + j;
+        item->name = HASH_OF_TIMES;
+        item->res = read_object(cr, CheckpointResult, false);
+        if (item->res != NULL) result_retain(item->res);
+        item->e = item->res == NULL ? read_expression_id(cr) : NULL;
+        item->context = seq->context;
+        item->alias = NULL;
+        item->refs = 1;
+    }
+}
+
+void read_result(CheckpointReader * cr, Result * res)
+{
+    res->type = read_varint(&cr->r);
+    expect(res->type <= PrimitiveList, "Error: Corrupt checkpoint.\n");
+    res->num = read_number(&cr->r);
+    if (res->type == PrimitiveString) {
+        size_t len = read_varint(&cr->r);
+        res->str = new_string_from((char *)read_bytes(&cr->r, len), len);
+    } else if (res->type == PrimitiveList) {
+        res->seq = sequence_retain(read_object(cr, CheckpointSequence, true));
+    } else if (res->type == PrimitiveNumber) {
+        size_t nlimbs = read_varint(&cr->r);
+        if (nlimbs == 0) return;
+        expect(nlimbs <= cr->r.len - cr->r.pos, "Error: Corrupt checkpoint.\n");
+        res->big = new_bigint(nlimbs);
+        res->big->negative = read_varint(&cr->r);
+        for (size_t i = 0; i < nlimbs; i++) {
+            unsigned long long limb = read_varint(&cr->r);
+            expect(limb < BIGINT_BASE, "Error: Corrupt checkpoint.\n");
+            res->big->limbs[i] = limb;
+        }
+        expect(res->big->limbs[nlimbs - 1] != 0, "Error: Corrupt checkpoint.\n");
+    }
+}
+
+size_t read_checkpoint(Interp * in, const unsigned char * data, size_t len,
+        Queue/*<Thunk>*/ ** context)
+{
+    /*
+     * Restores the function table and the top-level context of a run, and the
+     * steps and input position (in->input must be set), and the frames of the
+     * statement it was in, if any (see execute_in_frame()). Returns the index
+     * of the next statement, or of that one.
+     */
+    CheckpointReader cr;
+    Reader * r = &cr.r;
+    *r = (Reader){ data, len, 0, NULL, "checkpoint" };
+    size_t magic_len = strlen(CHECKPOINT_MAGIC);
+    expect(len >= magic_len && memcmp(data, CHECKPOINT_MAGIC, magic_len) == 0,
+            "Error: Not a checkpoint.\n");
+    r->pos = magic_len;
+    expect(read_varint(r) == CHECKPOINT_VERSION, "Error: Checkpoint has the wrong version.\n");
+    expect(read_varint(r) == program_hash(in),
+            "Error: Checkpoint was made by a different program (or optimizations).\n");
+    size_t next = read_varint(r);
+    unsigned long long steps = read_varint(r);
+    size_t input_pos = read_varint(r);
+    unsigned long long input_hash = read_varint(r);
+    expect(input_pos <= strlen(in->input) &&
+            fnv1a(FNV_OFFSET_BASIS, in->input, input_pos) == input_hash,
+            "Error: Checkpoint was made with different input.\n");
+    in->steps = in->checkpoint_steps = steps;
+    in->input_pos = input_pos;
+
+    Queue/*<Expression>*/ * expressions = new_queue(NULL);
+    number_expressions(in->program, NULL, expressions);
+    if (in->prelude != NULL) number_expressions(in->prelude, NULL, expressions);
+    cr.nexpressions = queue_size(expressions);
+    // (on the run heap, so they are freed even if the checkpoint is corrupt)
+    cr.expressions = heap_alloc(cr.nexpressions * sizeof(Expression *));
+    size_t i = 0;
+    queue_foreach(node, expressions) {
+        cr.expressions[i++] = node->data;
+    }
+    destroy_queue(expressions);
+
+    // Make every object first, since they may refer to later ones
+    // (their references are counted as they are read):
+    for (int k = 0; k < CHECKPOINT_KINDS; k++) {
+        cr.n[k] = read_varint(r);
+        expect(cr.n[k] <= len, "Error: Corrupt checkpoint.\n");  // (each takes a byte)
+        cr.objects[k] = heap_alloc(cr.n[k] * sizeof(void *) + 1);
+    }
+    for (i = 0; i < cr.n[CheckpointContext]; i++) {
+        Queue * restored = new_context(NULL);
+        restored->refs = 0;
+        cr.objects[CheckpointContext][i] = restored;
+    }
+    for (i = 0; i < cr.n[CheckpointThunk]; i++) {
+        Thunk * t = new_thunk(HASH_OF_TIMES, NULL, NULL);
+        t->refs = 0;
+        cr.objects[CheckpointThunk][i] = t;
+    }
+    for (i = 0; i < cr.n[CheckpointSequence]; i++) {
+        Sequence * seq = heap_alloc(sizeof(Sequence));
+        seq->refs = 0;  // (counted as the references are read)
+        seq->len = 0;
+        seq->items = NULL;
+        seq->context = NULL;
+        seq->owner = NULL;
+        cr.objects[CheckpointSequence][i] = seq;
+    }
+    for (i = 0; i < cr.n[CheckpointResult]; i++) {
+        Result * res = new_result(0, NULL, PrimitiveNULL);
+        res->refs = 0;
+        cr.objects[CheckpointResult][i] = res;
+    }
+
+    clear_functions(in);
+    size_t nfunctions = read_varint(r);
+    for (i = 0; i < nfunctions; i++) {
+        Function * f = heap_alloc(sizeof(Function));
+        f->name = read_number(r);
+        f->prelude = read_varint(r) != 0;
+        f->params = new_queue(NULL);
+        size_t nparams = read_varint(r);
+        for (size_t j = 0; j < nparams; j++) {
+            queue_push(f->params, (void *)read_number(r));
+        }
+        f->def = read_expression_id(&cr);
+        find_slots(f->def, f->params);
+        queue_push(in->ftable, f);
+    }
+
+    for (i = 0; i < cr.n[CheckpointContext]; i++) {
+        size_t nthunks = read_varint(r);
+        for (size_t j = 0; j < nthunks; j++) {
+            Thunk * t = read_object(&cr, CheckpointThunk, true);
+            queue_push(cr.objects[CheckpointContext][i], thunk_retain(t));
+        }
+    }
+    for (i = 0; i < cr.n[CheckpointThunk]; i++) {
+        Thunk * t = cr.objects[CheckpointThunk][i];
+        t->name = read_number(r);
+        t->res = read_object(&cr, CheckpointResult, false);
+        if (t->res == NULL) t->alias = read_object(&cr, CheckpointThunk, false);
+        if (t->res != NULL) {
+            result_retain(t->res);
+        } else if (t->alias != NULL) {
+            // (an alias stands for a thunk which is not itself an alias)
+            expect(t->alias->alias == NULL && t->alias != t, "Error: Corrupt checkpoint.\n");
+            thunk_retain(t->alias);
+        } else {
+            t->e = read_expression_id(&cr);
+            t->context = context_retain(read_object(&cr, CheckpointContext, true));
+        }
+    }
+    for (i = 0; i < cr.n[CheckpointSequence]; i++) {
+        read_sequence(&cr, i);
+    }
+    for (i = 0; i < cr.n[CheckpointResult]; i++) {
+        read_result(&cr, cr.objects[CheckpointResult][i]);
+    }
+    *context = context_retain(read_object(&cr, CheckpointContext, true));
+    size_t nframes = read_varint(r);
+    expect(nframes <= len, "Error: Corrupt checkpoint.\n");
+    Replay * replay = NULL;
+    for (i = 0; i < nframes; i++) {
+        Replay * outer = heap_alloc(sizeof(Replay));
+        size_t id = read_varint(r);
+        expect(id <= cr.nexpressions, "Error: Corrupt checkpoint.\n");
+        outer->e = id == 0 ? NULL : cr.expressions[id - 1];
+        outer->nresults = read_varint(r);
+        expect(outer->nresults <= len, "Error: Corrupt checkpoint.\n");
+        outer->results = heap_alloc(outer->nresults * sizeof(Result *) + 1);
+        for (size_t j = 0; j < outer->nresults; j++) {
+            outer->results[j] = result_retain(read_object(&cr, CheckpointResult, true));
+        }
+        outer->call = read_object(&cr, CheckpointThunk, false);
+        if (outer->call != NULL) thunk_retain(outer->call);
+        outer->context = read_object(&cr, CheckpointContext, false);
+        if (outer->context != NULL) context_retain(outer->context);
+        outer->next = replay;
+        replay = outer;
+    }
+    expect(r->pos == r->len, "Error: Corrupt checkpoint.\n");
+    in->replay = replay;
+    if (replay != NULL) in->keep_frames = true;
+
+    for (int k = 0; k < CHECKPOINT_KINDS; k++) {
+        heap_free(cr.objects[k], cr.n[k] * sizeof(void *) + 1);
+    }
+    heap_free(cr.expressions, cr.nexpressions * sizeof(Expression *));
+    return next;
+}
+
+
+/*******************
+ *       API       *
+ *******************/
+
+/*
+ * Implements lang.h. Each entry point catches the errors raised by expect()
+ * while it runs (see fail()), and returns them as a non-zero status.
+ */
+
+void interp_enter(Interp * in, jmp_buf * handler)
+{
+    in->error[0] = '\0';
+    in->error_handler = handler;
+    in->prev_active = active_interp;
+    in->prev_heap = active_heap;
+    active_interp = in;
+    active_heap = &in->heap;
+}
+
+void interp_leave(Interp * in)
+{
+    active_interp = in->prev_active;
+    active_heap = in->prev_heap;
+    in->error_handler = NULL;
+}
+
+void unload_program(Interp * in)
+{
+    if (in->program) destroy_expression(in->program);
+    in->program = NULL;
+    if (in->live_functions) destroy_hashtable(in->live_functions);
+    in->live_functions = NULL;
+    if (in->shadowed) destroy_hashtable(in->shadowed);
+    in->shadowed = NULL;
+    // (and whatever else was made for it)
+    release_heap(&in->program_heap);
+}
+
+Interp * lang_create(void)
+{
+    Interp * in = malloc(sizeof(Interp));
+    in->symbols = new_symbol_table();
+    in->ftable = NULL;
+    in->program = NULL;
+    in->prelude = NULL;
+    in->cache_dir = NULL;
+    in->input = NULL;
+    in->input_pos = 0;
+    in->output = new_buffer();
+    in->write = NULL;
+    in->write_data = NULL;
+    in->timeout = 0;
+    in->deadline = 0;
+    in->max_steps = 0;
+    in->optimizations = 0;
+    in->inline_size = DEFAULT_INLINE_SIZE;
+    in->parse_threads = 0;
+    in->functions_version = 1;
+    in->live_functions = NULL;
+    in->shadowed = NULL;
+    in->fresh_names = 0;
+    in->checkpoint_fname = NULL;
+    in->checkpoint_every = 0;
+    in->checkpoint_steps = 0;
+    in->checkpoint_request = CHECKPOINT_NONE;
+    in->keep_frames = false;
+    in->entering = NULL;
+    in->frame = NULL;
+    in->frame_results = NULL;
+    in->nframe_results = in->frame_results_size = 0;
+    in->replay = NULL;
+    in->statement = 0;
+    in->statement_context = NULL;
+    in->statement_functions = 0;
+    init_heap(&in->heap, 0);
+    init_heap(&in->program_heap, 0);
+    init_heap(&in->run_heap, 0);
+    in->steps = 0;
+    in->error[0] = '\0';
+    in->error_handler = NULL;
+
+    jmp_buf handler;
+    interp_enter(in, &handler);
+    int status = setjmp(handler);
+    if (status == 0) {
+        in->prelude = load_prelude(in->symbols);
+    }
+    interp_leave(in);
+    if (status != 0) {
+        lang_destroy(in);
+        return NULL;
+    }
+    return in;
+}
+
+void lang_destroy(Interp * in)
+{
+    // (the run heap is already empty, see end_run())
+    unload_program(in);
+    if (in->prelude) destroy_expression(in->prelude);
+    // (and whatever else is left on the interpreter's heap)
+    release_heap(&in->heap);
+    free(in->cache_dir);
+    free(in->checkpoint_fname);
+    destroy_buffer(in->output);
+    destroy_symbol_table(in->symbols);
+    free(in);
+}
+
+void lang_set_output(Interp * in, lang_write_fn write, void * data)
+{
+    in->write = write;
+    in->write_data = data;
+}
+
+void lang_set_timeout(Interp * in, long long ms)
+{
+    in->timeout = ms;
+}
+
+void lang_set_limits(Interp * in, unsigned long long max_steps, size_t max_heap)
+{
+    in->max_steps = max_steps;
+    in->run_heap.limit = max_heap;
+}
+
+void lang_set_optimizations(Interp * in, unsigned optimizations)
+{
+    in->optimizations = optimizations;
+}
+
+void lang_set_parse_threads(Interp * in, int nthreads)
+{
+    in->parse_threads = nthreads;
+}
+
+void lang_set_inline_size(Interp * in, size_t size)
+{
+    in->inline_size = size;
+}
+
+void lang_get_stats(Interp * in, LangStats * stats)
+{
+    stats->steps = in->steps;
+    stats->heap_bytes = in->run_heap.bytes;
+    stats->peak_heap_bytes = in->run_heap.peak;
+}
+
+void lang_set_checkpoint(Interp * in, const char * fname, unsigned long long every_steps)
+{
+    free(in->checkpoint_fname);
+    in->checkpoint_fname = fname == NULL ? NULL : clone_string((char *)fname);
+    in->checkpoint_every = every_steps;
+}
+
+void lang_request_checkpoint(Interp * in, int stop)
+{
+    // (only sets a flag, so it may be called from a signal handler)
+    in->checkpoint_request = stop ? CHECKPOINT_STOP : CHECKPOINT_WRITE;
+}
+
+void lang_set_cache_dir(Interp * in, const char * dir)
+{
+    free(in->cache_dir);
+    in->cache_dir = (dir == NULL || dir[0] == '\0') ? NULL : clone_string((char *)dir);
+}
+
+int lang_load(Interp * in, const char * source)
+{
+    // These are volatile, since they are read after a longjmp():
+    Lexer * volatile lex = NULL;
+
+    jmp_buf handler;
+    interp_enter(in, &handler);
+    int status = setjmp(handler);
+    if (status == 0) {
+        unload_program(in);
+        active_heap = &in->program_heap;
+
+        // lex/parse program into rooted tree (or load it from the cache):
+        char path[PATH_MAX];
+        if (in->cache_dir != NULL) {
+            cache_path(path, sizeof(path), in->cache_dir, (char *)source);
+            in->program = cache_load(in, path);
+        }
+        if (in->program == NULL) {
+#ifndef __EMSCRIPTEN__
+            in->program = parse_program_parallel(in, source);
+#endif
+            if (in->program == NULL) {
+                lex = new_lexer((char *)source, in->symbols);
+                in->program = parse_program(lex);
+            }
+            if (in->cache_dir != NULL) {
+                cache_store(path, in->program, in->symbols);  // (replacing a corrupt entry)
+            }
+        }
+        // (the cache holds the program as written, whichever optimizations are on)
+        find_shadowed(in, in->program);
+        optimize_program(in, in->program);
+    }
+    if (lex) destroy_lexer(lex);
+    interp_leave(in);
+    if (status != 0) {
+        // (whatever was made of the program goes with its heap)
+        in->program = NULL;
+        unload_program(in);
+    }
+    return status;
+}
+
+void start_run(Interp * in, const char * input)
+{
+    expect(in->program != NULL, "Error: No program loaded.\n");
+    // (the position in the real stdin could not be saved)
+    expect(in->checkpoint_fname == NULL || input != NULL,
+            "Error: Checkpoints need the input as a string.\n");
+    in->input = input;
+    in->input_pos = 0;
+    in->output->len = 0;
+    in->steps = 0;
+    in->checkpoint_steps = 0;
+    in->checkpoint_request = CHECKPOINT_NONE;
+    in->keep_frames = in->checkpoint_fname != NULL;
+    in->run_heap.peak = 0;
+    in->deadline = in->timeout == 0 ? 0 : now_ns() + in->timeout * 1000000LL;
+    active_heap = &in->run_heap;
+
+    // Initialize Function Table:
+    in->ftable = new_queue(NULL);
+    in->functions_version++;
+    define_prelude(in);
+}
+
+void end_run(Interp * in)
+{
+    // Frees everything the run made at once, whether it finished or not.
+    in->ftable = NULL;
+    in->functions_version++;  // (the functions cached by calls are gone)
+    in->input = NULL;
+    // (the frames are gone too, if the run failed)
+    in->frame = NULL;
+    in->frame_results = NULL;
+    in->nframe_results = in->frame_results_size = 0;
+    in->replay = NULL;
+    release_heap(&in->run_heap);
+}
+
+int lang_run(Interp * in, const char * input)
+{
+    jmp_buf handler;
+    interp_enter(in, &handler);
+    int status = setjmp(handler);
+    if (status == 0) {
+        start_run(in, input);
+
+        // Execute program:
+        Queue * context = new_context(NULL);
+        Thunk * thunk = new_thunk(HASH_OF_TIMES, in->program, context);
+        execute(thunk, in);
+    }
+    // clean up (the thunks and results of the execution are all on the run heap)
+    end_run(in);
+    interp_leave(in);
+    return status;
+}
+
+int lang_resume(Interp * in, const char * fname, const char * input)
+{
+    // These are volatile, since they are read after a longjmp():
+    Buffer * volatile buf = NULL;
+
+    jmp_buf handler;
+    interp_enter(in, &handler);
+    int status = setjmp(handler);
+    if (status == 0) {
+        expect(input != NULL, "Error: Checkpoints need the input as a string.\n");
+        start_run(in, input);
+
+        FILE * fp = fopen(fname, "rb");
+        expect(fp != NULL, "Error: Failed to open file %s.\n", fname);
+        buf = new_buffer();
+        char chunk[4096];
+        size_t n;
+        while ((n = fread(chunk, 1, sizeof(chunk), fp)) > 0) {
+            buffer_write(buf, chunk, n);
+        }
+        fclose(fp);
+
+        Queue/*<Thunk>*/ * context = NULL;
+        size_t next = read_checkpoint(in, (unsigned char *)buf->data, buf->len, &context);
+        Thunk * thunk = new_thunk(HASH_OF_TIMES, in->program, NULL);
+        execute_statements(thunk, in, next, context);
+    }
+    // clean up (as in lang_run())
+    if (buf) destroy_buffer(buf);
+    end_run(in);
+    interp_leave(in);
+    return status;
+}
+
+bool binds_names(Expression * e)
+{
+    // Whether running e may keep its expressions in use (by a 'def' or 'let').
+    HASH_TYPE name = statement_name(e);
+    if (name == HASH_OF_DEF || name == HASH_OF_LET) return true;
+    queue_foreach(node, e->children) {
+        if (binds_names(node->data)) return true;
+    }
+    return false;
+}
+
+int lang_run_stream(Interp * in, lang_read_fn read, void * data, const char * input)
+{
+    /*
+     * Reads the program with read(), and runs each top-level form as soon as
+     * it is complete, so only the form being read is kept as text. Forms are
+     * parsed into a scratch arena, and only those which bind names are kept
+     * in the program. (Whole program optimizations, the cache and checkpoints
+     * are not available.)
+     */
+    // These are volatile, since they are read after a longjmp():
+    Buffer * volatile source = NULL;
+    Lexer * volatile lex = NULL;
+    Expression * volatile scratch = NULL;
+
+    jmp_buf handler;
+    interp_enter(in, &handler);
+    int status = setjmp(handler);
+    if (status == 0) {
+        expect(in->checkpoint_fname == NULL,
+                "Error: Checkpoints are not supported for streamed programs.\n");
+        unload_program(in);
+        active_heap = &in->program_heap;
+        Arena * arena = new_arena();
+        in->program = new_expression_in(arena, HASH_OF_TIMES, Program, PrimitiveANY, NULL);
+        start_run(in, input);
+
+        Queue * context = new_context(NULL);
+        source = new_buffer();
+        lex = new_lexer(NULL, in->symbols);
+        char chunk[STREAM_CHUNK_SIZE];
+        int form = 0, pos = 0, depth = 0, found = 0;
+        bool more = true;
+        while (found != -1 && more) {
+            size_t n = read(data, chunk, sizeof(chunk));
+            more = n > 0;
+            buffer_write(source, chunk, n);
+            buffer_putc(source, '\0');
+            source->len--;
+            lex->input = source->data;
+            while ((found = scan_form(source->data, source->len, &pos, &depth, more)) == 1) {
+                scratch = new_expression_in(new_arena(), HASH_OF_TIMES, Program, PrimitiveANY, NULL);
+                lex->arena = scratch->arena;
+                lex->idx = form;
+                lex->prev_idx = -1;
+                if (!parse_statement(scratch, lex)) {
+                    found = -1;
+                    break;
+                }
+                form = pos;
+                Expression * e = queue_begin(scratch->children)->data;
+                if (binds_names(e)) {
+                    // (into the program's arena, which outlives the run)
+                    e = copy_expression(arena, e, NULL, NULL);
+                    queue_push(in->program->children, e);
+                }
+                result_release(execute_statement(in, e, context));
+                destroy_expression(scratch);
+                scratch = NULL;
+            }
+            // Keep only the text of the form which is not complete yet:
+            memmove(source->data, source->data + form, source->len - form);
+            source->len -= form;
+            pos -= form;
+            form = 0;
+        }
+    }
+    // clean up (as in lang_run(), but the scratch form may have constants)
+    if (scratch) destroy_expression(scratch);
+    if (lex) destroy_lexer(lex);
+    if (source) destroy_buffer(source);
+    end_run(in);
+    // (what was kept is not the whole program, so it can't be run again)
+    unload_program(in);
+    interp_leave(in);
+    return status;
+}
+
+const char * lang_output(Interp * in)
+{
+    buffer_putc(in->output, '\0');
+    in->output->len--;
+    return in->output->data;
+}
+
+const char * lang_error(Interp * in)
+{
+    return in->error;
+}
+
+
+/*******************
+ *     RUNNING     *
+ *******************/
+
+void write_stdout(void * data, const char * buf, size_t len)
+{
+    fwrite(buf, 1, len, stdout);
+}
+
+size_t read_fd(void * data, char * buf, size_t len)
+{
+    // Returns whatever has arrived, so that streamed forms run without waiting.
+    fflush(stdout);
+    ssize_t n;
+    do {
+        n = read(*(int *)data, buf, len);
+    } while (n < 0 && errno == EINTR);
+    return n < 0 ? 0 : n;
+}
+
+struct Options {
+    char * cache_dir;
+    long long timeout;
+    unsigned long long max_steps;
+    size_t max_heap;
+    unsigned optimizations;
+    size_t inline_size;  // 0 for the default
+    int parse_threads;   // 0 for the default
+    char * checkpoint;  // (not for batches)
+    unsigned long long checkpoint_every;
+    char * resume;
+} typedef Options;
+
+void apply_options(Interp * in, Options * opts)
+{
+    lang_set_cache_dir(in, opts->cache_dir);
+    lang_set_timeout(in, opts->timeout);
+    lang_set_limits(in, opts->max_steps, opts->max_heap);
+    lang_set_optimizations(in, opts->optimizations);
+    if (opts->inline_size != 0) lang_set_inline_size(in, opts->inline_size);
+    lang_set_parse_threads(in, opts->parse_threads);
+}
+
+// The interpreter whose run is saved on signals (see run_program()):
+Interp * volatile signalled_interp = NULL;
+
+void checkpoint_on_signal(int sig)
+{
+    // SIGUSR1 saves the run, SIGINT and SIGTERM save it and stop.
+    if (signalled_interp != NULL) lang_request_checkpoint(signalled_interp, sig != SIGUSR1);
+}
+
+int run_program(char * source, char * input, Options * opts)
+{
+    // Runs a program, printing its output and errors.
+    Interp * in = lang_create();
+    expect(in != NULL, "Error: Failed to create interpreter.\n");
+    lang_set_output(in, write_stdout, NULL);
+    if (opts != NULL) apply_options(in, opts);
+    bool checkpoints = opts != NULL && opts->checkpoint != NULL;
+    if (checkpoints) {
+        lang_set_checkpoint(in, opts->checkpoint, opts->checkpoint_every);
+        signalled_interp = in;
+        signal(SIGUSR1, checkpoint_on_signal);
+        signal(SIGINT, checkpoint_on_signal);
+        signal(SIGTERM, checkpoint_on_signal);
+    }
+    int status = lang_load(in, source);
+    if (status == 0) {
+        if (opts != NULL && opts->resume != NULL) {
+            status = lang_resume(in, opts->resume, input);
+        } else {
+            status = lang_run(in, input);
+        }
+    }
+    if (checkpoints) {
+        signal(SIGUSR1, SIG_DFL);
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+        signalled_interp = NULL;
+    }
+    fflush(stdout);
+    if (status != 0) fprintf(stderr, "%s", lang_error(in));
+    lang_destroy(in);
+    return status;
+}
+
+int run_stream(char * fname, Options * opts)
+{
+    // Runs a program as it is read from a file or pipe ("-" for stdin).
+    int fd = streq(fname, "-") ? STDIN_FILENO : open(fname, O_RDONLY);
+    expect(fd >= 0, "Error: Failed to open file %s.\n", fname);
+    Interp * in = lang_create();
+    expect(in != NULL, "Error: Failed to create interpreter.\n");
+    lang_set_output(in, write_stdout, NULL);
+    apply_options(in, opts);
+    int status = lang_run_stream(in, read_fd, &fd, NULL);
+    fflush(stdout);
+    if (status != 0) fprintf(stderr, "%s", lang_error(in));
+    lang_destroy(in);
+    if (fd != STDIN_FILENO) close(fd);
+    return status;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int run_code(char * code, char * input)
+{
+    // Entry point for the web page, which keeps one instance of the module.
+    return run_program(code, input, NULL);
+}
+
+
+/*******************
+ *    COMPILER     *
+ *******************/
+
+#ifndef __EMSCRIPTEN__
+
+/*
+ * `lang --emit-c out.c prog.lang` translates a program, and the prelude,
+ * to a standalone C file. The file starts with the runtime in runtime.c,
+ * which is embedded as runtime.h when the interpreter is built.
+ *
+ * An expression whose value is needed right away becomes straight-line C
+ * over Value temporaries. A lazy expression becomes a Thunk. Function
+ * arguments live on the caller's stack, unless the function may return a
+ * list, whose items could still refer to them after the call returns (see
+ * compute_list_results()). 'let' bindings and list items are allocated.
+ * Names are resolved at compile time, because the context a name is
+ * looked up in is known statically.
+ *
+ * An argument is evaluated before the call, with no thunk, when it is pure
+ * and the function always forces that parameter (see compute_strictness()).
+ *
+ * Only top-level 'def's are supported. Limits (--timeout, --max-steps,
+ * --max-heap) don't apply to compiled programs.
+ */
+#ifdef NO_PRELUDE
+const unsigned char RUNTIME[] = { 0 };
+#else
+#include "runtime.h"
+#endif
+
+void build_runtime(char * out_fname, char * fname)
+{
+    // Embeds runtime.c into the interpreter, as a string.
+    char * source = read_file(fname);
+    FILE * fp = fopen(out_fname, "w");
+    expect(fp != NULL, "Error: Failed to open file %s.\n", out_fname);
+    fprintf(fp, "/* Generated by `lang --build-runtime`. Do not edit. */\n");
+    fprintf(fp, "const unsigned char RUNTIME[] = {");
+    size_t len = strlen(source);
+    for (size_t i = 0; i <= len; i++) {
+        fprintf(fp, "%s0x%02x,", i % 16 == 0 ? "\n    " : " ", (unsigned char)source[i]);
+    }
+    fprintf(fp, "\n};\n");
+    fclose(fp);
+    destroy_string(source);
+}
+
+struct ScopeEntry {
+    HASH_TYPE name;
+    char ref[32];  // a C expression for its Thunk *
+} typedef ScopeEntry;
+
+struct Scope {
+    ScopeEntry * items;
+    size_t len;
+    size_t cap;
+} typedef Scope;
+
+// Which parameters a function always forces (for arguments to be evaluated early):
+struct Strictness {
+    unsigned long long mask;  // bit i for parameter i
+    int arity;                // -1 if its definitions disagree
+} typedef Strictness;
+
+struct Compiler {
+    Interp * in;
+    Buffer * decls;        // prototypes
+    Buffer * code;         // generated functions
+    HashTable * slots;     // function name -> index in the function table + 1
+    Queue/*<HASH_TYPE>*/ * slot_names;
+    HashTable * pure;      // see find_pure_functions()
+    HashTable * strict;    // function name -> Strictness
+    HashTable * lists;     // the names of the functions which may return a list
+    int ntemps;
+    int nfunctions;
+} typedef Compiler;
+
+void buffer_printf(Buffer * buf, const char * fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+    char * s = new_string(len);
+    va_start(args, fmt);
+    vsnprintf(s, len + 1, fmt, args);
+    va_end(args);
+    buffer_write(buf, s, len);
+    destroy_string(s);
+}
+
+void emit_c_string(Buffer * buf, const char * s, size_t len)
+{
+    buffer_putc(buf, '"');
+    for (size_t i = 0; i < len; i++) {
+        unsigned char ch = s[i];
+        if (ch == '"' || ch == '\\' || ch == '?') {
+            buffer_printf(buf, "\\%c", ch);
+        } else if (ch < 32 || ch > 126) {
+            buffer_printf(buf, "\\%03o", ch);
+        } else {
+            buffer_putc(buf, ch);
+        }
+    }
+    buffer_putc(buf, '"');
+}
+
+char * symbol_token(Compiler * c, HASH_TYPE key)
+{
+    HashTableItem * item = hashtable_find(c->in->symbols, key);
+    return item == NULL ? "?" : item->value;
+}
+
+Scope * new_scope(Scope * s_old)
+{
+    Scope * s = malloc(sizeof(Scope));
+    s->len = 0;
+    s->cap = 8;
+    if (s_old != NULL && s_old->len > s->cap) s->cap = s_old->len;
+    s->items = malloc(s->cap * sizeof(ScopeEntry));
+    if (s_old != NULL) {  // clone s_old
+        memcpy(s->items, s_old->items, s_old->len * sizeof(ScopeEntry));
+        s->len = s_old->len;
+    }
+    return s;
+}
+
+void destroy_scope(Scope * s)
+{
+    free(s->items);
+    free(s);
+}
+
+void scope_push(Scope * s, HASH_TYPE name, const char * fmt, ...)
+{
+    if (s->len == s->cap) {
+        s->cap *= 2;
+        s->items = realloc(s->items, s->cap * sizeof(ScopeEntry));
+    }
+    ScopeEntry * entry = s->items + s->len++;
+    entry->name = name;
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(entry->ref, sizeof(entry->ref), fmt, args);
+    va_end(args);
+}
+
+ScopeEntry * scope_find(Scope * s, HASH_TYPE name)
+{
+    // The first binding wins, as in the interpreter's contexts.
+    for (size_t i = 0; i < s->len; i++) {
+        if (s->items[i].name == name) return s->items + i;
+    }
+    return NULL;
+}
+
+int function_slot(Compiler * c, HASH_TYPE name)
+{
+    HashTableItem * item = hashtable_find(c->slots, name);
+    if (item != NULL) return (int)(long long)item->value - 1;
+    int slot = queue_size(c->slot_names);
+    queue_push(c->slot_names, (void *)name);
+    hashtable_insert(c->slots, name, (void *)(long long)(slot + 1));
+    return slot;
+}
+
+/*
+ * Strictness: whether evaluating e always forces the parameter p. Starting
+ * from "every function forces every parameter", this is refined until
+ * nothing changes (a function which never returns may be assumed to force
+ * anything).
+ */
+bool forces_param(Compiler * c, Expression * e, HASH_TYPE p)
+{
+    if (e->type == Id) return e->value == p;
+    if (e->type != Statement) return false;
+    HASH_TYPE name = statement_name(e);
+    size_t nargs = queue_size(e->children) - 1;
+    Node * args = queue_begin(e->children)->next;
+    if (name == HASH_OF_DO) {
+        for (Node * cur = args; cur != queue_end(e->children); cur = cur->next) {
+            if (forces_param(c, cur->data, p)) return true;
+        }
+        return false;
+    }
+    if (name == HASH_OF_PLUS || name == HASH_OF_MINUS || name == HASH_OF_TIMES ||
+            name == HASH_OF_DIVIDE || name == HASH_OF_PERCENT || name == HASH_OF_EQUAL ||
+            name == HASH_OF_GET || name == HASH_OF_AT) {
+        return nargs == 2 && (forces_param(c, args->data, p) || forces_param(c, args->next->data, p));
+    }
+    if (name == HASH_OF_LEN || name == HASH_OF_PRINT) {
+        return nargs == 1 && forces_param(c, args->data, p);
+    }
+    if (name == HASH_OF_QUESTION) {
+        if (nargs != 3) return false;
+        return forces_param(c, args->data, p) ||
+            (forces_param(c, args->next->data, p) && forces_param(c, args->next->next->data, p));
+    }
+    if (name == HASH_OF_MATCH) {
+        return nargs >= 1 && forces_param(c, args->data, p);
+    }
+    if (is_builtin(name)) return false;
+    HashTableItem * item = hashtable_find(c->strict, function_key(c->in, e, name));
+    if (item == NULL) return false;
+    Strictness * st = item->value;
+    if (st->arity != (int)nargs) return false;
+    int i = 0;
+    for (Node * cur = args; cur != queue_end(e->children); cur = cur->next, i++) {
+        if (i < 64 && (st->mask >> i & 1) && forces_param(c, cur->data, p)) return true;
+    }
+    return false;
+}
+
+void add_definitions(Queue * defs, Expression * program)
+{
+    if (program == NULL) return;
+    queue_foreach(node, program->children) {
+        if (is_definition(node->data)) queue_push(defs, node->data);
+    }
+}
+
+void compute_strictness(Compiler * c, Queue/*<Expression>*/ * defs)
+{
+    queue_foreach(node, defs) {
+        Expression * def = node->data;
+        HASH_TYPE fname = definition_key(c->in, def);
+        int arity = queue_size(def->children) - 3;
+        HashTableItem * item = hashtable_find(c->strict, fname);
+        if (item == NULL) {
+            Strictness * st = malloc(sizeof(Strictness));
+            st->mask = ~0ULL;
+            st->arity = arity;
+            // (until the program defines it, the prelude's function is called)
+            HashTableItem * shadowed = hashtable_find(c->strict, prelude_key(c->in, fname));
+            if (prelude_key(c->in, fname) != 0 && shadowed != NULL) {
+                st->mask = ((Strictness *)shadowed->value)->mask;
+                if (((Strictness *)shadowed->value)->arity != arity) st->arity = -1;
+            }
+            hashtable_insert(c->strict, fname, st);
+        } else if (((Strictness *)item->value)->arity != arity) {
+            ((Strictness *)item->value)->arity = -1;
+        }
+    }
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        queue_foreach(node, defs) {
+            Expression * def = node->data;
+            HASH_TYPE fname = definition_key(c->in, def);
+            Strictness * st = hashtable_find(c->strict, fname)->value;
+            Queue * params = definition_params(def);
+            int i = 0;
+            for (Node * cur = queue_begin(params); cur != queue_end(params); cur = cur->next, i++) {
+                if (i < 64 && (st->mask >> i & 1) &&
+                        !forces_param(c, definition_body(def), (HASH_TYPE)cur->data)) {
+                    st->mask &= ~(1ULL << i);
+                    changed = true;
+                }
+            }
+            destroy_queue(params);
+        }
+    }
+}
+
+bool may_be_list(Compiler * c, Expression * e)
+{
+    // Whether e may evaluate to a list.
+    if (e->type == Primitive) return false;
+    if (e->type != Statement) return true;
+    HASH_TYPE name = statement_name(e);
+    size_t len = queue_size(e->children);
+    if (name == HASH_OF_QUESTION) {
+        return len != 4 ||
+            may_be_list(c, queue_begin(e->children)->next->next->data) ||
+            may_be_list(c, queue_end(e->children)->prev->data);
+    } else if (name == HASH_OF_MATCH) {
+        if (len < 2 || (len - 2) % 3 != 0) return true;
+        Node * cur = queue_begin(e->children)->next->next;
+        for (; cur != queue_end(e->children); cur = cur->next->next->next) {
+            if (may_be_list(c, cur->next->next->data)) return true;
+        }
+        return false;
+    } else if (name == HASH_OF_DO) {
+        return len < 2 || may_be_list(c, queue_end(e->children)->prev->data);
+    }
+    if (name == 0 || name == HASH_OF_GET || name == HASH_OF_AT) return true;
+    if (is_builtin(name)) return false;
+    return hashtable_find(c->lists, function_key(c->in, e, name)) != NULL;
+}
+
+void compute_list_results(Compiler * c, Queue/*<Expression>*/ * defs)
+{
+    // Which functions may return a list, starting from none, until nothing changes.
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        queue_foreach(node, defs) {
+            Expression * def = node->data;
+            HASH_TYPE fname = definition_key(c->in, def);
+            if (hashtable_find(c->lists, fname) == NULL && may_be_list(c, definition_body(def))) {
+                hashtable_insert(c->lists, fname, (void *)1);
+                changed = true;
+            }
+        }
+    }
+}
+
+bool is_strict_argument(Compiler * c, HASH_TYPE fname, int i, int nargs, Expression * arg)
+{
+    HashTableItem * item = hashtable_find(c->strict, fname);
+    if (item == NULL || i >= 64) return false;
+    Strictness * st = item->value;
+    return st->arity == nargs && (st->mask >> i & 1) && is_pure(c->in, arg, c->pure);
+}
 
-            Function * f = new_function(fname, t->e);
-            queue_push(ftable, f);
+int compile_strict(Compiler * c, Buffer * b, Scope * s, Expression * e);
 
-        } else if (name == HASH_OF_DO) {
-            int i = 0;
-            Expression * ec;
-            Thunk * tc;
-            Queue/*<Thunk>*/ * context = new_queue(t->context);
-            queue_foreach(node, t->e->children) {
-                if (i != 0) {
-                    ec = node->data;
-                    tc = new_thunk(HASH_OF_TIMES, ec, context);
-                    execute(tc, symbols);
-                    t->res = tc->res;
-                    destroy_thunk(tc);
-                }
-                i++;
-            }
-            destroy_queue(context);
+void collect_free_names(Expression * e, Scope * s, Scope * captured)
+{
+    if (e->type == Id) {
+        ScopeEntry * entry = scope_find(s, e->value);
+        if (entry != NULL && scope_find(captured, e->value) == NULL) {
+            scope_push(captured, e->value, "%s", entry->ref);
+        }
+    }
+    queue_foreach(node, e->children) {
+        collect_free_names(node->data, s, captured);
+    }
+}
 
-        } else if (name == HASH_OF_LET) {
-            expect(queue_size(t->e->children) == 3,
-                    "Error: Expected 'let' statement to be given 2 parameters.\n");
-            Expression * id = queue_begin(t->e->children)->next->data;
-            Expression * ec = queue_begin(t->e->children)->next->next->data;
-            expect(id->type == Id, "Error: Expected parameter 1 of 'let' statement to be Id.\n");
-            // This thunk shouldn't see itself (so t->context is cloned first):
-            Queue/*<Thunk>*/ * context = new_queue(t->context);
-            Thunk * tc = new_thunk(id->value, ec, context);
-            queue_push(t->context, tc);
-            t->res = new_result(0, NULL, PrimitiveNULL);
+void compile_thunk(Compiler * c, Buffer * b, Scope * s, Expression * e,
+        bool on_stack, const char * fmt, ...)
+{
+    /*
+     * Initializes a thunk for e, named by fmt: "Thunk <name> = ..." on the
+     * stack, or "<name> = ..." for an allocated one.
+     */
+    char name[64];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(name, sizeof(name), fmt, args);
+    va_end(args);
+    const char * decl = on_stack ? "Thunk " : "";
 
-        } else if (name == HASH_OF_GET) {
-            expect(false, "Error: 'get' not implemented yet!\n");
+    if (e->type == Primitive) {
+        int v = compile_strict(c, b, s, e);
+        buffer_printf(b, "    %s%s = (Thunk){ true, v%d, NULL, NULL };\n", decl, name, v);
+        return;
+    }
+    ScopeEntry * alias = e->type == Id ? scope_find(s, e->value) : NULL;
+    if (alias != NULL) {
+        int env = c->ntemps++;
+        buffer_printf(b, "    Thunk ** e%d = rt_alloc(sizeof(Thunk *));\n", env);
+        buffer_printf(b, "    e%d[0] = %s;\n", env, alias->ref);
+        buffer_printf(b, "    %s%s = (Thunk){ false, RT_NULL, rt_alias, e%d };\n", decl, name, env);
+        return;
+    }
 
-        } else if (name == HASH_OF_READ_INT) {
-            expect(queue_size(t->e->children) == 1,
-                    "Error: Function 'read_int' expects no parameters.\n");
-            long long num;
-            expect(scanf(" %lld", &num) != EOF, "Error: read_int reached end of file.\n");
-            t->res = new_result(num, NULL, PrimitiveNumber);
+    // a new function, for the code of the thunk:
+    Scope * captured = new_scope(NULL);
+    collect_free_names(e, s, captured);
+    Scope * inner = new_scope(NULL);
+    for (size_t i = 0; i < captured->len; i++) {
+        scope_push(inner, captured->items[i].name, "self->env[%zu]", i);
+    }
+    int fn = c->nfunctions++;
+    Buffer * body = new_buffer();
+    buffer_printf(c->decls, "static Value c%d(Thunk * self);\n", fn);
+    buffer_printf(body, "static Value c%d(Thunk * self)\n{\n", fn);
+    if (captured->len == 0) buffer_printf(body, "    (void)self;\n");
+    int v = compile_strict(c, body, inner, e);
+    buffer_printf(body, "    return v%d;\n}\n\n", v);
+    buffer_write(c->code, body->data, body->len);
+    destroy_buffer(body);
+    destroy_scope(inner);
+
+    int env = c->ntemps++;
+    if (captured->len == 0) {
+        buffer_printf(b, "    Thunk ** e%d = NULL;\n", env);
+    } else if (on_stack) {
+        buffer_printf(b, "    Thunk * e%d[] = {", env);
+        for (size_t i = 0; i < captured->len; i++) {
+            buffer_printf(b, "%s %s", i == 0 ? "" : ",", captured->items[i].ref);
+        }
+        buffer_printf(b, " };\n");
+    } else {
+        buffer_printf(b, "    Thunk ** e%d = rt_alloc(%zu * sizeof(Thunk *));\n", env, captured->len);
+        for (size_t i = 0; i < captured->len; i++) {
+            buffer_printf(b, "    e%d[%zu] = %s;\n", env, i, captured->items[i].ref);
+        }
+    }
+    buffer_printf(b, "    %s%s = (Thunk){ false, RT_NULL, c%d, e%d };\n", decl, name, fn, env);
+    destroy_scope(captured);
+}
 
-        } else if (name == HASH_OF_READ_CHAR) {
-            expect(queue_size(t->e->children) == 1,
-                    "Error: Function 'read_char' expects no parameters.\n");
-            char c;
-            expect(scanf(" %c", &c) != EOF, "Error: read_char reached end of file.\n");
-            t->res = new_result(c, NULL, PrimitiveChar);
+int compile_fail(Compiler * c, Buffer * b, const char * fmt, ...)
+{
+    // A runtime error, where the interpreter would report it.
+    char msg[512];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, args);
+    va_end(args);
+    int v = c->ntemps++;
+    buffer_printf(b, "    Value v%d = rt_fail(\"%%s\", ", v);
+    emit_c_string(b, msg, strlen(msg));
+    buffer_printf(b, ");\n");
+    return v;
+}
 
-        } else if (name == HASH_OF_PRINT) {
-            expect(queue_size(t->e->children) == 2,
-                    "Invalid number of arguments for 'print' function.\n");
-            Expression * ec = queue_begin(t->e->children)->next->data;
-            Thunk * tt = new_thunk(HASH_OF_TIMES, ec, t->context);
-            execute(tt, symbols);
-            // perform print:
-            print_result(tt->res);
-            destroy_thunk(tt);
-            t->res = new_result(0, NULL, PrimitiveNULL);
+int compile_branch(Compiler * c, Buffer * b, Scope * s, Expression * e, int result)
+{
+    // Compiles e in a block of its own, assigning its value to v<result>.
+    // ('let's inside a branch can't be seen after it.)
+    Scope * inner = new_scope(s);
+    buffer_printf(b, "    {\n");
+    int v = compile_strict(c, b, inner, e);
+    buffer_printf(b, "    v%d = v%d;\n    }\n", result, v);
+    destroy_scope(inner);
+    return result;
+}
 
-        } else if (name == HASH_OF_MATCH) {
-            // TODO: Add match to grammar, and move this sanitization to the parser...
-            expect(queue_size(t->e->children) >= 2,
-                    "Error: Too few parameters to 'match' statement.\n");
+int compile_call(Compiler * c, Buffer * b, Scope * s, Expression * e, HASH_TYPE name)
+{
+    name = function_key(c->in, e, name);  // (the prelude calls its own functions)
+    int slot = function_slot(c, name);
+    int nargs = queue_size(e->children) - 1;
+    int call = c->ntemps++;
+    if (nargs == 0) {
+        buffer_printf(b, "    Value v%d = rt_call(&functions[%d], 0, NULL);\n", call, slot);
+        return call;
+    }
+    // (the arguments must outlive the call if it may return a list)
+    bool on_stack = hashtable_find(c->lists, name) == NULL;
+    int i = 0;
+    for (Node * cur = queue_begin(e->children)->next; cur != queue_end(e->children); cur = cur->next) {
+        Expression * arg = cur->data;
+        if (!on_stack && (is_strict_argument(c, name, i, nargs, arg) ||
+                    arg->type != Id || scope_find(s, arg->value) == NULL)) {
+            buffer_printf(b, "    Thunk * a%d_%d = rt_alloc(sizeof(Thunk));\n", call, i);
+        }
+        if (is_strict_argument(c, name, i, nargs, arg)) {
+            int v = compile_strict(c, b, s, arg);
+            buffer_printf(b, "    %sa%d_%d = (Thunk){ true, v%d, NULL, NULL };\n",
+                    on_stack ? "Thunk " : "*", call, i, v);
+        } else if (arg->type == Id && scope_find(s, arg->value) != NULL) {
+            // (passed on as it is, rather than wrapped in a thunk of its own)
+        } else if (on_stack) {
+            compile_thunk(c, b, s, arg, true, "a%d_%d", call, i);
+        } else {
+            compile_thunk(c, b, s, arg, false, "*a%d_%d", call, i);
+        }
+        i++;
+    }
+    buffer_printf(b, "    Thunk * a%d[] = {", call);
+    i = 0;
+    for (Node * cur = queue_begin(e->children)->next; cur != queue_end(e->children); cur = cur->next) {
+        Expression * arg = cur->data;
+        buffer_printf(b, "%s ", i == 0 ? "" : ",");
+        if (!is_strict_argument(c, name, i, nargs, arg) &&
+                arg->type == Id && scope_find(s, arg->value) != NULL) {
+            buffer_printf(b, "%s", scope_find(s, arg->value)->ref);
+        } else {
+            buffer_printf(b, "%sa%d_%d", on_stack ? "&" : "", call, i);
+        }
+        i++;
+    }
+    buffer_printf(b, " };\n");
+    buffer_printf(b, "    Value v%d = rt_call(&functions[%d], %d, a%d);\n", call, slot, nargs, call);
+    return call;
+}
 
-            Result * res_given;
-            do {
-                Expression * ec_given = queue_begin(t->e->children)->next->data;
-                Thunk * tc_given = new_thunk(HASH_OF_TIMES, ec_given, t->context);
-                execute(tc_given, symbols);
-                res_given = tc_given->res;
-                destroy_thunk(tc_given);
-            } while (0);
+int compile_match(Compiler * c, Buffer * b, Scope * s, Expression * e)
+{
+    size_t nchildren = queue_size(e->children);
+    if (nchildren < 2) {
+        return compile_fail(c, b, "Error: Too few parameters to 'match' statement.\n");
+    }
+    if ((nchildren - 2) % 3 != 0) {
+        return compile_fail(c, b, "Error: Expected (test : answer) triplets in match statement.\n");
+    }
+    for (Node * cur = queue_begin(e->children)->next->next; cur != queue_end(e->children);
+            cur = cur->next->next->next) {
+        Expression * sep = cur->next->data;
+        if (sep->type != Id || sep->value != HASH_OF_COLON) {
+            return compile_fail(c, b, "Error: Expected ':' token in match statement.\n");
+        }
+    }
+    int given = compile_strict(c, b, s, queue_begin(e->children)->next->data);
+    buffer_printf(b, "    rt_deep_force(v%d);\n", given);
+    int result = c->ntemps++;
+    buffer_printf(b, "    Value v%d = RT_NULL;\n", result);
+    buffer_printf(b, "    do {\n");
+    for (Node * cur = queue_begin(e->children)->next->next; cur != queue_end(e->children);
+            cur = cur->next->next->next) {
+        Scope * inner = new_scope(s);
+        buffer_printf(b, "    {\n");
+        int test = compile_strict(c, b, inner, cur->data);
+        if (!is_literal_test(cur->data)) buffer_printf(b, "    rt_deep_force(v%d);\n", test);
+        buffer_printf(b, "    if (rt_equal(v%d, v%d)) {\n", given, test);
+        compile_branch(c, b, inner, cur->next->next->data, result);
+        buffer_printf(b, "    break;\n    }\n    }\n");
+        destroy_scope(inner);
+    }
+    buffer_printf(b, "    } while (0);\n");
+    return result;
+}
 
-            Node * cur = queue_begin(t->e->children)->next->next,
-                 * end = queue_end(t->e->children);
-            bool matched = false;
-            for (int i = 0; cur != end; i++) {
-                // process the first value
-                Expression * ec_test = cur->data;
-
-                // process the ':' token
-                expect(cur->next != end, "Error: Expected ':' token in match statement.\n");
-                cur = cur->next;
-                Expression * ec_sep = cur->data;
-
-                // process the third value
-                expect(ec_sep->type == Id, "Error: Expected ':' token in match statement.\n");
-                expect(ec_sep->value == HASH_OF_COLON,
-                        "Error: Expected ':' token in match statement.\n");
-                expect(cur->next != end,
-                        "Error: Expected another parameter in match statement.\n");
-                cur = cur->next;
-                Expression * ec_ans = cur->data;
-
-                // advice to either end, or start of next triplet:
-                cur = cur->next;
-
-                // Compute this test:
-                Result * res_test;
-                do {
-                    Thunk * tc_test = new_thunk(HASH_OF_TIMES, ec_test, t->context);
-                    execute(tc_test, symbols);
-                    res_test = tc_test->res;
-                    destroy_thunk(tc_test);
-                } while (0);
-                if (result_equal(res_given, res_test)) {
-                    Thunk * tc_ans = new_thunk(HASH_OF_TIMES, ec_ans, t->context);
-                    execute(tc_ans, symbols);
-                    t->res = tc_ans->res;
-                    destroy_thunk(tc_ans);
-                    matched = true;
-                    break;
-                }
-            }
-            if (!matched) {
-                t->res = new_result(0, NULL, PrimitiveNULL);
-            }
+int compile_strict(Compiler * c, Buffer * b, Scope * s, Expression * e)
+{
+    // Emits code which evaluates e, and returns the number of the Value holding it.
+    if (e->type == Primitive) {
+        int v = c->ntemps++;
+        if (e->ptype == PrimitiveNumber && e->str != NULL) {
+            // (the digits of a literal too large for a long long, parsed once)
+            buffer_printf(c->decls, "static Value big%d;\n", v);
+            buffer_printf(b, "    if (big%d.big == NULL) big%d = rt_big_parse(", v, v);
+            emit_c_string(b, e->str->data, e->str->len);
+            buffer_printf(b, ", %zu, false);\n    Value v%d = big%d;\n", e->str->len, v, v);
+            return v;
+        }
+        switch (e->ptype) {
+        case PrimitiveNumber:
+            buffer_printf(b, "    Value v%d = rt_number(%lldLL);\n", v, e->value);
+            break;
+        case PrimitiveChar:
+            buffer_printf(b, "    Value v%d = rt_char(%lldLL);\n", v, e->value);
+            break;
+        case PrimitiveString:
+            buffer_printf(b, "    Value v%d = rt_string(", v);
+            emit_c_string(b, e->str->data, e->str->len);
+            buffer_printf(b, ", %zu);\n", e->str->len);
+            break;
+        case PrimitiveTRUE:  buffer_printf(b, "    Value v%d = RT_TRUE;\n", v); break;
+        case PrimitiveFALSE: buffer_printf(b, "    Value v%d = RT_FALSE;\n", v); break;
+        case PrimitiveANY:   buffer_printf(b, "    Value v%d = RT_ANY;\n", v); break;
+        default:             buffer_printf(b, "    Value v%d = RT_NULL;\n", v); break;
+        }
+        return v;
+    }
 
-        } else if (name == HASH_OF_QUESTION) {
-            expect(queue_size(t->e->children) == 4,
-                    "Expected 4 arguments for '?' statement.\n");
-            Expression * e_test = queue_begin(t->e->children)->next->data;
-            Thunk * t_test = new_thunk(HASH_OF_TIMES, e_test, t->context);
-            execute(t_test, symbols);
-            Expression * ec;
-            if (result_is_true(t_test->res)) {
-                ec = queue_begin(t->e->children)->next->next->data;
-            } else {
-                ec = queue_begin(t->e->children)->next->next->next->data;
-            }
-            Thunk * ans = new_thunk(HASH_OF_TIMES, ec, t->context);
-            execute(ans, symbols);
-            t->res = ans->res;
-            destroy_thunk(ans);
-            destroy_thunk(t_test);
+    if (e->type == Id) {
+        ScopeEntry * entry = scope_find(s, e->value);
+        if (entry == NULL) {
+            return compile_fail(c, b, "Error: Symbol %s not found.\n", symbol_token(c, e->value));
+        }
+        int v = c->ntemps++;
+        buffer_printf(b, "    Value v%d = rt_force(%s);\n", v, entry->ref);
+        return v;
+    }
 
-        } else if (name == HASH_OF_PLUS   ||
-                   name == HASH_OF_MINUS  ||
-                   name == HASH_OF_TIMES  ||
-                   name == HASH_OF_DIVIDE ||
-                   name == HASH_OF_PERCENT) {
-            expect(queue_size(t->e->children) == 3,
-                    "Invalid number of arguments for '%s' function.\n",
-                    (char *)hashtable_find(symbols, name)->value);
-            Expression * ea = queue_begin(t->e->children)->next->data;
-            Expression * eb = queue_begin(t->e->children)->next->next->data;
-            Thunk * tta = new_thunk(HASH_OF_TIMES, ea, t->context);
-            Thunk * ttb = new_thunk(HASH_OF_TIMES, eb, t->context);
-            execute(tta, symbols);
-            execute(ttb, symbols);
-            long long num = 0;
-            if      (name == HASH_OF_PLUS)    num = tta->res->num + ttb->res->num;
-            else if (name == HASH_OF_MINUS)   num = tta->res->num - ttb->res->num;
-            else if (name == HASH_OF_TIMES)   num = tta->res->num * ttb->res->num;
-            else if (name == HASH_OF_DIVIDE)  num = tta->res->num / ttb->res->num;
-            else if (name == HASH_OF_PERCENT) num = tta->res->num % ttb->res->num;
-            else                              num = 0;
-            t->res = new_result(num, NULL, PrimitiveNumber);
-            // Note: The result may have been reused from somewhere else,
-            //       and it still may be used elsewhere, so we cannot destroy it yet.
-            destroy_thunk(tta);
-            destroy_thunk(ttb);
+    if (e->type == List) {
+        size_t len = queue_size(e->children);
+        int v = c->ntemps++;
+        if (len == 0) {
+            buffer_printf(b, "    Value v%d = rt_list(NULL, 0);\n", v);
+            return v;
+        }
+        buffer_printf(b, "    Thunk * i%d = rt_alloc(%zu * sizeof(Thunk));\n", v, len);
+        size_t i = 0;
+        queue_foreach(node, e->children) {
+            compile_thunk(c, b, s, node->data, false, "i%d[%zu]", v, i++);
+        }
+        buffer_printf(b, "    Value v%d = rt_list(i%d, %zu);\n", v, v, len);
+        return v;
+    }
 
-        } else if (name == HASH_OF_EQUAL) {
-            expect(queue_size(t->e->children) == 3,
-                    "Invalid number of arguments for '=' function.\n");
-            Expression * ea = queue_begin(t->e->children)->next->data;
-            Expression * eb = queue_begin(t->e->children)->next->next->data;
-            Thunk * tta = new_thunk(HASH_OF_TIMES, ea, t->context);
-            Thunk * ttb = new_thunk(HASH_OF_TIMES, eb, t->context);
-            execute(tta, symbols);
-            execute(ttb, symbols);
-            if (result_equal(tta->res, ttb->res)) {
-                t->res = new_result(0, NULL, PrimitiveTRUE);
-            } else {
-                t->res = new_result(0, NULL, PrimitiveFALSE);
-            }
-            destroy_thunk(tta);
-            destroy_thunk(ttb);
+    expect(e->type == Statement, "Error (internal): compile_strict :: Bad Expression tree.\n");
+    HASH_TYPE name = statement_name(e);
+    size_t nargs = queue_size(e->children) - 1;
+    Node * args = queue_begin(e->children)->next;
+
+    if (name == HASH_OF_DEF) {
+        expect(false, "Error: --emit-c only supports 'def' at the top level of a program.\n");
+        return 0;
+
+    } else if (name == HASH_OF_DO) {
+        Scope * inner = new_scope(s);
+        int v = c->ntemps++;
+        buffer_printf(b, "    Value v%d = RT_NULL;\n", v);
+        for (Node * cur = args; cur != queue_end(e->children); cur = cur->next) {
+            int vc = compile_strict(c, b, inner, cur->data);
+            buffer_printf(b, "    v%d = v%d;\n", v, vc);
+        }
+        destroy_scope(inner);
+        return v;
 
+    } else if (name == HASH_OF_LET) {
+        if (nargs != 2) {
+            return compile_fail(c, b, "Error: Expected 'let' statement to be given 2 parameters.\n");
+        }
+        Expression * id = args->data;
+        if (id->type != Id) {
+            return compile_fail(c, b, "Error: Expected parameter 1 of 'let' statement to be Id.\n");
+        }
+        // (the binding can't see itself)
+        int k = c->ntemps++;
+        buffer_printf(b, "    Thunk * k%d = rt_alloc(sizeof(Thunk));\n", k);
+        compile_thunk(c, b, s, args->next->data, false, "*k%d", k);
+        scope_push(s, id->value, "k%d", k);
+        int v = c->ntemps++;
+        buffer_printf(b, "    Value v%d = RT_NULL;\n", v);
+        return v;
+
+    } else if (name == HASH_OF_GET || name == HASH_OF_AT || name == HASH_OF_PLUS ||
+            name == HASH_OF_MINUS || name == HASH_OF_TIMES || name == HASH_OF_DIVIDE ||
+            name == HASH_OF_PERCENT || name == HASH_OF_EQUAL) {
+        if (nargs != 2) {
+            return compile_fail(c, b, "Invalid number of arguments for '%s' function.\n",
+                    symbol_token(c, name));
+        }
+        int va = compile_strict(c, b, s, args->data);
+        int vb = compile_strict(c, b, s, args->next->data);
+        int v = c->ntemps++;
+        const char * op = name == HASH_OF_PLUS  ? "+" : name == HASH_OF_MINUS   ? "-" :
+                          name == HASH_OF_TIMES ? "*" : name == HASH_OF_DIVIDE  ? "/" :
+                          name == HASH_OF_PERCENT ? "%" : NULL;
+        if (op != NULL) {
+            buffer_printf(b, "    Value v%d = rt_arith('%s', v%d, v%d);\n", v, op, va, vb);
+        } else if (name == HASH_OF_EQUAL) {
+            buffer_printf(b, "    rt_deep_force(v%d);\n    rt_deep_force(v%d);\n", va, vb);
+            buffer_printf(b, "    Value v%d = rt_bool(rt_equal(v%d, v%d));\n", v, va, vb);
         } else {
-            Function * userfunc = find_function(name);
-            expect(userfunc != NULL,
-                    "Error: Couldn't find function named %s!\n",
-                    (char *)hashtable_find(symbols, name)->value);
-            int num_params_expected = queue_size(userfunc->params);
-            int num_params_supplied = queue_size(t->e->children) - 1; // ignore the function name
-            expect(num_params_expected == num_params_supplied,
-                    "Error: Expected %d parameters for function %s, but got %d.\n",
-                    num_params_expected,
-                    (char *)hashtable_find(symbols, name)->value,
-                    num_params_supplied);
-            // Create a new thunk, with an empty context.
-            Queue/*<Thunk>*/ * context = new_queue(NULL);
-            Thunk * tf = new_thunk(HASH_OF_TIMES, userfunc->def, context);
-            // For each function parameter, create a new thunk with the context
-            // of the current thunk being executed,
-            // and add it to the function thunk's context.
-            // That way, the only Ids visible in the function execution are the parameters.
-            Node * cur = queue_begin(t->e->children)->next;
-            queue_foreach(node, userfunc->params) {
-                HASH_TYPE param_id = (HASH_TYPE)node->data;
-                Expression * ec = cur->data;
-                Thunk * tp = new_thunk(param_id, ec, t->context);
-                queue_push(tf->context, tp);
-                cur = cur->next;
+            buffer_printf(b, "    Value v%d = rt_%s(v%d, v%d);\n", v,
+                    name == HASH_OF_GET ? "get" : "at", va, vb);
+        }
+        return v;
+
+    } else if (name == HASH_OF_LEN || name == HASH_OF_PRINT) {
+        if (nargs != 1) {
+            return compile_fail(c, b, "Invalid number of arguments for '%s' function.\n",
+                    symbol_token(c, name));
+        }
+        int va = compile_strict(c, b, s, args->data);
+        int v = c->ntemps++;
+        buffer_printf(b, "    Value v%d = rt_%s(v%d);\n", v, name == HASH_OF_LEN ? "len" : "print", va);
+        return v;
+
+    } else if (name == HASH_OF_READ_INT || name == HASH_OF_READ_CHAR) {
+        if (nargs != 0) {
+            return compile_fail(c, b, "Error: Function '%s' expects no parameters.\n",
+                    symbol_token(c, name));
+        }
+        int v = c->ntemps++;
+        buffer_printf(b, "    Value v%d = rt_%s();\n", v, symbol_token(c, name));
+        return v;
+
+    } else if (name == HASH_OF_QUESTION) {
+        if (nargs != 3) return compile_fail(c, b, "Expected 4 arguments for '?' statement.\n");
+        int test = compile_strict(c, b, s, args->data);
+        int v = c->ntemps++;
+        buffer_printf(b, "    Value v%d;\n", v);
+        buffer_printf(b, "    if (rt_truthy(v%d))\n", test);
+        compile_branch(c, b, s, args->next->data, v);
+        buffer_printf(b, "    else\n");
+        compile_branch(c, b, s, args->next->next->data, v);
+        return v;
+
+    } else if (name == HASH_OF_MATCH) {
+        return compile_match(c, b, s, e);
+
+    } else {
+        return compile_call(c, b, s, e, name);
+    }
+}
+
+void compile_definition(Compiler * c, Expression * def, int fn)
+{
+    Queue * params = definition_params(def);
+    Scope * s = new_scope(NULL);
+    int i = 0;
+    queue_foreach(node, params) {
+        scope_push(s, (HASH_TYPE)node->data, "args[%d]", i++);
+    }
+    Buffer * body = new_buffer();
+    buffer_printf(c->decls, "static Value f%d(Thunk ** args);\n", fn);
+    buffer_printf(body, "static Value f%d(Thunk ** args)\n{\n", fn);
+    if (i == 0) buffer_printf(body, "    (void)args;\n");
+    int v = compile_strict(c, body, s, definition_body(def));
+    buffer_printf(body, "    return v%d;\n}\n\n", v);
+    buffer_write(c->code, body->data, body->len);
+    destroy_buffer(body);
+    destroy_scope(s);
+    destroy_queue(params);
+}
+
+void emit_c(Interp * in, char * out_fname);
+
+int compile_program(char * fname, char * out_fname, Options * opts)
+{
+    // Compiles a program to C, printing any errors.
+    char * source = read_file(fname);
+    Interp * in = lang_create();
+    expect(in != NULL, "Error: Failed to create interpreter.\n");
+    apply_options(in, opts);
+    int status = lang_load(in, source);
+    if (status == 0) {
+        emit_c(in, out_fname);
+    } else {
+        fprintf(stderr, "%s", lang_error(in));
+    }
+    lang_destroy(in);
+    destroy_string(source);
+    return status == 0 ? 0 : EXIT_FAILURE;
+}
+
+void emit_c(Interp * in, char * out_fname)
+{
+    Compiler c;
+    c.in = in;
+    c.decls = new_buffer();
+    c.code = new_buffer();
+    c.slots = new_hashtable(DEFAULT_HASHTABLE_SIZE);
+    c.slot_names = new_queue(NULL);
+    c.pure = find_pure_functions(in, in->program);
+    c.strict = new_hashtable(DEFAULT_HASHTABLE_SIZE);
+    c.lists = new_hashtable(DEFAULT_HASHTABLE_SIZE);
+    c.ntemps = 0;
+    c.nfunctions = 0;
+
+    // (the prelude only calls its own functions, so it goes first)
+    Queue * defs = new_queue(NULL);
+    add_definitions(defs, in->prelude);
+    compute_strictness(&c, defs);
+    compute_list_results(&c, defs);
+    destroy_queue(defs);
+    hashtable_foreach(item, in->shadowed) {
+        if (hashtable_find(c.lists, (HASH_TYPE)item->value) != NULL) {
+            hashtable_insert(c.lists, item->key, (void *)1);
+        }
+    }
+    defs = new_queue(NULL);
+    add_definitions(defs, in->program);
+    compute_strictness(&c, defs);
+    compute_list_results(&c, defs);
+    destroy_queue(defs);
+
+    // the prelude's functions are defined from the start:
+    Buffer * init = new_buffer();
+    if (in->prelude != NULL) {
+        queue_foreach(node, in->prelude->children) {
+            Expression * def = node->data;
+            HASH_TYPE fname = ((Expression *)queue_begin(def->children)->next->data)->value;
+            HASH_TYPE key = definition_key(in, def);
+            if (in->live_functions != NULL && hashtable_find(in->live_functions, key) == NULL) {
+                continue;
             }
-            execute(tf, symbols);
-            t->res = tf->res;
-            // cleanup:
-            queue_foreach(node, tf->context) {
-                Thunk * tp = node->data;
-                destroy_thunk(tp);
+            int fn = c.nfunctions++;
+            compile_definition(&c, def, fn);
+            // (one the program shadows has a slot of its own, for the prelude's calls)
+            for (int i = 0; i < (key == fname ? 1 : 2); i++) {
+                int slot = function_slot(&c, i == 0 ? key : fname);
+                buffer_printf(init, "    functions[%d].fn = f%d;\n", slot, fn);
+                buffer_printf(init, "    functions[%d].arity = %d;\n",
+                        slot, (int)queue_size(def->children) - 3);
+                buffer_printf(init, "    functions[%d].prelude = true;\n", slot);
             }
-            destroy_queue(context);
-            destroy_thunk(tf);
         }
+    }
 
-    } else if (t->e->type == List) {
-        expect(false, "Error (internal): List type not implemented yet!\n");
-
-    } else if (t->e->type == Id) {
-        HASH_TYPE name = t->e->value;
-        bool found = false;
-        Thunk * tc;
-        queue_foreach(node, t->context) {
-            tc = node->data;
-            if (tc->name == name) {
-                found = true;
-                break;
+    // the program runs its statements in one scope:
+    Buffer * run = new_buffer();
+    Scope * s = new_scope(NULL);
+    queue_foreach(node, in->program->children) {
+        Expression * e = node->data;
+        if (statement_name(e) == HASH_OF_DEF) {
+            if (!is_valid_definition(e)) {
+                compile_fail(&c, run, "Error: Expected function name and definition.\n");
+                continue;
             }
+            HASH_TYPE fname = ((Expression *)queue_begin(e->children)->next->data)->value;
+            int fn = c.nfunctions++;
+            compile_definition(&c, e, fn);
+            buffer_printf(run, "    rt_define(&functions[%d], f%d, %d);\n",
+                    function_slot(&c, fname), fn, (int)queue_size(e->children) - 3);
+        } else {
+            buffer_printf(run, "    (void)v%d;\n", compile_strict(&c, run, s, e));
         }
-        expect(found,
-                "Error: Symbol %s not found.\n",
-                (char *)hashtable_find(symbols, name)->value);
-        execute(tc, symbols);
-        t->res = tc->res;
+    }
+    destroy_scope(s);
+
+    FILE * fp = fopen(out_fname, "w");
+    expect(fp != NULL, "Error: Failed to open file %s.\n", out_fname);
+    fprintf(fp, "%s", (const char *)RUNTIME);
+    fprintf(fp, "\n/* Generated by `lang --emit-c`. */\n\n");
+    size_t nslots = queue_size(c.slot_names);
+    if (nslots == 0) function_slot(&c, HASH_OF_TIMES);  // (C has no empty arrays)
+    fprintf(fp, "static RtFunction functions[%zu] = {\n", queue_size(c.slot_names));
+    queue_foreach(node, c.slot_names) {
+        char * token = symbol_token(&c, (HASH_TYPE)node->data);
+        if (token[0] == '#') token++;  // (a function of the prelude, see find_shadowed())
+        Buffer * quoted = new_buffer();
+        emit_c_string(quoted, token, strlen(token));
+        fprintf(fp, "    { NULL, 0, false, %.*s },\n", (int)quoted->len, quoted->data);
+        destroy_buffer(quoted);
+    }
+    fprintf(fp, "};\n\n");
+    fwrite(c.decls->data, 1, c.decls->len, fp);
+    fprintf(fp, "\n");
+    fwrite(c.code->data, 1, c.code->len, fp);
+    fprintf(fp, "static void rt_program(void)\n{\n");
+    fwrite(init->data, 1, init->len, fp);
+    fwrite(run->data, 1, run->len, fp);
+    fprintf(fp, "}\n");
+    fclose(fp);
 
-    } else if (t->e->type == Primitive) {
-        if (t->e->ptype == PrimitiveNULL) {
-            t->res = new_result(0, NULL, PrimitiveNULL);
+    hashtable_foreach(item, c.strict) {
+        free(item->value);
+    }
+    destroy_hashtable(c.strict);
+    destroy_hashtable(c.lists);
+    destroy_hashtable(c.pure);
+    destroy_hashtable(c.slots);
+    destroy_queue(c.slot_names);
+    destroy_buffer(init);
+    destroy_buffer(run);
+    destroy_buffer(c.decls);
+    destroy_buffer(c.code);
+}
 
-        } else if (t->e->ptype == PrimitiveANY) {
-            t->res = new_result(1, NULL, PrimitiveANY);
+#endif
 
-        } else if (t->e->ptype == PrimitiveTRUE) {
-            t->res = new_result(1, NULL, PrimitiveTRUE);
 
-        } else if (t->e->ptype == PrimitiveFALSE) {
-            t->res = new_result(0, NULL, PrimitiveFALSE);
+/*******************
+ *      BATCH      *
+ *******************/
 
-        } else if (t->e->ptype == PrimitiveString) {
-            t->res = new_result(1, t->e->str, PrimitiveString);
+/*
+ * Runs many programs in one process: `lang --batch jobs.jsonl`.
+ * Each line of the input is a JSON object describing one job:
+ *   {"id": 1, "program": "(print (read_int))", "stdin": "42"}
+ * ("file": "path.lang" may be given instead of "program"). The jobs run on a
+ * pool of threads, each job with its own interpreter, and one JSON line per
+ * job is written to stdout, in the same order as the input:
+ *   {"id": 1, "status": "ok", "stdout": "42\n", "stderr": ""}
+ * where status is one of "ok", "error", "timeout", "out_of_fuel",
+ * "out_of_memory" or "stopped". A line which is not a valid job gets an
+ * "error" line of its own (with the line number as its id, if it has none),
+ * and the other jobs still run. Other fields of a job are ignored.
+ */
+#ifndef __EMSCRIPTEN__
 
-        } else if (t->e->ptype == PrimitiveNumber) {
-            t->res = new_result(t->e->value, NULL, PrimitiveNumber);
+// Evaluation is deeply recursive, so give the workers plenty of (lazily committed) stack:
+#define BATCH_STACK_SIZE (256 * 1024 * 1024)
 
-        } else if (t->e->ptype == PrimitiveChar) {
-            t->res = new_result(t->e->value, NULL, PrimitiveChar);
+struct Job {
+    char * id;       // as raw JSON
+    char * program;
+    char * file;
+    char * input;
+    int status;
+    Buffer * output;
+    char * error;
+    bool done;
+} typedef Job;
+
+struct Batch {
+    Job * jobs;
+    size_t njobs;
+    size_t next;     // the next job to start
+    Options * opts;
+    pthread_mutex_t lock;
+    pthread_cond_t finished;
+} typedef Batch;
+
+char * json_skip_whitespace(char * p)
+{
+    while (member_of(*p, " \r\n\t") && *p != '\0') p++;
+    return p;
+}
 
+char * json_parse_string(char * p, Buffer * out)
+{
+    // Decodes the string starting at p (which must be a '"') into out,
+    // and returns the position after it, or NULL if it is malformed.
+    if (*p++ != '"') return NULL;
+    for (; *p != '"'; p++) {
+        if (*p == '\0') return NULL;
+        if (*p != '\\') {
+            buffer_putc(out, *p);
+            continue;
+        }
+        p++;
+        if      (*p == 'n') buffer_putc(out, '\n');
+        else if (*p == 't') buffer_putc(out, '\t');
+        else if (*p == 'r') buffer_putc(out, '\r');
+        else if (*p == 'b') buffer_putc(out, '\b');
+        else if (*p == 'f') buffer_putc(out, '\f');
+        else if (*p == '"' || *p == '\\' || *p == '/') buffer_putc(out, *p);
+        else if (*p == 'u') {
+            unsigned int c = 0;
+            for (int i = 1; i <= 4; i++) {
+                if (!isxdigit(p[i])) return NULL;
+                c = c * 16 + (isdigit(p[i]) ? p[i] - '0' : tolower(p[i]) - 'a' + 10);
+            }
+            p += 4;
+            // encode as UTF-8 (surrogate pairs are not combined):
+            if (c < 0x80) {
+                buffer_putc(out, c);
+            } else if (c < 0x800) {
+                buffer_putc(out, 0xc0 | (c >> 6));
+                buffer_putc(out, 0x80 | (c & 0x3f));
+            } else {
+                buffer_putc(out, 0xe0 | (c >> 12));
+                buffer_putc(out, 0x80 | ((c >> 6) & 0x3f));
+                buffer_putc(out, 0x80 | (c & 0x3f));
+            }
         } else {
-            expect(false,
-                    "Error: Couldn't match primitive expression '%s'.\n",
-                    (char *)hashtable_find(symbols, t->e->value)->value);
+            return NULL;
         }
     }
+    return p + 1;
 }
 
+void json_write_string(Buffer * out, const char * s, size_t len)
+{
+    buffer_putc(out, '"');
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = s[i];
+        if      (c == '"')  buffer_write(out, "\\\"", 2);
+        else if (c == '\\') buffer_write(out, "\\\\", 2);
+        else if (c == '\n') buffer_write(out, "\\n", 2);
+        else if (c == '\t') buffer_write(out, "\\t", 2);
+        else if (c == '\r') buffer_write(out, "\\r", 2);
+        else if (c < 0x20) {
+            char esc[8];
+            snprintf(esc, sizeof(esc), "\\u%04x", c);
+            buffer_write(out, esc, 6);
+        } else {
+            buffer_putc(out, c);
+        }
+    }
+    buffer_putc(out, '"');
+}
 
-int main(int argc, char * argv[])
+char * json_skip_value(char * p)
 {
-    expect(argc >= 2, "Usage: %s <input.lang>\n", argv[0]);
+    // Returns the position after the value starting at p (of any kind,
+    // including arrays and objects), or NULL if it is malformed.
+    if (*p == '"') {
+        Buffer * ignored = new_buffer();
+        p = json_parse_string(p, ignored);
+        destroy_buffer(ignored);
+        return p;
+    }
+    if (*p == '[' || *p == '{') {
+        char close = *p == '[' ? ']' : '}';
+        p = json_skip_whitespace(p + 1);
+        while (*p != close) {
+            if (close == '}') {
+                // (a key)
+                if (*p != '"' || (p = json_skip_value(p)) == NULL) return NULL;
+                p = json_skip_whitespace(p);
+                if (*p++ != ':') return NULL;
+                p = json_skip_whitespace(p);
+            }
+            if ((p = json_skip_value(p)) == NULL) return NULL;
+            p = json_skip_whitespace(p);
+            if (*p == ',') p = json_skip_whitespace(p + 1);
+            else if (*p != close) return NULL;
+        }
+        return p + 1;
+    }
+    // numbers and literals:
+    char * start = p;
+    while (*p != '\0' && *p != ',' && *p != '}' && *p != ']' && !isspace(*p)) p++;
+    return p == start ? NULL : p;
+}
 
-    // Read input from file:
-    char * input = read_file(argv[1]);
+char * buffer_to_string(Buffer * buf)
+{
+    char * s = new_string(buf->len);
+    memcpy(s, buf->data, buf->len);
+    s[buf->len] = '\0';
+    return s;
+}
 
-    // lex/parse program into rooted tree:
-    Lexer * lex = new_lexer(input);
-    Expression * program = parse_program(lex);
-    //print_expression(program, lex->symbols, 0);
+bool parse_job(char * line, Job * job)
+{
+    // Returns false if the line is not a valid job.
+    char * p = json_skip_whitespace(line);
+    if (*p++ != '{') return false;
+    p = json_skip_whitespace(p);
+    while (*p != '}') {
+        Buffer * key = new_buffer();
+        p = json_parse_string(p, key);
+        buffer_putc(key, '\0');
+        if (p == NULL) {
+            destroy_buffer(key);
+            return false;
+        }
+        p = json_skip_whitespace(p);
+        if (*p++ != ':') {
+            destroy_buffer(key);
+            return false;
+        }
+        p = json_skip_whitespace(p);
+        char * start = p;
+        Buffer * value = new_buffer();
+        char ** field = NULL;
+        if      (streq(key->data, "program")) field = &job->program;
+        else if (streq(key->data, "file"))    field = &job->file;
+        else if (streq(key->data, "stdin"))   field = &job->input;
+        if (field != NULL) {
+            p = json_parse_string(p, value);
+            if (p != NULL) {
+                free(*field);
+                *field = buffer_to_string(value);
+            }
+        } else {
+            p = json_skip_value(p);
+            if (p != NULL && streq(key->data, "id")) {
+                free(job->id);
+                job->id = new_string(p - start);
+                substring(job->id, start, 0, p - start);
+            }
+        }
+        destroy_buffer(key);
+        destroy_buffer(value);
+        if (p == NULL) return false;
+        p = json_skip_whitespace(p);
+        if (*p == ',') p = json_skip_whitespace(p + 1);
+        else if (*p != '}') return false;
+    }
+    return job->program != NULL || job->file != NULL;
+}
 
-    // Initialize Function Table:
-    ftable = new_queue(NULL);
+void run_job(Job * job, Options * opts)
+{
+    job->output = new_buffer();
+    if (job->error != NULL) return;  // (not a valid job, see run_batch())
+    char * source = job->program;
+    if (source == NULL) {
+        source = try_read_file(job->file);
+        if (source == NULL) {
+            job->status = LANG_ERROR;
+            job->error = new_string(strlen(job->file) + 32);
+            sprintf(job->error, "Error: Failed to open file %s.\n", job->file);
+            return;
+        }
+    }
+    Interp * in = lang_create();
+    if (in == NULL) {
+        job->status = LANG_ERROR;
+        job->error = clone_string("Error: Failed to create interpreter.\n");
+    } else {
+        apply_options(in, opts);
+        job->status = lang_load(in, source);
+        // (a job never reads the real stdin)
+        if (job->status == LANG_OK) job->status = lang_run(in, job->input ? job->input : "");
+        buffer_write(job->output, lang_output(in), in->output->len);
+        job->error = clone_string((char *)lang_error(in));
+        lang_destroy(in);
+    }
+    if (source != job->program) destroy_string(source);
+}
 
-    // Execute program:
-    Queue/*<Thunk>*/ * context = new_queue(NULL);
-    Thunk * thunk = new_thunk(HASH_OF_TIMES, program, context);
-    execute(thunk, lex->symbols);
+void * batch_worker(void * arg)
+{
+    Batch * b = arg;
+    while (true) {
+        pthread_mutex_lock(&b->lock);
+        Job * job = b->next < b->njobs ? b->jobs + b->next++ : NULL;
+        pthread_mutex_unlock(&b->lock);
+        if (job == NULL) break;
+
+        run_job(job, b->opts);
+
+        pthread_mutex_lock(&b->lock);
+        job->done = true;
+        pthread_cond_broadcast(&b->finished);
+        pthread_mutex_unlock(&b->lock);
+    }
+    return NULL;
+}
 
-    // clean up
-    destroy_thunk(thunk);
-    destroy_queue(context);
-    destroy_expression(program);
-    destroy_queue(ftable);
-    destroy_lexer(lex);
-    destroy_string(input);
+int run_batch(char * fname, int nthreads, Options * opts)
+{
+    char * text = read_file(fname);
+
+    // one job per (non-empty) line:
+    Batch b;
+    size_t cap = 16;
+    b.jobs = malloc(cap * sizeof(Job));
+    b.njobs = 0;
+    b.next = 0;
+    b.opts = opts;
+    int lineno = 1;
+    for (char * line = strtok(text, "\n"); line != NULL; line = strtok(NULL, "\n"), lineno++) {
+        if (*json_skip_whitespace(line) == '\0') continue;
+        if (b.njobs == cap) {
+            cap *= 2;
+            b.jobs = realloc(b.jobs, cap * sizeof(Job));
+        }
+        Job * job = b.jobs + b.njobs++;
+        memset(job, 0, sizeof(Job));
+        if (!parse_job(line, job)) {
+            // (reported as the job's result, so that the other jobs still run)
+            job->status = LANG_ERROR;
+            job->error = new_string(64);
+            sprintf(job->error, "Error: Invalid job on line %d.\n", lineno);
+        }
+        if (job->id == NULL) {
+            job->id = new_string(16);
+            sprintf(job->id, "%d", lineno);
+        }
+    }
+    destroy_string(text);
+
+    pthread_mutex_init(&b.lock, NULL);
+    pthread_cond_init(&b.finished, NULL);
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, BATCH_STACK_SIZE);
+    if (nthreads > (int)b.njobs) nthreads = b.njobs;
+    pthread_t * threads = malloc(nthreads * sizeof(pthread_t));
+    for (int i = 0; i < nthreads; i++) {
+        expect(pthread_create(threads + i, &attr, batch_worker, &b) == 0,
+                "Error: Failed to start worker thread.\n");
+    }
+
+    // report the results in order, as soon as they are available:
+    char * status_names[] = { "ok", "error", "timeout", "out_of_fuel", "out_of_memory", "stopped" };
+    for (size_t i = 0; i < b.njobs; i++) {
+        Job * job = b.jobs + i;
+        pthread_mutex_lock(&b.lock);
+        while (!job->done) pthread_cond_wait(&b.finished, &b.lock);
+        pthread_mutex_unlock(&b.lock);
+
+        Buffer * line = new_buffer();
+        buffer_write(line, "{\"id\": ", 7);
+        buffer_write(line, job->id, strlen(job->id));
+        buffer_write(line, ", \"status\": ", 12);
+        char * status = status_names[job->status];
+        json_write_string(line, status, strlen(status));
+        buffer_write(line, ", \"stdout\": ", 12);
+        json_write_string(line, job->output->data, job->output->len);
+        buffer_write(line, ", \"stderr\": ", 12);
+        json_write_string(line, job->error, strlen(job->error));
+        buffer_write(line, "}\n", 2);
+        fwrite(line->data, 1, line->len, stdout);
+        fflush(stdout);
+        destroy_buffer(line);
+
+        free(job->id);
+        free(job->program);
+        free(job->file);
+        free(job->input);
+        destroy_buffer(job->output);
+        free(job->error);
+    }
 
+    for (int i = 0; i < nthreads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    pthread_attr_destroy(&attr);
+    pthread_cond_destroy(&b.finished);
+    pthread_mutex_destroy(&b.lock);
+    free(b.jobs);
     return 0;
 }
+
+#endif
+
+
+#ifndef LANG_NO_MAIN
+int main(int argc, char * argv[])
+{
+    if (argc >= 2 && streq(argv[1], "--build-prelude")) {
+        expect(argc >= 4, "Usage: %s --build-prelude <prelude.h> <input.lang>...\n", argv[0]);
+        build_prelude(argv[2], argc - 3, argv + 3);
+        return 0;
+    }
+#ifndef __EMSCRIPTEN__
+    if (argc >= 2 && streq(argv[1], "--build-runtime")) {
+        expect(argc == 4, "Usage: %s --build-runtime <runtime.h> <runtime.c>\n", argv[0]);
+        build_runtime(argv[2], argv[3]);
+        return 0;
+    }
+#endif
+
+    Options opts = { getenv("LANG_CACHE_DIR"), 0, 0, 0, 0, 0, 0, NULL, 0, NULL };
+    bool batch = false;
+    bool stream = false;
+    char * emit_fname = NULL;
+    int nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    int argi = 1;
+    for (; argi < argc && strncmp(argv[argi], "--", 2) == 0; argi++) {
+        if (streq(argv[argi], "--cache-dir")) {
+            expect(argi + 1 < argc, "Error: Expected directory after --cache-dir.\n");
+            opts.cache_dir = argv[++argi];
+        } else if (streq(argv[argi], "--batch")) {
+            batch = true;
+        } else if (streq(argv[argi], "--stream")) {
+            stream = true;
+        } else if (streq(argv[argi], "--jobs")) {
+            expect(argi + 1 < argc && atoi(argv[argi + 1]) > 0,
+                    "Error: Expected number of threads after --jobs.\n");
+            nthreads = atoi(argv[++argi]);
+        } else if (streq(argv[argi], "--parse-threads")) {
+            expect(argi + 1 < argc && atoi(argv[argi + 1]) > 0,
+                    "Error: Expected number of threads after --parse-threads.\n");
+            opts.parse_threads = atoi(argv[++argi]);
+        } else if (streq(argv[argi], "--timeout")) {
+            expect(argi + 1 < argc && atoll(argv[argi + 1]) > 0,
+                    "Error: Expected milliseconds after --timeout.\n");
+            opts.timeout = atoll(argv[++argi]);
+        } else if (streq(argv[argi], "--emit-c")) {
+            expect(argi + 1 < argc, "Error: Expected file name after --emit-c.\n");
+            emit_fname = argv[++argi];
+        } else if (streq(argv[argi], "--cse")) {
+            opts.optimizations |= LANG_OPT_CSE;
+        } else if (streq(argv[argi], "--inline")) {
+            opts.optimizations |= LANG_OPT_INLINE;
+        } else if (streq(argv[argi], "--dce")) {
+            opts.optimizations |= LANG_OPT_DCE;
+        } else if (streq(argv[argi], "--inline-size")) {
+            expect(argi + 1 < argc && atoll(argv[argi + 1]) > 0,
+                    "Error: Expected number of expressions after --inline-size.\n");
+            opts.inline_size = atoll(argv[++argi]);
+        } else if (streq(argv[argi], "--max-steps")) {
+            expect(argi + 1 < argc && atoll(argv[argi + 1]) > 0,
+                    "Error: Expected number of steps after --max-steps.\n");
+            opts.max_steps = atoll(argv[++argi]);
+        } else if (streq(argv[argi], "--checkpoint")) {
+            expect(argi + 1 < argc, "Error: Expected file name after --checkpoint.\n");
+            opts.checkpoint = argv[++argi];
+        } else if (streq(argv[argi], "--checkpoint-every")) {
+            expect(argi + 1 < argc && atoll(argv[argi + 1]) > 0,
+                    "Error: Expected number of steps after --checkpoint-every.\n");
+            opts.checkpoint_every = atoll(argv[++argi]);
+        } else if (streq(argv[argi], "--resume")) {
+            expect(argi + 1 < argc, "Error: Expected file name after --resume.\n");
+            opts.resume = argv[++argi];
+        } else if (streq(argv[argi], "--max-heap")) {
+            expect(argi + 1 < argc && atoll(argv[argi + 1]) > 0,
+                    "Error: Expected number of bytes after --max-heap.\n");
+            opts.max_heap = atoll(argv[++argi]);
+        } else {
+            expect(false, "Error: Unknown option %s.\n", argv[argi]);
+        }
+    }
+    expect(argi < argc,
+            "Usage: %s [--cache-dir <dir>] [--parse-threads <threads>] [<limits>] [<optimizations>] [<checkpoints>] <input.lang>\n"
+            "       %s --batch [--jobs <threads>] [<limits>] [<optimizations>] <jobs.jsonl>\n"
+            "       %s --emit-c <output.c> [<optimizations>] <input.lang>\n"
+            "       %s --stream [<limits>] <input.lang>\n"
+            "Limits: --timeout <ms> --max-steps <steps> --max-heap <bytes>\n"
+            "Optimizations: --cse --inline [--inline-size <expressions>] --dce\n"
+            "Checkpoints: --checkpoint <file> [--checkpoint-every <steps>] --resume <file>\n",
+            argv[0], argv[0], argv[0], argv[0]);
+
+    // (the jobs of a batch already run in parallel)
+    if (batch && opts.parse_threads == 0) opts.parse_threads = 1;
+    expect(!batch || (opts.checkpoint == NULL && opts.resume == NULL),
+            "Error: Checkpoints are not supported with --batch.\n");
+    expect(opts.checkpoint != NULL || opts.checkpoint_every == 0,
+            "Error: Expected --checkpoint with --checkpoint-every.\n");
+    expect(!stream || (!batch && emit_fname == NULL && opts.checkpoint == NULL && opts.resume == NULL),
+            "Error: --stream can't be used with --batch, --emit-c or checkpoints.\n");
+    // (they need the whole program)
+    expect(!stream || opts.optimizations == 0,
+            "Error: Optimizations are not supported with --stream.\n");
+
+#ifndef __EMSCRIPTEN__
+    if (batch) return run_batch(argv[argi], nthreads < 1 ? 1 : nthreads, &opts);
+    if (emit_fname != NULL) return compile_program(argv[argi], emit_fname, &opts);
+#else
+    expect(!batch, "Error: --batch is not supported in this build.\n");
+    expect(emit_fname == NULL, "Error: --emit-c is not supported in this build.\n");
+#endif
+
+    if (stream) return run_stream(argv[argi], &opts) == 0 ? 0 : EXIT_FAILURE;
+
+    // Read input from file:
+    char * input = read_file(argv[argi]);
+    // (to save the position in stdin, it is read in advance)
+    char * stdin_input = NULL;
+    if (opts.checkpoint != NULL || opts.resume != NULL) stdin_input = read_file("-");
+    int status = run_program(input, stdin_input, &opts);
+    destroy_string(input);
+    free(stdin_input);
+
+    return status == 0 ? 0 : EXIT_FAILURE;
+}
+#endif
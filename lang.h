@@ -0,0 +1,117 @@
+/*
+ *   Embedding API for the interpreter.
+ *
+ *   Each interpreter holds all of its own state, and reports errors through
+ *   return values, so any number of them can live in one process. An
+ *   interpreter may only be used by one thread at a time.
+ *
+ *   by Jacob Merizian
+ *   License: MIT
+ */
+
+#ifndef LANG_H
+#define LANG_H
+
+#include <stddef.h>
+
+typedef struct Interp Interp;
+
+// The status returned by lang_load() and lang_run():
+enum {
+    LANG_OK = 0,
+    LANG_ERROR = 1,
+    LANG_TIMEOUT = 2,
+    LANG_OUT_OF_FUEL = 3,
+    LANG_OUT_OF_MEMORY = 4,
+    LANG_STOPPED = 5,  // on request, see lang_request_checkpoint()
+};
+
+// Optimization passes, applied by lang_load():
+enum {
+    LANG_OPT_CSE = 1,     // evaluate repeated pure expressions once per call
+    LANG_OPT_INLINE = 2,  // replace calls of small functions by their bodies
+    LANG_OPT_DCE = 4,     // drop unused 'let's and functions which are never called
+};
+
+typedef struct LangStats {
+    unsigned long long steps;   // evaluation steps of the last run
+    size_t heap_bytes;          // bytes of runtime objects in use (none after a run)
+    size_t peak_heap_bytes;     // the most allocated during the last run
+} LangStats;
+
+// Receives the output of a program, as it is printed.
+typedef void (*lang_write_fn)(void * data, const char * buf, size_t len);
+
+// Supplies the source of a streamed program: fills buf with up to len bytes,
+// and returns how many, or 0 at the end.
+typedef size_t (*lang_read_fn)(void * data, char * buf, size_t len);
+
+// Creates an interpreter (with the prelude loaded), or returns NULL on failure.
+Interp * lang_create(void);
+void lang_destroy(Interp * in);
+
+// Sends output to write() instead of collecting it (see lang_output()).
+void lang_set_output(Interp * in, lang_write_fn write, void * data);
+
+// Caches parsed programs in the given directory (NULL to disable).
+void lang_set_cache_dir(Interp * in, const char * dir);
+
+// Stops lang_run() with LANG_TIMEOUT after the given time (0 for no limit).
+void lang_set_timeout(Interp * in, long long ms);
+
+// Stops lang_run() with LANG_OUT_OF_FUEL after max_steps evaluation steps,
+// or with LANG_OUT_OF_MEMORY when more than max_heap bytes are in use by the
+// run (0 for no limit). Both count from zero on every run, and the loaded
+// program doesn't count.
+void lang_set_limits(Interp * in, unsigned long long max_steps, size_t max_heap);
+
+// Parses large sources on the given number of threads (0, the default, for one
+// per core).
+void lang_set_parse_threads(Interp * in, int nthreads);
+
+// Chooses the optimizations (LANG_OPT_* flags) for programs loaded next.
+void lang_set_optimizations(Interp * in, unsigned optimizations);
+
+// The largest function body (in expressions) which LANG_OPT_INLINE inlines.
+void lang_set_inline_size(Interp * in, size_t size);
+
+void lang_get_stats(Interp * in, LangStats * stats);
+
+// Saves the state of lang_run() to the file fname between top-level statements,
+// or at a function call within one, once at least every_steps steps have passed
+// since the last time (0 to only save on request), so that lang_resume() can
+// continue it. NULL to disable. (Runs are slower while it is enabled.)
+void lang_set_checkpoint(Interp * in, const char * fname, unsigned long long every_steps);
+
+// Asks the running program to save its state at its next function call (or
+// after the current top-level statement), and then to stop with LANG_STOPPED
+// if stop is non-zero.
+// May be called from a signal handler.
+void lang_request_checkpoint(Interp * in, int stop);
+
+// Parses a program, replacing the one loaded before. Returns 0 on success.
+int lang_load(Interp * in, const char * source);
+
+// Runs the loaded program from the start, with the given stdin
+// (or the real stdin, if input is NULL). Returns 0 on success.
+int lang_run(Interp * in, const char * input);
+
+// Parses and runs a program read with read(), running each top-level form as
+// soon as it has been read (instead of lang_load() and lang_run()). The
+// optimizations, cache and checkpoints need the whole program, so are not used.
+// Afterwards no program is loaded, so lang_run() fails until the next lang_load().
+// Returns 0 on success.
+int lang_run_stream(Interp * in, lang_read_fn read, void * data, const char * input);
+
+// Continues the run saved in the given checkpoint file, which must have been
+// made by the same program with the same input. Returns 0 on success.
+// (With checkpoints enabled, lang_run() also needs the input as a string.)
+int lang_resume(Interp * in, const char * fname, const char * input);
+
+// The output collected by the last run (if no output function was set).
+const char * lang_output(Interp * in);
+
+// The message of the last error, or "" if there was none.
+const char * lang_error(Interp * in);
+
+#endif
@@ -1,13 +1,93 @@
-function runCode(code, onstdout, onstderr) {
-    MyCode({
-        'print': onstdout,
-        'printErr': onstderr,
-    }).then(function (Module) {
-        Module.FS.writeFile('/input.lang', code);
-        Module.callMain(['/input.lang']);
+// The interpreter runs in a Web Worker, so long runs don't freeze the page.
+// A spare worker is kept instantiated so that the next run (or the run after
+// a stop, which terminates the busy worker) can start right away.
+var WORKER_URL = '/functional-language-demo/worker.js';
+
+// Time to first run, logged to the console: when the first worker is ready
+// (with how long it took to load the module, and whether it was cached), and
+// when the first run is done, in milliseconds since the page started loading.
+// The last visits' are kept, so loading can be compared before and after a change.
+var firstRun = { ready: null, done: null, timing: null };
+var FIRST_RUN_KEY = 'lang.firstRuns';
+var FIRST_RUN_VISITS = 20;
+
+function recordFirstRun() {
+    try {
+        var visits = JSON.parse(localStorage.getItem(FIRST_RUN_KEY) || '[]');
+        visits.push({
+            date: new Date().toISOString(),
+            build: firstRun.timing.build,
+            cached: firstRun.timing.cached,
+            load: Math.round(firstRun.timing.load),
+            ready: Math.round(firstRun.ready),
+            done: Math.round(firstRun.done),
+        });
+        visits = visits.slice(-FIRST_RUN_VISITS);
+        localStorage.setItem(FIRST_RUN_KEY, JSON.stringify(visits));
+        console.table(visits);
+    } catch (e) {}  // (no storage)
+}
+
+function LangWorker() {
+    var self = this;
+    this.worker = new Worker(WORKER_URL);
+    this.ready = new Promise(function (resolve) {
+        self.worker.onmessage = function (e) {
+            if (e.data.type !== 'ready') return;
+            if (firstRun.ready === null) {
+                firstRun.ready = performance.now();
+                firstRun.timing = e.data.timing;
+                console.log('lang: ready after ' + Math.round(firstRun.ready) + ' ms ' +
+                            '(module loaded in ' + Math.round(e.data.timing.load) + ' ms, ' +
+                            (e.data.timing.cached ? 'cached' : 'compiled') + ')');
+            }
+            resolve(self);
+        };
+    });
+}
+
+var idleWorker = new LangWorker();
+var spareWorker = new LangWorker();
+var busyWorker = null;
+
+function runCode(code, onstdout, onstderr, ondone) {
+    if (busyWorker !== null) stopCode();
+    var lw = idleWorker;
+    idleWorker = null;
+    busyWorker = lw;
+    lw.ready.then(function () {
+        if (busyWorker !== lw) return;  // stopped before it started
+        lw.worker.onmessage = function (e) {
+            if (e.data.type === 'output') {
+                e.data.chunks.forEach(function (chunk) {
+                    (chunk.stream === 'stdout' ? onstdout : onstderr)(chunk.text);
+                });
+            } else if (e.data.type === 'done') {
+                if (firstRun.done === null) {
+                    firstRun.done = performance.now();
+                    console.log('lang: first run done after ' + Math.round(firstRun.done) + ' ms');
+                    recordFirstRun();
+                }
+                busyWorker = null;
+                idleWorker = lw;
+                ondone(e.data.status);
+            }
+        };
+        lw.worker.postMessage({ code: code });
     });
 }
 
+function stopCode() {
+    // A synchronous run can't be interrupted from outside, so the worker is
+    // dropped and the spare takes its place.
+    if (busyWorker === null) return false;
+    busyWorker.worker.terminate();
+    busyWorker = null;
+    idleWorker = spareWorker;
+    spareWorker = new LangWorker();
+    return true;
+}
+
 function appendStdout(text) {
     var div = $("<div>", {"class": "stdout-msg"});
     div.html(text);
@@ -24,7 +104,21 @@ function clearResults() {
     $('#result').empty();
 }
 
+function setRunning(running) {
+    $('#run').prop('disabled', running);
+    $('#stop').prop('disabled', !running);
+}
+
+function run(cm) {
+    clearResults();
+    setRunning(true);
+    runCode(cm.getValue(), appendStdout, appendStderr, function () {
+        setRunning(false);
+    });
+}
+
 $('#vim-on').hide();
+setRunning(false);
 
 $(document).ready(function () {
     var elem = document.getElementById('cm');
@@ -52,22 +146,21 @@ $(document).ready(function () {
         keyMap: 'sublime',
         extraKeys: {
             'Ctrl-Enter': function () {
-                var code = cm.getValue();
-                clearResults();
-                runCode(code, appendStdout, appendStderr);
+                run(cm);
             },
             'Cmd-Enter': function () {
-                var code = cm.getValue();
-                clearResults();
-                runCode(code, appendStdout, appendStderr);
+                run(cm);
             }
         }
     });
 
     $('#run').on('click', function () {
-        var code = cm.getValue();
-        clearResults();
-        runCode(code, appendStdout, appendStderr);
+        run(cm);
+    });
+
+    $('#stop').on('click', function () {
+        if (stopCode()) appendStderr('Stopped.');
+        setRunning(false);
     });
 
     $('#vim-off').on('click', function () {
@@ -4,19 +4,36 @@ import sys
 import subprocess
 import shlex
 import time
+import json
+import tempfile
 
 TEST_DIR = './tests/'
 BINARY = './lang'
 MAX_DIFF_LENGTH = 50
 TIME_LIMIT = 2
+LANG_FLAGS = []  # passed on to the interpreter (e.g. optimizations)
+CC = os.environ.get('CC', 'gcc')
 
 def run_test(name):
     code_fname = os.path.join(TEST_DIR, name+'.lang')
     in_fname   = os.path.join(TEST_DIR, name+'.in')
     out_fname  = os.path.join(TEST_DIR, name+'.out')
 
+    command = [BINARY] + LANG_FLAGS + [code_fname]
+    if EMIT_C:
+        command = compile_test(name, code_fname)
+        if command is None:
+            return False
+    if os.path.exists(os.path.join(TEST_DIR, name+'.c')):
+        command = compile_api_test(name)
+        if command is None:
+            return False
+    if os.path.exists(os.path.join(TEST_DIR, name+'.jsonl')):
+        # (the output is the batch's, one JSON line per job)
+        command = [BINARY, '--batch', os.path.join(TEST_DIR, name+'.jsonl')]
+
     inp = open(in_fname)
-    p = subprocess.Popen([BINARY, code_fname], universal_newlines=True,
+    p = subprocess.Popen(command, universal_newlines=True,
             stdin=inp, stdout=subprocess.PIPE)
     st = time.time()
     tle = False
@@ -54,18 +71,93 @@ def run_test(name):
     return True
 
 
-if len(sys.argv) > 1:
-    name = sys.argv[1]
+def compile_test(name, code_fname):
+    # Compiles a test with `lang --emit-c`, and returns the command to run it.
+    c_fname = os.path.join(BUILD_DIR, name.replace('/', '_') + '.c')
+    exe_fname = c_fname[:-2]
+    if subprocess.run([BINARY, '--emit-c', c_fname] + LANG_FLAGS + [code_fname]).returncode != 0 or \
+            subprocess.run([CC, '-O1', '-pthread', c_fname, '-o', exe_fname]).returncode != 0:
+        print('[RUNNER] Test "{}" Failed!'.format(name), 'Could not compile to C!')
+        return None
+    return [exe_fname]
+
+
+def compile_api_test(name):
+    # Compiles a test of the embedding API (a C program using lang.h) with the
+    # interpreter, and returns the command to run it.
+    exe_fname = os.path.join(BUILD_DIR, name.replace('/', '_'))
+    if subprocess.run([CC, '-O1', '-DLANG_NO_MAIN', '-pthread', '-I.', 'lang.c',
+            os.path.join(TEST_DIR, name+'.c'), '-o', exe_fname]).returncode != 0:
+        print('[RUNNER] Test "{}" Failed!'.format(name), 'Could not compile!')
+        return None
+    return [exe_fname]
+
+
+def run_tests_batch(names):
+    # Runs all tests in one process, with `lang --batch`.
+    jobs = ''
+    for name in names:
+        code_fname = os.path.join(TEST_DIR, name+'.lang')
+        in_fname   = os.path.join(TEST_DIR, name+'.in')
+        with open(in_fname) as f:
+            jobs += json.dumps({'id': name, 'file': code_fname, 'stdin': f.read()}) + '\n'
+    p = subprocess.run([BINARY, '--batch', '--timeout', str(TIME_LIMIT * 1000)] + LANG_FLAGS + ['-'],
+            input=jobs, universal_newlines=True, stdout=subprocess.PIPE)
+
+    results = []
+    for line in p.stdout.splitlines():
+        res = json.loads(line)
+        name = res['id']
+        with open(os.path.join(TEST_DIR, name+'.out')) as f:
+            exp = f.read()
+        if res['status'] == 'timeout':
+            print('[RUNNER] Test "{}" Failed!'.format(name), 'Time Limit Exceeded!')
+            results.append(False)
+        elif res['status'] != 'ok':
+            print('[RUNNER] Test "{}" Failed!'.format(name), 'Got an error!')
+            results.append(False)
+        elif res['stdout'] != exp:
+            print('[RUNNER] Test "{}" Failed!'.format(name), 'Wrong Answer!')
+            results.append(False)
+        else:
+            results.append(True)
+    return results
+
+
+args = sys.argv[1:]
+batch = '--batch' in args
+if batch:
+    args.remove('--batch')
+EMIT_C = '--emit-c' in args
+if EMIT_C:
+    # Compile each test to a native executable, and check it instead:
+    args.remove('--emit-c')
+BUILD_DIR = tempfile.mkdtemp(prefix='lang_tests_')
+LANG_FLAGS = [arg for arg in args if arg.startswith('--')]
+args = [arg for arg in args if not arg.startswith('--')]
+
+if len(args) > 0:
+    name = args[0]
     if run_test(name):
         print('Test "{}" passed!'.format(name))
 
 else:
     tests = []
+    api_tests = []  # (of the API and of batch mode, which don't depend on how the interpreter is run)
     for types in os.listdir(TEST_DIR):
         for fname in os.listdir(os.path.join(TEST_DIR, types)):
             if fname.endswith('.lang'):
                 tests.append(os.path.join(types, fname[:-5]))
+            elif fname.endswith('.c') and not batch and not EMIT_C and len(LANG_FLAGS) == 0:
+                api_tests.append(os.path.join(types, fname[:-2]))
+            elif fname.endswith('.jsonl') and not batch and not EMIT_C and len(LANG_FLAGS) == 0:
+                api_tests.append(os.path.join(types, fname[:-6]))
 
-    results = [run_test(test) for test in tests]
+    if batch:
+        results = run_tests_batch(tests)
+    else:
+        results = [run_test(test) for test in tests]
+    results += [run_test(test) for test in api_tests]
+    tests += api_tests
     tot = sum(1 if x else 0 for x in results)
     print('Passed {}/{} tests.'.format(tot, len(tests)))
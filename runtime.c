@@ -0,0 +1,743 @@
+/*
+ *   Runtime for programs compiled to C by `lang --emit-c`.
+ *
+ *   The compiler embeds this file at the top of its output, so a compiled
+ *   program is a single C file with no other dependencies:
+ *
+ *     ./lang --emit-c prog.c prog.lang && gcc -O2 -pthread prog.c -o prog
+ *
+ *   Values are small structs passed by value. Lazy expressions (function
+ *   arguments, 'let' bindings and list items) are Thunks, which run their
+ *   code once, when first forced. Memory is never freed, as in the
+ *   interpreter, so this suits programs that run and exit. Numbers are
+ *   long longs, and become big numbers where the interpreter's would.
+ *
+ *   by Jacob Merizian
+ *   License: MIT
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <pthread.h>
+
+// (in the same order as the interpreter's PrimitiveType)
+enum {
+    T_ANY = 0,
+    T_TRUE = 1,
+    T_FALSE = 2,
+    T_NULL = 3,
+    T_NUMBER = 4,
+    T_STRING = 5,
+    T_CHAR = 6,
+    T_LIST = 7,
+};
+
+struct Thunk;
+struct RtBig;
+
+struct Value {
+    int type;
+    long long num;         // numbers and chars
+    size_t len;            // strings and lists
+    union {
+        const char * str;
+        struct RtBig * big;  // numbers which don't fit in num (or NULL)
+    };
+    struct Thunk * items;
+} typedef Value;
+
+struct Thunk {
+    bool forced;
+    Value val;
+    Value (*code)(struct Thunk * self);
+    struct Thunk ** env;   // the names the code refers to
+} typedef Thunk;
+
+struct RtFunction {
+    Value (*fn)(Thunk ** args);  // NULL until defined
+    int arity;
+    bool prelude;                // may be replaced by the program
+    const char * name;
+} typedef RtFunction;
+
+static const Value RT_NULL  __attribute__((unused)) = { T_NULL, 0, 0, { NULL }, NULL };
+static const Value RT_ANY   __attribute__((unused)) = { T_ANY, 1, 0, { NULL }, NULL };
+static const Value RT_TRUE  __attribute__((unused)) = { T_TRUE, 1, 0, { NULL }, NULL };
+static const Value RT_FALSE __attribute__((unused)) = { T_FALSE, 0, 0, { NULL }, NULL };
+
+/*******************
+ *     MEMORY      *
+ *******************/
+
+#define RT_CHUNK_SIZE (1024 * 1024)
+
+static char * rt_chunk = NULL;
+static size_t rt_chunk_left = 0;
+
+static inline void * rt_alloc(size_t size)
+{
+    size = (size + 15) & ~(size_t)15;
+    if (size > rt_chunk_left) {
+        size_t csize = size > RT_CHUNK_SIZE ? size : RT_CHUNK_SIZE;
+        rt_chunk = malloc(csize);
+        if (rt_chunk == NULL) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            exit(EXIT_FAILURE);
+        }
+        rt_chunk_left = csize;
+    }
+    void * p = rt_chunk;
+    rt_chunk += size;
+    rt_chunk_left -= size;
+    return p;
+}
+
+/*******************
+ *     ERRORS      *
+ *******************/
+
+static inline Value rt_fail(const char * fmt, ...) __attribute__((noreturn));
+
+static inline Value rt_fail(const char * fmt, ...)
+{
+    fflush(stdout);
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+    exit(EXIT_FAILURE);
+}
+
+/*******************
+ *     BIGNUMS     *
+ *******************/
+
+/*
+ * As in the interpreter: a number only becomes an RtBig when it doesn't fit
+ * in a long long. Its limbs are in base 10^9, least significant first.
+ * Multiplication switches to Karatsuba's algorithm for long operands, and
+ * division is Knuth's algorithm D.
+ */
+#define RT_BIG_BASE   1000000000U
+#define RT_BIG_DIGITS 9   // decimal digits per limb
+#define RT_KARATSUBA_MIN 32  // limbs of the shorter operand
+
+struct RtBig {
+    bool negative;
+    size_t len;  // the most significant limb is not 0
+    uint32_t limbs[];
+} typedef RtBig;
+
+static inline RtBig * rt_new_big(size_t len)
+{
+    RtBig * b = rt_alloc(sizeof(RtBig) + len * sizeof(uint32_t));
+    b->negative = false;
+    b->len = len;
+    memset(b->limbs, 0, len * sizeof(uint32_t));
+    return b;
+}
+
+static inline size_t rt_mag_trim(const uint32_t * a, size_t len)
+{
+    while (len > 0 && a[len - 1] == 0) len--;
+    return len;
+}
+
+static inline int rt_mag_cmp(const uint32_t * a, size_t alen, const uint32_t * b, size_t blen)
+{
+    alen = rt_mag_trim(a, alen);
+    blen = rt_mag_trim(b, blen);
+    if (alen != blen) return alen < blen ? -1 : 1;
+    for (size_t i = alen; i-- > 0;) {
+        if (a[i] != b[i]) return a[i] < b[i] ? -1 : 1;
+    }
+    return 0;
+}
+
+static inline uint32_t rt_mag_add_into(uint32_t * r, size_t rlen, const uint32_t * a, size_t alen)
+{
+    // r += a (with alen <= rlen), returning the carry out of r.
+    uint32_t carry = 0;
+    size_t i = 0;
+    for (; i < alen; i++) {
+        uint32_t s = r[i] + a[i] + carry;
+        carry = s >= RT_BIG_BASE;
+        r[i] = carry ? s - RT_BIG_BASE : s;
+    }
+    for (; carry && i < rlen; i++) {
+        carry = r[i] == RT_BIG_BASE - 1;
+        r[i] = carry ? 0 : r[i] + 1;
+    }
+    return carry;
+}
+
+static inline uint32_t rt_mag_sub_from(uint32_t * r, size_t rlen, const uint32_t * a, size_t alen)
+{
+    // r -= a (with alen <= rlen), returning the borrow out of r.
+    uint32_t borrow = 0;
+    size_t i = 0;
+    for (; i < alen; i++) {
+        uint32_t sub = a[i] + borrow;
+        borrow = r[i] < sub;
+        r[i] = borrow ? r[i] + RT_BIG_BASE - sub : r[i] - sub;
+    }
+    for (; borrow && i < rlen; i++) {
+        borrow = r[i] == 0;
+        r[i] = borrow ? RT_BIG_BASE - 1 : r[i] - 1;
+    }
+    return borrow;
+}
+
+static inline void rt_mag_mul_small(uint32_t * r, const uint32_t * a, size_t alen, uint32_t m)
+{
+    // r = a * m, where r has room for alen + 1 limbs.
+    uint64_t carry = 0;
+    for (size_t i = 0; i < alen; i++) {
+        uint64_t t = (uint64_t)a[i] * m + carry;
+        r[i] = t % RT_BIG_BASE;
+        carry = t / RT_BIG_BASE;
+    }
+    r[alen] = carry;
+}
+
+static inline uint32_t rt_mag_div_small(uint32_t * q, const uint32_t * a, size_t alen, uint32_t d)
+{
+    // q = a / d (q may be a), returning a % d.
+    uint64_t rem = 0;
+    for (size_t i = alen; i-- > 0;) {
+        uint64_t cur = rem * RT_BIG_BASE + a[i];
+        q[i] = cur / d;
+        rem = cur % d;
+    }
+    return rem;
+}
+
+static inline void rt_mag_mul_school(uint32_t * r, const uint32_t * a, size_t alen,
+        const uint32_t * b, size_t blen)
+{
+    memset(r, 0, (alen + blen) * sizeof(uint32_t));
+    for (size_t i = 0; i < alen; i++) {
+        uint64_t ai = a[i], carry = 0;
+        if (ai == 0) continue;
+        for (size_t j = 0; j < blen; j++) {
+            uint64_t t = ai * b[j] + r[i + j] + carry;
+            r[i + j] = t % RT_BIG_BASE;
+            carry = t / RT_BIG_BASE;
+        }
+        r[i + blen] = carry;
+    }
+}
+
+static inline void rt_mag_mul(uint32_t * r, const uint32_t * a, size_t alen, const uint32_t * b, size_t blen)
+{
+    // r = a * b, where r has room for alen + blen limbs (the operands needn't be trimmed).
+    if (alen < blen) {
+        const uint32_t * t = a; a = b; b = t;
+        size_t tlen = alen; alen = blen; blen = tlen;
+    }
+    if (blen < RT_KARATSUBA_MIN) {
+        rt_mag_mul_school(r, a, alen, b, blen);
+        return;
+    }
+    if (alen >= 2 * blen) {
+        // lopsided, so multiply b by slices of a as long as b:
+        memset(r, 0, (alen + blen) * sizeof(uint32_t));
+        uint32_t * t = malloc(2 * blen * sizeof(uint32_t));
+        for (size_t i = 0; i < alen; i += blen) {
+            size_t n = alen - i < blen ? alen - i : blen;
+            rt_mag_mul(t, a + i, n, b, blen);
+            rt_mag_add_into(r + i, alen + blen - i, t, n + blen);
+        }
+        free(t);
+        return;
+    }
+    // a = a1 B^m + a0 and b = b1 B^m + b0, so a b = z2 B^2m + z1 B^m + z0,
+    // with z1 = (a1 + a0)(b1 + b0) - z2 - z0:
+    size_t m = alen / 2, a1len = alen - m, b1len = blen - m;
+    size_t salen = a1len + 1, sblen = (b1len > m ? b1len : m) + 1;
+    rt_mag_mul(r, a, m, b, m);
+    rt_mag_mul(r + 2 * m, a + m, a1len, b + m, b1len);
+    uint32_t * sa = calloc(2 * (salen + sblen), sizeof(uint32_t));
+    uint32_t * sb = sa + salen, * z1 = sb + sblen;
+    memcpy(sa, a + m, a1len * sizeof(uint32_t));
+    rt_mag_add_into(sa, salen, a, m);
+    memcpy(sb, b, m * sizeof(uint32_t));
+    rt_mag_add_into(sb, sblen, b + m, b1len);
+    rt_mag_mul(z1, sa, salen, sb, sblen);
+    rt_mag_sub_from(z1, salen + sblen, r, 2 * m);
+    rt_mag_sub_from(z1, salen + sblen, r + 2 * m, a1len + b1len);
+    rt_mag_add_into(r + m, alen + blen - m, z1, rt_mag_trim(z1, salen + sblen));
+    free(sa);
+}
+
+static inline void rt_mag_divmod(uint32_t * q, uint32_t * rem, const uint32_t * a, size_t alen,
+        const uint32_t * b, size_t blen)
+{
+    // q = a / b and rem = a % b, where b is trimmed, has at least 2 limbs,
+    // and alen >= blen (see mag_divmod() in lang.c).
+    uint32_t d = RT_BIG_BASE / (b[blen - 1] + 1);
+    uint32_t * u = malloc((alen + 1 + blen + 1) * sizeof(uint32_t));
+    uint32_t * v = u + alen + 1;
+    rt_mag_mul_small(u, a, alen, d);
+    rt_mag_mul_small(v, b, blen, d);
+    uint64_t vtop = v[blen - 1], vnext = v[blen - 2];
+    for (size_t j = alen - blen + 1; j-- > 0;) {
+        uint64_t num = (uint64_t)u[j + blen] * RT_BIG_BASE + u[j + blen - 1];
+        uint64_t qhat = num / vtop, rhat = num % vtop;
+        while (qhat >= RT_BIG_BASE || qhat * vnext > rhat * RT_BIG_BASE + u[j + blen - 2]) {
+            qhat--;
+            rhat += vtop;
+            if (rhat >= RT_BIG_BASE) break;
+        }
+        uint64_t carry = 0;
+        int64_t borrow = 0;
+        for (size_t i = 0; i < blen; i++) {
+            uint64_t p = qhat * v[i] + carry;
+            carry = p / RT_BIG_BASE;
+            int64_t t = (int64_t)u[i + j] - (int64_t)(p % RT_BIG_BASE) - borrow;
+            borrow = t < 0;
+            u[i + j] = t < 0 ? t + RT_BIG_BASE : t;
+        }
+        int64_t top = (int64_t)u[j + blen] - (int64_t)carry - borrow;
+        if (top < 0) {
+            qhat--;
+            rt_mag_add_into(u + j, blen, v, blen);
+        }
+        u[j + blen] = 0;
+        q[j] = qhat;
+    }
+    rt_mag_div_small(rem, u, blen, d);
+    free(u);
+}
+
+struct RtNumView {
+    bool negative;
+    size_t len;
+    const uint32_t * limbs;
+    uint32_t small[3];  // (a long long fits in 3 limbs)
+} typedef RtNumView;
+
+static inline void rt_num_view(RtNumView * v, const Value * x)
+{
+    if (x->big != NULL) {
+        v->negative = x->big->negative;
+        v->len = x->big->len;
+        v->limbs = x->big->limbs;
+        return;
+    }
+    v->negative = x->num < 0;
+    unsigned long long mag = x->num < 0 ? -(unsigned long long)x->num : (unsigned long long)x->num;
+    v->len = 0;
+    while (mag != 0) {
+        v->small[v->len++] = mag % RT_BIG_BASE;
+        mag /= RT_BIG_BASE;
+    }
+    v->limbs = v->small;
+}
+
+static inline Value rt_big_value(RtBig * b)
+{
+    // A number of b, which is a long long if it fits.
+    b->len = rt_mag_trim(b->limbs, b->len);
+    if (b->len == 0) b->negative = false;
+    Value v = { T_NUMBER, 0, 0, { NULL }, NULL };
+    unsigned long long mag = 0;
+    bool fits = b->len <= 3;
+    for (size_t i = b->len; fits && i-- > 0;) {
+        if (mag > (ULLONG_MAX - b->limbs[i]) / RT_BIG_BASE) fits = false;
+        else mag = mag * RT_BIG_BASE + b->limbs[i];
+    }
+    if (fits && !b->negative && mag <= LLONG_MAX) {
+        v.num = mag;
+    } else if (fits && b->negative && mag <= (unsigned long long)LLONG_MAX + 1) {
+        v.num = mag == (unsigned long long)LLONG_MAX + 1 ? LLONG_MIN : -(long long)mag;
+    } else {
+        v.big = b;
+    }
+    return v;
+}
+
+static inline Value rt_big_add(RtNumView * a, RtNumView * b, bool negate_b)
+{
+    bool bneg = b->negative != negate_b;
+    if (a->negative == bneg) {
+        size_t len = (a->len > b->len ? a->len : b->len) + 1;
+        RtBig * r = rt_new_big(len);
+        memcpy(r->limbs, a->limbs, a->len * sizeof(uint32_t));
+        rt_mag_add_into(r->limbs, len, b->limbs, b->len);
+        r->negative = a->negative;
+        return rt_big_value(r);
+    }
+    // (subtract the smaller magnitude from the larger)
+    bool a_larger = rt_mag_cmp(a->limbs, a->len, b->limbs, b->len) >= 0;
+    RtNumView * x = a_larger ? a : b, * y = a_larger ? b : a;
+    RtBig * r = rt_new_big(x->len);
+    memcpy(r->limbs, x->limbs, x->len * sizeof(uint32_t));
+    rt_mag_sub_from(r->limbs, x->len, y->limbs, y->len);
+    r->negative = a_larger ? a->negative : bneg;
+    return rt_big_value(r);
+}
+
+static inline Value rt_big_divmod(RtNumView * a, RtNumView * b, bool want_rem)
+{
+    // Truncates towards 0, like C: the remainder has the sign of a.
+    if (b->len == 0) rt_fail("Error: Division by zero.\n");
+    RtBig * q, * rem;
+    if (rt_mag_cmp(a->limbs, a->len, b->limbs, b->len) < 0) {
+        q = rt_new_big(0);
+        rem = rt_new_big(a->len);
+        memcpy(rem->limbs, a->limbs, a->len * sizeof(uint32_t));
+    } else if (b->len == 1) {
+        q = rt_new_big(a->len);
+        rem = rt_new_big(1);
+        rem->limbs[0] = rt_mag_div_small(q->limbs, a->limbs, a->len, b->limbs[0]);
+    } else {
+        q = rt_new_big(a->len - b->len + 1);
+        rem = rt_new_big(b->len);
+        rt_mag_divmod(q->limbs, rem->limbs, a->limbs, a->len, b->limbs, b->len);
+    }
+    q->negative = a->negative != b->negative;
+    rem->negative = a->negative;
+    return rt_big_value(want_rem ? rem : q);
+}
+
+static inline Value rt_big_arith(char op, Value a, Value b)
+{
+    // Arithmetic whose result (or operands) don't fit in a long long.
+    RtNumView x, y;
+    rt_num_view(&x, &a);
+    rt_num_view(&y, &b);
+    switch (op) {
+    case '+': return rt_big_add(&x, &y, false);
+    case '-': return rt_big_add(&x, &y, true);
+    case '*': {
+        RtBig * r = rt_new_big(x.len + y.len);
+        if (x.len != 0 && y.len != 0) rt_mag_mul(r->limbs, x.limbs, x.len, y.limbs, y.len);
+        r->negative = x.negative != y.negative;
+        return rt_big_value(r);
+    }
+    case '/': return rt_big_divmod(&x, &y, false);
+    case '%': return rt_big_divmod(&x, &y, true);
+    }
+    return rt_big_value(rt_new_big(0));
+}
+
+static inline Value rt_big_parse(const char * digits, size_t len, bool negative)
+{
+    // From decimal digits (without a sign).
+    while (len > 1 && digits[0] == '0') {
+        digits++;
+        len--;
+    }
+    RtBig * b = rt_new_big((len + RT_BIG_DIGITS - 1) / RT_BIG_DIGITS);
+    for (size_t i = 0; i < b->len; i++) {
+        // limb i holds the digits [end - 9, end)
+        size_t end = len - i * RT_BIG_DIGITS;
+        size_t start = end > RT_BIG_DIGITS ? end - RT_BIG_DIGITS : 0;
+        uint32_t limb = 0;
+        for (size_t j = start; j < end; j++) limb = limb * 10 + (digits[j] - '0');
+        b->limbs[i] = limb;
+    }
+    b->negative = negative;
+    return rt_big_value(b);
+}
+
+static inline bool rt_big_equal(RtBig * a, RtBig * b)
+{
+    return a->negative == b->negative && a->len == b->len &&
+           memcmp(a->limbs, b->limbs, a->len * sizeof(uint32_t)) == 0;
+}
+
+static inline void rt_print_big(RtBig * b)
+{
+    if (b->negative) putchar('-');
+    printf("%u", b->limbs[b->len - 1]);
+    for (size_t i = b->len - 1; i-- > 0;) {
+        printf("%09u", b->limbs[i]);
+    }
+}
+
+/*******************
+ *     VALUES      *
+ *******************/
+
+static inline Value rt_number(long long num)
+{
+    Value v = { T_NUMBER, num, 0, { NULL }, NULL };
+    return v;
+}
+
+static inline Value rt_arith(char op, Value a, Value b)
+{
+    long long r = 0;
+    bool overflow = a.big != NULL || b.big != NULL;
+    if (!overflow) {
+        switch (op) {
+        case '+': overflow = __builtin_add_overflow(a.num, b.num, &r); break;
+        case '-': overflow = __builtin_sub_overflow(a.num, b.num, &r); break;
+        case '*': overflow = __builtin_mul_overflow(a.num, b.num, &r); break;
+        case '/': case '%':
+            if (b.num == 0) rt_fail("Error: Division by zero.\n");
+            overflow = a.num == LLONG_MIN && b.num == -1;
+            if (!overflow) r = op == '/' ? a.num / b.num : a.num % b.num;
+            break;
+        }
+    }
+    if (overflow) return rt_big_arith(op, a, b);
+    return rt_number(r);
+}
+
+static inline Value rt_char(long long c)
+{
+    Value v = { T_CHAR, c, 0, { NULL }, NULL };
+    return v;
+}
+
+static inline Value rt_string(const char * str, size_t len)
+{
+    Value v = { T_STRING, 1, len, { str }, NULL };
+    return v;
+}
+
+static inline Value rt_list(Thunk * items, size_t len)
+{
+    Value v = { T_LIST, 0, len, { NULL }, items };
+    return v;
+}
+
+static inline Value rt_bool(bool b)
+{
+    return b ? RT_TRUE : RT_FALSE;
+}
+
+static inline Value rt_force(Thunk * t)
+{
+    if (!t->forced) {
+        t->val = t->code(t);
+        t->forced = true;
+    }
+    return t->val;
+}
+
+static inline Value rt_alias(Thunk * self)
+{
+    // the code of a thunk which stands for another one
+    return rt_force(self->env[0]);
+}
+
+static inline void rt_deep_force(Value v)
+{
+    // Evaluate every item of a list (recursively).
+    if (v.type != T_LIST) return;
+    for (size_t i = 0; i < v.len; i++) {
+        rt_deep_force(rt_force(v.items + i));
+    }
+}
+
+static inline bool rt_equal(Value a, Value b)
+{
+    if (a.type == T_ANY || b.type == T_ANY) return true;
+    if (a.type != b.type) return false;
+    switch (a.type) {
+    case T_TRUE: case T_FALSE: case T_NULL:
+        return true;
+    case T_STRING:
+        return a.len == b.len && (a.str == b.str || memcmp(a.str, b.str, a.len) == 0);
+    case T_NUMBER:
+        if (a.big != NULL || b.big != NULL) {
+            return a.big != NULL && b.big != NULL && rt_big_equal(a.big, b.big);
+        }
+        return a.num == b.num;
+    case T_CHAR:
+        return a.num == b.num;
+    case T_LIST:
+        if (a.len != b.len) return false;
+        if (a.items == b.items) return true;
+        for (size_t i = 0; i < a.len; i++) {
+            if (!rt_equal(a.items[i].val, b.items[i].val)) return false;
+        }
+        return true;
+    }
+    return false;
+}
+
+static inline bool rt_truthy(Value v)
+{
+    switch (v.type) {
+    case T_ANY: case T_TRUE:             return true;
+    case T_FALSE: case T_NULL:           return false;
+    case T_STRING:                       return true;
+    case T_NUMBER:                       return v.num != 0 || v.big != NULL;
+    case T_CHAR:                         return v.num != 0;
+    case T_LIST:                         return v.len != 0;
+    }
+    return false;
+}
+
+/*******************
+ *    BUILTINS     *
+ *******************/
+
+static inline void rt_print_value(Value v)
+{
+    switch (v.type) {
+    case T_ANY:    fputs("ANY", stdout); break;
+    case T_TRUE:   fputs("TRUE", stdout); break;
+    case T_FALSE:  fputs("FALSE", stdout); break;
+    case T_NULL:   fputs("NULL", stdout); break;
+    case T_STRING: fwrite(v.str, 1, v.len, stdout); break;
+    case T_NUMBER:
+        if (v.big != NULL) rt_print_big(v.big);
+        else printf("%lld", v.num);
+        break;
+    case T_CHAR:   printf("%c", (char)v.num); break;
+    case T_LIST:
+        putchar('[');
+        for (size_t i = 0; i < v.len; i++) {
+            if (i != 0) putchar(' ');
+            rt_print_value(v.items[i].val);
+        }
+        putchar(']');
+        break;
+    }
+}
+
+static inline Value rt_print(Value v)
+{
+    rt_deep_force(v);
+    rt_print_value(v);
+    putchar('\n');
+    return RT_NULL;
+}
+
+static inline Value rt_read_int(void)
+{
+    // Like scanf(" %lld"), but of any size.
+    int c = getchar();
+    while (c != EOF && isspace(c)) c = getchar();
+    bool negative = c == '-';
+    if (c == '-' || c == '+') c = getchar();
+    size_t len = 0, cap = 32;
+    char * digits = malloc(cap);
+    while (c != EOF && isdigit(c)) {
+        if (len == cap) digits = realloc(digits, cap *= 2);
+        digits[len++] = c;
+        c = getchar();
+    }
+    if (c != EOF) ungetc(c, stdin);
+    if (len == 0) rt_fail("Error: read_int reached end of file.\n");
+    long long num = 0;
+    for (size_t i = 0; i < len && len < 19; i++) num = num * 10 + (digits[i] - '0');
+    Value v = len < 19 ? rt_number(negative ? -num : num) : rt_big_parse(digits, len, negative);
+    free(digits);
+    return v;
+}
+
+static inline Value rt_read_char(void)
+{
+    char c;
+    if (scanf(" %c", &c) != 1) rt_fail("Error: read_char reached end of file.\n");
+    return rt_char(c);
+}
+
+static inline Value rt_get(Value s, Value i)
+{
+    if (s.type != T_STRING && s.type != T_LIST) {
+        rt_fail("Error: Expected parameter 1 of 'get' to be a string or list.\n");
+    }
+    if (i.type != T_NUMBER) rt_fail("Error: Expected parameter 2 of 'get' to be a number.\n");
+    if (i.big != NULL || i.num < 0 || (size_t)i.num >= s.len) return RT_NULL;
+    if (s.type == T_STRING) return rt_char((unsigned char)s.str[i.num]);
+    return rt_force(s.items + i.num);
+}
+
+static inline Value rt_at(Value s, Value i)
+{
+    if (s.type != T_STRING && s.type != T_LIST) {
+        rt_fail("Error: Expected parameter 1 of '@' to be a string or list.\n");
+    }
+    if (i.type != T_NUMBER || i.big != NULL || (i.num != 1 && i.num != 2)) {
+        rt_fail("Error: Expected parameter 2 of '@' to be 1 or 2.\n");
+    }
+    if (s.len == 0) return RT_NULL;
+    if (s.type == T_STRING) {
+        if (i.num == 1) return rt_char((unsigned char)s.str[0]);
+        return rt_string(s.str + 1, s.len - 1);
+    }
+    if (i.num == 1) return rt_force(s.items);
+    return rt_list(s.items + 1, s.len - 1);
+}
+
+static inline Value rt_len(Value s)
+{
+    if (s.type != T_STRING && s.type != T_LIST) {
+        rt_fail("Error: Expected parameter of 'len' to be a string or list.\n");
+    }
+    return rt_number(s.len);
+}
+
+/*******************
+ *    FUNCTIONS    *
+ *******************/
+
+static inline void rt_define(RtFunction * f, Value (*fn)(Thunk **), int arity)
+{
+    if (f->fn != NULL && !f->prelude) {
+        rt_fail("Error: function '%s' redeclaration not allowed!\n", f->name);
+    }
+    f->fn = fn;
+    f->arity = arity;
+    f->prelude = false;
+}
+
+static inline Value rt_call(RtFunction * f, int nargs, Thunk ** args)
+{
+    if (f->fn == NULL) rt_fail("Error: Couldn't find function named %s!\n", f->name);
+    if (f->arity != nargs) {
+        rt_fail("Error: Expected %d parameters for function %s, but got %d.\n",
+                f->arity, f->name, nargs);
+    }
+    // (the arguments of a function which may return a list are allocated,
+    // since its items may still refer to them)
+    return f->fn(args);
+}
+
+/*******************
+ *      MAIN       *
+ *******************/
+
+static void rt_program(void);
+
+static void * rt_main_thread(void * arg)
+{
+    (void)arg;
+    rt_program();
+    return NULL;
+}
+
+int main(void)
+{
+    // Deep recursion needs a deep stack, so the program runs on its own thread:
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, (size_t)256 * 1024 * 1024);
+    pthread_t thread;
+    if (pthread_create(&thread, &attr, rt_main_thread, NULL) != 0) {
+        rt_main_thread(NULL);
+    } else {
+        pthread_join(thread, NULL);
+    }
+    pthread_attr_destroy(&attr);
+    fflush(stdout);
+    return 0;
+}
+
+/*******************
+ *     PROGRAM     *
+ *******************/
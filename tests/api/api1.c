@@ -0,0 +1,90 @@
+/*
+ * Uses the embedding API over and over, with runs and loads which fail
+ * half way, and checks that the memory of the process stays bounded.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "lang.h"
+
+#define WARMUP 20
+#define ROUNDS 100
+#define MAX_GROWTH (512 * 1024)  // bytes
+
+const char * PROGRAM =
+    "(def f n (? (= n 0) 0 (+ 1 (f (- n 1)))))\n"
+    "(let s \"hello world\")\n"
+    "(print (f 2000))\n"
+    "(print (@ (@ s 2) 2))\n"
+    "(print (match (read_int) 1 : \"one\" 2 : \"two\" ANY : \"many\"))\n";
+
+// fails deep inside the recursion, with everything it made still in use:
+const char * FAILING =
+    "(def f n (? (= n 0) (undefined 1) (+ 1 (f (- n 1)))))\n"
+    "(print (f 2000))\n";
+
+// fails half way through parsing:
+const char * UNPARSABLE = "(def g x (+ x \"a\" [1 2 (3";
+
+size_t read_source(void * data, char * buf, size_t len)
+{
+    const char ** pos = data;
+    size_t n = strlen(*pos);
+    if (n > len) n = len;
+    memcpy(buf, *pos, n);
+    *pos += n;
+    return n;
+}
+
+size_t resident_bytes(void)
+{
+    unsigned long size = 0, resident = 0;
+    FILE * fp = fopen("/proc/self/statm", "r");
+    if (fp == NULL) return 0;
+    if (fscanf(fp, "%lu %lu", &size, &resident) != 2) resident = 0;
+    fclose(fp);
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+int round_trip(Interp * in, int i)
+{
+    // Returns 0 if every call did what was expected.
+    if (lang_load(in, PROGRAM) != 0) return 1;
+    if (lang_run(in, "2") != 0 || strcmp(lang_output(in), "2000\nllo world\ntwo\n") != 0) return 2;
+    if (lang_load(in, UNPARSABLE) == 0) return 3;
+    if (lang_load(in, FAILING) != 0) return 4;
+    if (lang_run(in, "") == 0) return 5;
+    const char * pos = i % 2 == 0 ? PROGRAM : FAILING;
+    if ((lang_run_stream(in, read_source, &pos, "3") == 0) != (i % 2 == 0)) return 6;
+
+    // and an interpreter of its own, which fails:
+    Interp * other = lang_create();
+    if (other == NULL) return 7;
+    lang_set_limits(other, 0, 64 * 1024);
+    if (lang_load(other, PROGRAM) != 0) return 8;
+    if (lang_run(other, "1") != LANG_OUT_OF_MEMORY) return 9;
+    lang_destroy(other);
+    return 0;
+}
+
+int main(void)
+{
+    Interp * in = lang_create();
+    size_t before = 0;
+    for (int i = 0; i < WARMUP + ROUNDS; i++) {
+        if (i == WARMUP) before = resident_bytes();
+        int failed = round_trip(in, i);
+        if (failed) {
+            printf("round %d failed at step %d: %s", i, failed, lang_error(in));
+            return 1;
+        }
+    }
+    size_t after = resident_bytes();
+    lang_destroy(in);
+    if (after > before + MAX_GROWTH) {
+        printf("memory grew by %zu bytes in %d rounds\n", after - before, ROUNDS);
+        return 1;
+    }
+    printf("memory stayed bounded\n");
+    return 0;
+}
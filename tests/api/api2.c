@@ -0,0 +1,83 @@
+/*
+ * Runs programs into the step, heap and time limits, and checks that each
+ * stops with its own status, and that the limits start afresh on every run.
+ */
+#include <stdio.h>
+#include <string.h>
+#include "lang.h"
+
+#define RERUNS 60
+
+const char * DEEP =
+    "(def f n (? (= n 0) 0 (+ 1 (f (- n 1)))))\n"
+    "(print (f (read_int)))\n";
+
+// fails deep inside the recursion, with everything it made still in use:
+const char * FAILING =
+    "(def f n (? (= n 0) (undefined 1) (+ 1 (f (- n 1)))))\n"
+    "(print (f 5000))\n";
+
+// (takes far too long, without running out of stack)
+const char * SLOW =
+    "(def fib n (? (= n 0) 0 (? (= n 1) 1 (+ (fib (- n 1)) (fib (- n 2))))))\n"
+    "(print (fib 60))\n";
+
+int expect_status(Interp * in, const char * what, int status, int expected)
+{
+    // Returns 0 if the status is as expected.
+    if (status == expected) return 0;
+    printf("%s: got status %d instead of %d: %s", what, status, expected, lang_error(in));
+    return 1;
+}
+
+int main(void)
+{
+    Interp * in = lang_create();
+    int failed = 0;
+    LangStats stats;
+
+    // steps:
+    lang_set_limits(in, 1000, 0);
+    lang_load(in, DEEP);
+    failed |= expect_status(in, "fuel", lang_run(in, "2000"), LANG_OUT_OF_FUEL);
+    if (strstr(lang_error(in), "Step limit of 1000 exceeded") == NULL ||
+            strstr(lang_error(in), "steps: 1001") == NULL) {
+        printf("fuel: unexpected error: %s", lang_error(in));
+        failed = 1;
+    }
+    failed |= expect_status(in, "fuel, enough", lang_run(in, "10"), LANG_OK);
+    printf("%s", lang_output(in));
+
+    // heap:
+    lang_set_limits(in, 0, 256 * 1024);
+    failed |= expect_status(in, "heap", lang_run(in, "100000"), LANG_OUT_OF_MEMORY);
+    lang_get_stats(in, &stats);
+    if (strstr(lang_error(in), "Heap limit of 262144 bytes exceeded") == NULL ||
+            stats.peak_heap_bytes > 256 * 1024 || stats.heap_bytes != 0) {
+        printf("heap: unexpected error or stats: %s", lang_error(in));
+        failed = 1;
+    }
+    failed |= expect_status(in, "heap, enough", lang_run(in, "100"), LANG_OK);
+    printf("%s", lang_output(in));
+
+    // time:
+    lang_set_limits(in, 0, 0);
+    lang_set_timeout(in, 50);
+    lang_load(in, SLOW);
+    failed |= expect_status(in, "timeout", lang_run(in, ""), LANG_TIMEOUT);
+    lang_set_timeout(in, 0);
+
+    // the heap limit holds for each run, however many went before (or failed):
+    lang_set_limits(in, 0, 20 * 1024 * 1024);
+    for (int i = 0; i < RERUNS && !failed; i++) {
+        lang_load(in, FAILING);
+        failed |= expect_status(in, "failing rerun", lang_run(in, ""), LANG_ERROR);
+        lang_load(in, DEEP);
+        failed |= expect_status(in, "rerun", lang_run(in, "5000"), LANG_OK);
+    }
+    printf("%s", lang_output(in));
+
+    lang_destroy(in);
+    printf(failed ? "failed\n" : "ok\n");
+    return failed;
+}
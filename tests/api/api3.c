@@ -0,0 +1,97 @@
+/*
+ * Loads programs through the parse cache: a miss stores an entry, a hit
+ * runs what the entry holds, and a corrupt entry is parsed again and
+ * replaced, without failing the load.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include "lang.h"
+
+const char * FIRST = "(print \"first\")\n";
+const char * SECOND = "(print \"second\")\n";
+
+char dir[] = "/tmp/lang_cache_XXXXXX";
+
+int entry_path(char * path, size_t size, const char * except)
+{
+    // The path of the (only) entry not called except; returns 0 if there is one.
+    DIR * d = opendir(dir);
+    struct dirent * ent;
+    int found = 1;
+    while (d != NULL && (ent = readdir(d)) != NULL) {
+        if (ent->d_name[0] == '.' || (except != NULL && strstr(except, ent->d_name) != NULL)) continue;
+        snprintf(path, size, "%s/%s", dir, ent->d_name);
+        found = 0;
+    }
+    if (d != NULL) closedir(d);
+    return found;
+}
+
+size_t read_entry(const char * path, char * buf, size_t size)
+{
+    FILE * fp = fopen(path, "rb");
+    if (fp == NULL) return 0;
+    size_t len = fread(buf, 1, size, fp);
+    fclose(fp);
+    return len;
+}
+
+void write_entry(const char * path, const char * data, size_t len)
+{
+    FILE * fp = fopen(path, "wb");
+    fwrite(data, 1, len, fp);
+    fclose(fp);
+}
+
+int load_and_run(Interp * in, const char * source)
+{
+    // Prints the output; returns 0 if the program was loaded and ran.
+    if (lang_load(in, source) != 0 || lang_run(in, "") != 0) {
+        printf("failed: %s", lang_error(in));
+        return 1;
+    }
+    printf("%s", lang_output(in));
+    return 0;
+}
+
+int main(void)
+{
+    char first[4096], second[4096];
+    char first_entry[4096], second_entry[4096], entry[4096];
+    if (mkdtemp(dir) == NULL) return 1;
+    Interp * in = lang_create();
+    lang_set_cache_dir(in, dir);
+    int failed = 0;
+
+    // misses store entries:
+    failed |= load_and_run(in, FIRST);
+    failed |= entry_path(first, sizeof(first), NULL);
+    size_t first_len = read_entry(first, first_entry, sizeof(first_entry));
+    failed |= load_and_run(in, SECOND);
+    failed |= entry_path(second, sizeof(second), first);
+    size_t second_len = read_entry(second, second_entry, sizeof(second_entry));
+
+    // a hit runs the entry (here, of the other program) rather than the source:
+    write_entry(first, second_entry, second_len);
+    failed |= load_and_run(in, FIRST);
+
+    // corrupt entries are parsed again, and replaced:
+    write_entry(first, "garbage", 7);
+    failed |= load_and_run(in, FIRST);
+    failed |= read_entry(first, entry, sizeof(entry)) != first_len ||
+              memcmp(entry, first_entry, first_len) != 0;
+    write_entry(first, first_entry, first_len / 2);
+    failed |= load_and_run(in, FIRST);
+    failed |= read_entry(first, entry, sizeof(entry)) != first_len ||
+              memcmp(entry, first_entry, first_len) != 0;
+
+    lang_destroy(in);
+    unlink(first);
+    unlink(second);
+    rmdir(dir);
+    printf(failed ? "failed\n" : "ok\n");
+    return failed;
+}
@@ -0,0 +1,130 @@
+/*
+ * Stops a run with a checkpoint part way through, resumes it in another
+ * interpreter, and checks that the output is the same as a run which was
+ * never stopped; and that bad checkpoints fail cleanly.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "lang.h"
+
+const char * PROGRAM =
+    "(def fact n (? (= n 0) 1 (* n (fact (- n 1)))))\n"
+    "(def empty s 7)\n"  // (the prelude's sum keeps its own)
+    "(let n (read_int))\n"
+    "(let xs [1 2 3 n])\n"
+    "(print (sum xs))\n"
+    "(print (fact 30))\n"
+    "(print (empty xs))\n"
+    "(let s \"checkpoint\")\n"
+    "(print (@ s 2))\n"
+    "(def twice x (* 2 x))\n"
+    "(print (twice n))\n"
+    "(print (count 1 [1 2 1]))\n"
+    "(print (match n 4 : \"four\" ANY : \"other\"))\n"
+    // (a list whose items are parameters passed straight through, evaluated in turn)
+    "(def pair a b [a b])\n"
+    "(def pass x y (pair x y))\n"
+    "(let p (pass n (fact 3)))\n"
+    "(print (get p 0))\n"
+    "(print (get p 1))\n";
+
+const char * INPUT = "4";
+char CHECKPOINT[] = "/tmp/lang_checkpoint_XXXXXX";
+
+struct Output {
+    Interp * in;
+    char text[4096];
+    size_t len;
+    int lines;
+    int stop_after;  // lines, or 0 to never stop
+} typedef Output;
+
+void collect(void * data, const char * buf, size_t len)
+{
+    Output * out = data;
+    if (out->len + len < sizeof(out->text)) {
+        memcpy(out->text + out->len, buf, len);
+        out->len += len;
+        out->text[out->len] = '\0';
+    }
+    for (size_t i = 0; i < len; i++) out->lines += buf[i] == '\n';
+    if (out->stop_after != 0 && out->lines == out->stop_after) lang_request_checkpoint(out->in, 1);
+}
+
+Interp * new_interp(Output * out, int stop_after)
+{
+    memset(out, 0, sizeof(Output));
+    out->in = lang_create();
+    out->stop_after = stop_after;
+    lang_set_output(out->in, collect, out);
+    lang_load(out->in, PROGRAM);
+    return out->in;
+}
+
+int main(void)
+{
+    int failed = 0;
+    Output full, first, rest;
+    int fd = mkstemp(CHECKPOINT);
+    if (fd == -1) return 1;
+    close(fd);
+
+    Interp * in = new_interp(&full, 0);
+    failed |= lang_run(in, INPUT) != LANG_OK;
+    lang_destroy(in);
+    printf("%s", full.text);
+
+    // stopped after each line in turn, and resumed:
+    for (int stop = 1; stop < full.lines && !failed; stop++) {
+        in = new_interp(&first, stop);
+        lang_set_checkpoint(in, CHECKPOINT, 0);
+        int status = lang_run(in, INPUT);
+        lang_destroy(in);
+        if (status != LANG_STOPPED) {
+            printf("stop %d: got status %d\n", stop, status);
+            failed = 1;
+            break;
+        }
+        in = new_interp(&rest, 0);
+        status = lang_resume(in, CHECKPOINT, INPUT);
+        lang_destroy(in);
+        char joined[sizeof(first.text) * 2];
+        snprintf(joined, sizeof(joined), "%s%s", first.text, rest.text);
+        if (status != LANG_OK || strcmp(joined, full.text) != 0) {
+            printf("stop %d: resumed with status %d and output:\n%s", stop, status, joined);
+            failed = 1;
+        }
+    }
+
+    // saved every so many steps, and resumed from the last one:
+    in = new_interp(&first, 0);
+    lang_set_checkpoint(in, CHECKPOINT, 10);
+    failed |= lang_run(in, INPUT) != LANG_OK;
+    lang_destroy(in);
+    in = new_interp(&rest, 0);
+    failed |= lang_resume(in, CHECKPOINT, INPUT) != LANG_OK;
+    lang_destroy(in);
+    if (rest.len > full.len || strcmp(full.text + full.len - rest.len, rest.text) != 0) {
+        printf("periodic: resumed with output:\n%s", rest.text);
+        failed = 1;
+    }
+
+    // a truncated checkpoint, and one which doesn't exist:
+    FILE * fp = fopen(CHECKPOINT, "r+");
+    if (fp != NULL) {
+        fseek(fp, 0, SEEK_END);
+        long size = ftell(fp);
+        fclose(fp);
+        if (truncate(CHECKPOINT, size / 2) != 0) failed = 1;
+    }
+    in = new_interp(&rest, 0);
+    failed |= lang_resume(in, CHECKPOINT, INPUT) != LANG_ERROR;
+    remove(CHECKPOINT);
+    failed |= lang_resume(in, CHECKPOINT, INPUT) != LANG_ERROR;
+    lang_destroy(in);
+
+    printf(failed ? "failed\n" : "ok\n");
+    return failed;
+}
@@ -0,0 +1,87 @@
+/*
+ * Loads sources large enough to be parsed on several threads, and checks
+ * that they run and fail just as they do when parsed on one thread.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lang.h"
+
+#define STATEMENTS 1000  // (about 1.1MB of source, so just large enough)
+#define PADDING 1000    // characters of a string in each list
+#define THREADS 4
+
+const char * name(char prefix, int i)
+{
+    // (names can't have digits, so i is written in letters)
+    static char names[2][16];
+    char * s = names[prefix == 'f'];
+    int len = 0;
+    s[len++] = prefix;
+    do {
+        s[len++] = 'a' + i % 26;
+        i /= 26;
+    } while (i != 0);
+    s[len] = '\0';
+    return s;
+}
+
+char * make_source(const char * middle, const char * end)
+{
+    // Each statement uses what the ones before it defined, wherever the splits fall.
+    size_t size = STATEMENTS * (128 + PADDING) + strlen(middle) + strlen(end) + 1;
+    char * source = malloc(size);
+    size_t len = 0;
+    len += sprintf(source + len, "(let %s 0)\n", name('v', 0));
+    for (int i = 1; i < STATEMENTS; i++) {
+        if (i == STATEMENTS / 2) len += sprintf(source + len, "%s", middle);
+        len += sprintf(source + len, "; (statement %d\n", i);
+        len += sprintf(source + len, "(def %s x [(+ x %d) \"(%d) ;\" \"", name('f', i), i % 7, i);
+        for (int j = 0; j < PADDING; j++) source[len++] = "([;)] "[j % 6];
+        len += sprintf(source + len, "\"])\n");
+        len += sprintf(source + len, "(let %s ", name('v', i));
+        len += sprintf(source + len, "(get (%s %s) 0))\n", name('f', i), name('v', i - 1));
+        if (i % 250 == 0) len += sprintf(source + len, "(print (get (%s 0) 1))\n", name('f', i));
+    }
+    sprintf(source + len, "(print %s)\n%s", name('v', STATEMENTS - 1), end);
+    return source;
+}
+
+int load_and_run(int threads, const char * source, char * result, size_t size)
+{
+    // Writes the output, or the error, to result; returns the status.
+    Interp * in = lang_create();
+    lang_set_parse_threads(in, threads);
+    int status = lang_load(in, source);
+    if (status == LANG_OK) status = lang_run(in, "");
+    snprintf(result, size, "%s", status == LANG_OK ? lang_output(in) : lang_error(in));
+    lang_destroy(in);
+    return status;
+}
+
+int compare(const char * what, const char * middle, const char * end)
+{
+    // Prints the result; returns 0 if it is the same on one thread as on several.
+    char one[4096], several[4096];
+    char * source = make_source(middle, end);
+    int status = load_and_run(1, source, one, sizeof(one));
+    int parallel_status = load_and_run(THREADS, source, several, sizeof(several));
+    free(source);
+    printf("%s: %s", what, one);
+    if (status == parallel_status && strcmp(one, several) == 0) return 0;
+    printf("%s: on %d threads, got status %d instead of %d, and:\n%s",
+           what, THREADS, parallel_status, status, several);
+    return 1;
+}
+
+int main(void)
+{
+    int failed = 0;
+    failed |= compare("program", "", "");
+    failed |= compare("error at the end", "", "(print (+ 1 2)");
+    failed |= compare("errors in the middle and at the end", "(def f x [1 2)\n", "(print (+ 1 2)");
+    failed |= compare("unbalanced in the middle", "(print 1))\n", "");
+    failed |= compare("unterminated string at the end", "", "(print \"abc)\n");
+    printf(failed ? "failed\n" : "ok\n");
+    return failed;
+}
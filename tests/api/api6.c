@@ -0,0 +1,158 @@
+/*
+ * Streams programs a few bytes at a time, so that tokens, strings and forms
+ * are split between reads, and checks that they run as they do when loaded
+ * whole, that output starts before the source ends, and that errors part
+ * way through stop the stream with the same error.
+ */
+#include <stdio.h>
+#include <string.h>
+#include "lang.h"
+
+const char * PROGRAM =
+    "; a comment with a ( in it\n"
+    "(def fact n (? (= n 0) 1 (* n (fact (- n 1)))))\n"
+    "(print \"started (early) ; not a comment\")\n"
+    "(def empty s 7)\n"  // (the prelude's sum keeps its own)
+    "(let n (read_int))\n"
+    "(let xs [1 2 [3 \"]\"] n])\n"
+    "(print xs)\n"
+    "(print (sum [1 2 3 n]))\n"
+    "(print (fact 25))\n"
+    "(print 123456789012345678901234567890)\n"
+    "(print (empty xs))\n"
+    "(def longer_name_than_any_read x (+ x 1))\n"
+    "(print (longer_name_than_any_read n))\n"
+    "(print (match n 4 : \"four\" ANY : \"other\"))\n";
+
+const char * INPUT = "4";
+
+struct Stream {
+    const char * source;
+    size_t pos;
+    size_t chunk;      // the most returned by a read
+    size_t pos_at_output;  // how much had been read when the first output came
+    char output[4096];
+    size_t len;
+} typedef Stream;
+
+size_t read_chunk(void * data, char * buf, size_t len)
+{
+    Stream * s = data;
+    size_t n = strlen(s->source + s->pos);
+    if (n > s->chunk) n = s->chunk;
+    if (n > len) n = len;
+    memcpy(buf, s->source + s->pos, n);
+    s->pos += n;
+    return n;
+}
+
+void collect(void * data, const char * buf, size_t len)
+{
+    Stream * s = data;
+    if (s->len == 0) s->pos_at_output = s->pos;
+    if (s->len + len < sizeof(s->output)) {
+        memcpy(s->output + s->len, buf, len);
+        s->len += len;
+        s->output[s->len] = '\0';
+    }
+}
+
+int stream(const char * source, size_t chunk, Stream * s, char * error, size_t size)
+{
+    // Returns the status, and the error in error.
+    memset(s, 0, sizeof(Stream));
+    s->source = source;
+    s->chunk = chunk;
+    Interp * in = lang_create();
+    lang_set_output(in, collect, s);
+    int status = lang_run_stream(in, read_chunk, s, INPUT);
+    snprintf(error, size, "%s", lang_error(in));
+    lang_destroy(in);
+    return status;
+}
+
+int load_and_run(const char * source, char * output, size_t size)
+{
+    // Returns the status, and the output or error in output.
+    Interp * in = lang_create();
+    int status = lang_load(in, source);
+    if (status == LANG_OK) status = lang_run(in, INPUT);
+    snprintf(output, size, "%s", status == LANG_OK ? lang_output(in) : lang_error(in));
+    lang_destroy(in);
+    return status;
+}
+
+int check(const char * what, const char * source, const char * output, const char * error)
+{
+    // Returns 0 if streaming the source, in chunks of every size, gives output and error.
+    Stream s;
+    char streamed_error[512];
+    for (size_t chunk = 1; chunk <= strlen(source); chunk++) {
+        int status = stream(source, chunk, &s, streamed_error, sizeof(streamed_error));
+        if (status != (error[0] == '\0' ? LANG_OK : LANG_ERROR) ||
+                strcmp(s.output, output) != 0 || strcmp(streamed_error, error) != 0) {
+            printf("%s: in chunks of %zu, got status %d, output:\n%serror: %s",
+                   what, chunk, status, s.output, streamed_error);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main(void)
+{
+    int failed = 0;
+    char output[4096], error[512], source[4096];
+    Stream s;
+
+    // the whole program, as lang_load() and lang_run() run it:
+    failed |= load_and_run(PROGRAM, output, sizeof(output)) != LANG_OK;
+    printf("%s", output);
+    failed |= check("program", PROGRAM, output, "");
+
+    // whose output starts before the source is all read:
+    stream(PROGRAM, 16, &s, error, sizeof(error));
+    if (s.pos_at_output == 0 || s.pos_at_output >= strlen(PROGRAM)) {
+        printf("the first output came after reading %zu bytes\n", s.pos_at_output);
+        failed = 1;
+    }
+
+    // a parse error part way through, which stops the stream there:
+    snprintf(source, sizeof(source), "%s(print (+ 1 2 3))\n(print \"never\")\n", PROGRAM);
+    load_and_run(source, error, sizeof(error));
+    printf("%s", error);
+    failed |= check("parse error", source, output, error);
+    stream(source, 1, &s, error, sizeof(error));
+    failed |= s.pos >= strlen(source);
+
+    // a program which fails while it runs, after some output:
+    snprintf(source, sizeof(source), "%s(print (undefined 1))\n(print \"never\")\n", PROGRAM);
+    load_and_run(source, error, sizeof(error));
+    printf("%s", error);
+    failed |= check("runtime error", source, output, error);
+
+    // a form cut short at the end of the source:
+    snprintf(source, sizeof(source), "%s(print [1 \"2", PROGRAM);
+    load_and_run(source, error, sizeof(error));
+    printf("%s", error);
+    failed |= check("unfinished", source, output, error);
+
+    // and an unbalanced bracket, where the program ends as if it were the end:
+    snprintf(source, sizeof(source), "%s)\n(print \"never\")\n", PROGRAM);
+    failed |= check("unbalanced", source, output, "");
+
+    // a streamed program is not left loaded, even in part:
+    Interp * in = lang_create();
+    memset(&s, 0, sizeof(Stream));
+    s.source = PROGRAM;
+    s.chunk = 64;
+    failed |= lang_run_stream(in, read_chunk, &s, INPUT) != LANG_OK;
+    failed |= lang_run(in, INPUT) != LANG_ERROR;
+    printf("%s", lang_error(in));
+    failed |= lang_load(in, PROGRAM) != LANG_OK || lang_run(in, INPUT) != LANG_OK ||
+              strcmp(lang_output(in), output) != 0;
+    lang_destroy(in);
+
+    printf(failed ? "failed\n" : "ok\n");
+    return failed;
+}
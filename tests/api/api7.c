@@ -0,0 +1,57 @@
+/*
+ * Keeps the result of a deep recursion, whose parameters are passed down
+ * from frame to frame, while running another one, and checks that the peak
+ * heap is not much more than that of one: the result must not keep the
+ * frames it was made in alive.
+ */
+#include <stdio.h>
+#include <string.h>
+#include "lang.h"
+
+#define DEPTH "2000"
+
+// Each frame holds a list of its own, which the frames below don't need.
+// x is passed straight through, y is evaluated on the way down:
+const char * FUNCTIONS =
+    "(def big n [n 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20])\n"
+    "(def pass n x (do (let b (big n)) (? (= (len b) (+ n 21)) [x] (pass (- n 1) x))))\n"
+    "(def eval n y (do (let b (big n)) (? (= (len b) (+ n (- 21 (* 0 y)))) [y] (eval (- n 1) (+ y 0)))))\n";
+
+size_t peak(const char * f, int twice)
+{
+    // The peak heap of running f to the depth (twice, keeping the first result).
+    char source[4096];
+    snprintf(source, sizeof(source),
+             twice ? "%s(let a (%s " DEPTH " 1))\n(let c (%s " DEPTH " 2))\n(print (+ (get a 0) (get c 0)))\n"
+                   : "%s(let a (%s " DEPTH " 1))\n(print (get a 0))\n",
+             FUNCTIONS, f, f);
+    Interp * in = lang_create();
+    LangStats stats;
+    stats.peak_heap_bytes = 0;
+    if (lang_load(in, source) == LANG_OK && lang_run(in, "") == LANG_OK) {
+        printf("%s", lang_output(in));
+        lang_get_stats(in, &stats);
+    } else {
+        printf("%s", lang_error(in));
+    }
+    lang_destroy(in);
+    return stats.peak_heap_bytes;
+}
+
+int check(const char * f)
+{
+    // Returns 0 if a kept result adds little to the peak.
+    size_t once = peak(f, 0), twice = peak(f, 1);
+    if (once != 0 && twice < once + once / 4) return 0;
+    printf("%s: the peak heap went from %zu bytes to %zu\n", f, once, twice);
+    return 1;
+}
+
+int main(void)
+{
+    int failed = 0;
+    failed |= check("pass");
+    failed |= check("eval");
+    printf(failed ? "failed\n" : "ok\n");
+    return failed;
+}
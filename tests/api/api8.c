@@ -0,0 +1,167 @@
+/*
+ * Stops runs in the middle of long top-level statements, with a checkpoint
+ * made at a call inside them, resumes them (even twice), and checks that the
+ * output is the same as a run which was never stopped, and that the statement
+ * was continued rather than run again.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "lang.h"
+
+// Each of the long statements below is a single deep evaluation, with 'let's
+// evaluated part way through it, parameters passed straight through, lists
+// whose items are evaluated late, and output made in the middle of it:
+const char * PROGRAM =
+    "(def fib n (do\n"
+    "    (let a (? (= (/ n 2) 0) 0 (fib (- n 1))))\n"
+    "    (let b (? (= (/ n 2) 0) 0 (fib (- n 2))))\n"
+    "    (match n 0 : 0 1 : 1 ANY : (+ a b))))\n"
+    "(def pair a b [a b])\n"
+    "(def pass x y (pair x y))\n"
+    "(def walk xs n (? (= n 0) (sum xs) (walk [(fib (/ n 2)) (head xs) (sum (tail xs))] (- n 1))))\n"
+    "(let n (read_int))\n"
+    "(print \"start\")\n"
+    "(print (fib n))\n"
+    "(let p (pass (fib (- n 1)) (sum [1 2 3])))\n"
+    "(print (+ (get p 0) (get p 1)))\n"
+    "(print (do (print \"inside\") (let q (fib (- n 2))) (print_each [q (fib 5) (read_int)]) (walk [1 2 3] 12)))\n"
+    "(print \"end\")\n";
+
+const char * INPUT = "15 7";
+#define POINTS 24  // where runs are stopped by the step limit
+char CHECKPOINT[] = "/tmp/lang_checkpoint_XXXXXX";
+
+struct Output {
+    Interp * in;
+    char text[4096];
+    size_t len;
+    int lines;
+    int stop_after;  // lines, or 0 to never stop
+} typedef Output;
+
+void collect(void * data, const char * buf, size_t len)
+{
+    Output * out = data;
+    if (out->len + len < sizeof(out->text)) {
+        memcpy(out->text + out->len, buf, len);
+        out->len += len;
+        out->text[out->len] = '\0';
+    }
+    for (size_t i = 0; i < len; i++) out->lines += buf[i] == '\n';
+    if (out->stop_after != 0 && out->lines == out->stop_after) lang_request_checkpoint(out->in, 1);
+}
+
+Interp * new_interp(Output * out, int stop_after)
+{
+    memset(out, 0, sizeof(Output));
+    out->in = lang_create();
+    out->stop_after = stop_after;
+    lang_set_output(out->in, collect, out);
+    lang_load(out->in, PROGRAM);
+    return out->in;
+}
+
+unsigned long long steps(Interp * in)
+{
+    LangStats stats;
+    lang_get_stats(in, &stats);
+    return stats.steps;
+}
+
+int check_rest(const char * what, Output * full, Output * first, Output * rest)
+{
+    // Returns 0 if the output before and after the checkpoint make up the full
+    // output (what was printed after the checkpoint, before the run was
+    // stopped, is printed again).
+    if (strncmp(first->text, full->text, first->len) == 0 && rest->len <= full->len &&
+            first->len + rest->len >= full->len &&
+            strcmp(full->text + full->len - rest->len, rest->text) == 0) {
+        return 0;
+    }
+    printf("%s: stopped with output:\n%sresumed with output:\n%s", what, first->text, rest->text);
+    return 1;
+}
+
+int main(void)
+{
+    int failed = 0;
+    Output full, first, rest;
+    int fd = mkstemp(CHECKPOINT);
+    if (fd == -1) return 1;
+    close(fd);
+
+    Interp * in = new_interp(&full, 0);
+    failed |= lang_run(in, INPUT) != LANG_OK;
+    unsigned long long total = steps(in);
+    lang_destroy(in);
+    printf("%s", full.text);
+
+    // stopped on request after each line in turn (at the next call, when
+    // the line was printed in the middle of a statement), and resumed:
+    for (int stop = 1; stop < full.lines && !failed; stop++) {
+        in = new_interp(&first, stop);
+        lang_set_checkpoint(in, CHECKPOINT, 0);
+        int status = lang_run(in, INPUT);
+        lang_destroy(in);
+        in = new_interp(&rest, 0);
+        int resumed = lang_resume(in, CHECKPOINT, INPUT);
+        lang_destroy(in);
+        char joined[sizeof(first.text) * 2];
+        snprintf(joined, sizeof(joined), "%s%s", first.text, rest.text);
+        if (status != LANG_STOPPED || resumed != LANG_OK || strcmp(joined, full.text) != 0) {
+            printf("stop %d: got status %d, resumed with status %d and output:\n%s",
+                   stop, status, resumed, joined);
+            failed = 1;
+        }
+    }
+
+    // saved every so many steps, stopped at a step limit, and resumed from the
+    // last checkpoint, which takes as many steps as were left (and a few more
+    // to replay the statement up to the call it was saved at):
+    unsigned long long every = total / POINTS / 4;
+    for (int point = 1; point < POINTS && !failed; point++) {
+        char what[64];
+        snprintf(what, sizeof(what), "point %d", point);
+        in = new_interp(&first, 0);
+        lang_set_checkpoint(in, CHECKPOINT, every);
+        lang_set_limits(in, total * point / POINTS, 0);
+        failed |= lang_run(in, INPUT) != LANG_OUT_OF_FUEL;
+        lang_destroy(in);
+        in = new_interp(&rest, 0);
+        failed |= lang_resume(in, CHECKPOINT, INPUT) != LANG_OK;
+        unsigned long long resumed = steps(in);
+        lang_destroy(in);
+        failed |= check_rest(what, &full, &first, &rest);
+        if (resumed < total || resumed > total + 1000) {
+            printf("%s: took %llu steps in all, instead of %llu\n", what, resumed, total);
+            failed = 1;
+        }
+    }
+
+    // and a resumed run saved again while it is still replaying, and stopped:
+    in = new_interp(&first, 0);
+    lang_set_checkpoint(in, CHECKPOINT, every);
+    lang_set_limits(in, total / 2, 0);
+    failed |= lang_run(in, INPUT) != LANG_OUT_OF_FUEL;
+    lang_destroy(in);
+    in = new_interp(&first, 0);
+    lang_set_checkpoint(in, CHECKPOINT, 1);
+    lang_set_limits(in, total / 2 + 20, 0);
+    failed |= lang_resume(in, CHECKPOINT, INPUT) != LANG_OUT_OF_FUEL;
+    lang_destroy(in);
+    in = new_interp(&rest, 0);
+    failed |= lang_resume(in, CHECKPOINT, INPUT) != LANG_OK;
+    unsigned long long resumed = steps(in);
+    lang_destroy(in);
+    if (rest.len == 0 || strcmp(full.text + full.len - rest.len, rest.text) != 0 ||
+            resumed < total || resumed > total + 1000) {
+        printf("twice: took %llu steps, with output:\n%s", resumed, rest.text);
+        failed = 1;
+    }
+
+    remove(CHECKPOINT);
+    printf(failed ? "failed\n" : "ok\n");
+    return failed;
+}
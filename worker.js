@@ -0,0 +1,136 @@
+// Runs the interpreter off the page's main thread.
+// Messages in:  { code: string }
+// Messages out: { type: 'ready', timing: { load: ms, cached: bool, build: string|null } }
+//               { type: 'output', chunks: [{ stream: 'stdout'|'stderr', text }] }
+//               { type: 'done', status: number }
+importScripts('lang.js');
+
+// compile.sh appends the hash of lang.wasm to lang.js as LANG_BUILD. It is in
+// the URL, so no cache (ours or the browser's) can serve an older build.
+var BUILD = typeof LANG_BUILD === 'string' ? LANG_BUILD : null;
+var WASM_URL = BUILD !== null ? 'lang.wasm?build=' + BUILD : 'lang.wasm';
+
+// run_code() is synchronous, so output is batched and flushed from the print
+// callbacks themselves, and from onFlush(), which the interpreter calls every
+// so many steps, at most once every FLUSH_INTERVAL milliseconds.
+var FLUSH_INTERVAL = 50;
+var pending = [];
+var lastFlush = 0;
+
+function flush() {
+    if (pending.length > 0) {
+        postMessage({ type: 'output', chunks: pending });
+        pending = [];
+    }
+    lastFlush = Date.now();
+}
+
+function flushIfDue() {
+    if (Date.now() - lastFlush >= FLUSH_INTERVAL) flush();
+}
+
+function emit(stream, text) {
+    pending.push({ stream: stream, text: text });
+    flushIfDue();
+}
+
+// The compiled module is kept in IndexedDB, keyed by the build, so that later
+// visits skip compiling it. Chrome (and current Firefox) can't store a
+// WebAssembly.Module there: put() throws a DataCloneError, so the lookup
+// always misses. They cache the code compileStreaming makes along with
+// lang.wasm in the HTTP cache instead, which the build in the URL keeps fresh.
+// Errors of any kind fall back to compiling.
+var DB_NAME = 'lang';
+var DB_STORE = 'modules';
+
+function openCache() {
+    return new Promise(function (resolve, reject) {
+        var req = indexedDB.open(DB_NAME, 1);
+        req.onupgradeneeded = function () { req.result.createObjectStore(DB_STORE); };
+        req.onsuccess = function () { resolve(req.result); };
+        req.onerror = function () { reject(req.error); };
+    });
+}
+
+function cacheGet(key) {
+    return openCache().then(function (db) {
+        return new Promise(function (resolve) {
+            var req = db.transaction(DB_STORE, 'readonly').objectStore(DB_STORE).get(key);
+            req.onsuccess = function () { resolve(req.result instanceof WebAssembly.Module ? req.result : null); };
+            req.onerror = function () { resolve(null); };
+        });
+    }).catch(function () { return null; });
+}
+
+function cachePut(key, module) {
+    openCache().then(function (db) {
+        var store = db.transaction(DB_STORE, 'readwrite').objectStore(DB_STORE);
+        store.clear();  // (older builds)
+        store.put(module, key);
+    }).catch(function () {});
+}
+
+function compileModule(key, signal) {
+    // Compiles while downloading, where the server sends application/wasm.
+    function download() {
+        return fetch(WASM_URL, { signal: signal }).then(function (res) { return res.arrayBuffer(); });
+    }
+    var compiled = WebAssembly.compileStreaming
+        ? WebAssembly.compileStreaming(fetch(WASM_URL, { signal: signal })).catch(function (err) {
+              if (signal && signal.aborted) throw err;
+              return download().then(WebAssembly.compile);
+          })
+        : download().then(WebAssembly.compile);
+    return compiled.then(function (module) {
+        if (key !== null) cachePut(key, module);
+        return module;
+    });
+}
+
+function loadModule(timing) {
+    // The compile starts alongside the lookup, so a miss costs no more than
+    // having no cache; a hit stops it.
+    if (BUILD === null) return compileModule(null);
+    var abort = typeof AbortController === 'function' ? new AbortController() : null;
+    var compiled = compileModule(BUILD, abort && abort.signal);
+    compiled.catch(function () {});  // (if aborted)
+    return cacheGet(BUILD).then(function (module) {
+        if (module === null) return compiled;
+        timing.cached = true;
+        if (abort !== null) abort.abort();
+        return module;
+    });
+}
+
+var start = performance.now();
+var timing = { load: 0, cached: false, build: BUILD };
+
+var langModule = MyCode({
+    'print': function (text) { emit('stdout', text); },
+    'printErr': function (text) { emit('stderr', text); },
+    'onFlush': flushIfDue,
+    'instantiateWasm': function (imports, receive) {
+        function instantiate(module) {
+            return WebAssembly.instantiate(module, imports).then(function (instance) {
+                receive(instance, module);
+            });
+        }
+        // (a cached module which doesn't fit the imports is compiled again)
+        loadModule(timing).then(instantiate).catch(function () {
+            timing.cached = false;
+            return compileModule(null).then(instantiate);
+        });
+        return {};  // (instantiated asynchronously)
+    },
+});
+
+langModule.then(function (Module) {
+    timing.load = performance.now() - start;
+    postMessage({ type: 'ready', timing: timing });
+    onmessage = function (e) {
+        lastFlush = 0;  // (the first output is shown at once)
+        var status = Module.ccall('run_code', 'number', ['string', 'string'], [e.data.code, '']);
+        flush();
+        postMessage({ type: 'done', status: status });
+    };
+});